@@ -0,0 +1,206 @@
+/**
+ * @file encoding.c
+ * @author Snyo
+ * @brief Benchmark body compression on recorded packets
+ *
+ * Recorded metric packets are cut into the packets the sender posts, 3
+ * samples of os and 2 of mysql, and compressed as JSON, as JSON by a
+ * schema as plugins send it, and in the binary format, with gzip and zstd,
+ * with and without cfg/metric.dict. The dictionary was trained on other
+ * recordings than these. Times of the binary format include encoding it.
+ *
+ * usage: bench_encoding [dictionary]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "encoding.h"
+#include "packet.h"
+#include "schema.h"
+#include "util.h"
+#include "wire.h"
+
+#define DICTIONARY "cfg/metric.dict"
+#define BENCH_MS   300
+
+static const struct {
+    const char *path;
+    int samples;
+} recorded[] = {
+    {"bench/data/os_metrics.json", 3},
+    {"bench/data/mysql_metrics.json", 2},
+};
+
+static const struct {
+    encoding_type type;
+    int level, dict;
+} cases[] = {
+    {IDENTITY, 0, 0},
+    {GZIP, 1, 0},
+    {GZIP, 6, 0},
+#ifdef HAVE_ZSTD
+    {ZSTD, 1, 0},
+    {ZSTD, 3, 0},
+    {ZSTD, 1, 1},
+    {ZSTD, 3, 1},
+    {ZSTD, 9, 1},
+#endif
+};
+
+static char *load(const char *path, long *size) {
+    FILE *fp = fopen(path, "rb");
+    if(!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = malloc(*size+1);
+    if(buf && fread(buf, 1, *size, fp) != (size_t)*size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    return buf;
+}
+
+/*
+ * Packets of 'k' samples of the "metrics" array, returns their count.
+ * With a schema samples are learned and written by it, as plugin_gather.
+ */
+static int split(const char *text, long size, int k, packet_t **pkts, int max, schema_t *s) {
+    const char *p = strstr(text, "\"metrics\":[");
+    if(!p) return 0;
+    p += strlen("\"metrics\":[");
+    int head = p - text, n = 0, samples = 0, depth = 0, quoted = 0;
+    packet_t *sample = packet_alloc(METRIC);
+
+    for(const char *start = p; p < text+size && n < max; p++) {
+        if(quoted) {
+            if(*p == '\\') p++;
+            else if(*p == '"') quoted = 0;
+            continue;
+        }
+        if(*p == '"') {
+            quoted = 1;
+        } else if(*p == '{' || *p == '[') {
+            depth++;
+        } else if((*p == '}' || *p == ']') && depth-- == 0) {
+            break;
+        } else if(*p == '}' && depth == 0) {
+            if(!samples) {
+                pkts[n] = packet_alloc(METRIC);
+                packet_write(pkts[n], text, head);
+            } else {
+                packet_write(pkts[n], ",", 1);
+            }
+            if(s) {
+                packet_reset(sample);
+                packet_write(sample, start, p+1 - start);
+                schema_learn(s, sample);
+                schema_write(s, sample, pkts[n]);
+            } else {
+                packet_write(pkts[n], start, p+1 - start);
+            }
+            if(++samples == k) {
+                packet_write(pkts[n], "]}", 2);
+                pkts[n++]->state = READY;
+                samples = 0;
+            }
+        } else if(*p == ',' && depth == 0) {
+            start = p+1;
+        }
+    }
+    if(samples)
+        packet_free(pkts[n]);
+    packet_free(sample);
+    return n;
+}
+
+static void bench(const char *path, int k, const void *dict, size_t dsize) {
+    static const char *formats[] = {"json", "schema", "binary"};
+    long size;
+    char *text = load(path, &size);
+    schema_t s;
+    schema_init(&s);
+    packet_t *pkts[2][64];  // As sent by keys and by the schema
+    int n = text ? split(text, size, k, pkts[0], 64, NULL) : 0;
+    if(!n || split(text, size, k, pkts[1], 64, &s) != n) {
+        fprintf(stderr, "Cannot read the metrics of %s\n", path);
+        free(text);
+        return;
+    }
+
+    wire_t w;
+    wire_init(&w);
+    unsigned long long json = 0, positional = 0, binary = 0;
+    for(int i=0; i<n; i++) {
+        json += pkts[0][i]->size;
+        positional += pkts[1][i]->size;
+        if(wire_encode(&w, pkts[0][i]) == 0)
+            binary += w.size;
+    }
+
+    printf("%s, %d packets of %d samples\n", path, n, k);
+    printf("%6s %8s %6s %5s %12s %8s %12s\n", "format", "encoding", "level", "dict", "B/packet", "ratio", "us/packet");
+    for(int f=0; f<3; f++) {
+        for(int c=0; c<sizeof(cases)/sizeof(cases[0]); c++) {
+            if(cases[c].dict && !dict) continue;
+
+            encoding_t e;
+            if(encoding_init(&e, cases[c].type, cases[c].dict ? dict : NULL, dsize, 1.0) < 0) {
+                fprintf(stderr, "Cannot initialize an encoder\n");
+                continue;
+            }
+            e.level = e.min = e.max = cases[c].level;
+
+            unsigned long long bytes = 0, iters = 0;
+            epoch_t begin = epoch_time();
+            do {
+                for(int i=0; i<n; i++) {
+                    packet_t *pkt = pkts[f == 1][i];
+                    size_t out;
+                    if(f == 2 && wire_encode(&w, pkt) < 0)
+                        continue;
+                    if(cases[c].type == IDENTITY)
+                        out = f == 2 ? w.size : pkt->size;
+                    else if((f == 2 ? encoding_buffer(&e, w.data, w.size) : encoding_packet(&e, pkt)) == 0)
+                        out = e.size;
+                    else
+                        continue;
+                    if(!iters) bytes += out;
+                }
+                iters++;
+            } while(epoch_time()-begin < BENCH_MS);
+            epoch_t elapsed = epoch_time()-begin;
+
+            printf("%6s %8s %6d %5s %12.1f %7.1fx %12.1f\n", formats[f],
+                    cases[c].type == GZIP ? "gzip" : cases[c].type == ZSTD ? "zstd" : "identity", cases[c].level,
+                    cases[c].dict ? "yes" : "no", (double)bytes/n, bytes ? (double)json/bytes : 0.0,
+                    (double)elapsed*1000/iters/n);
+            encoding_fini(&e);
+        }
+    }
+    printf("json %.1f B/packet, schema %.1f B/packet, binary %.1f B/packet, version %u\n\n",
+            (double)json/n, (double)positional/n, (double)binary/n, s.version);
+
+    wire_fini(&w);
+    schema_fini(&s);
+    for(int i=0; i<n; i++) {
+        packet_free(pkts[0][i]);
+        packet_free(pkts[1][i]);
+    }
+    free(text);
+}
+
+int main(int argc, char **argv) {
+    long dsize = 0;
+    char *dict = load(argc > 1 ? argv[1] : DICTIONARY, &dsize);
+    if(!dict)
+        fprintf(stderr, "No dictionary, zstd runs without one\n");
+
+    for(int i=0; i<sizeof(recorded)/sizeof(recorded[0]); i++)
+        bench(recorded[i].path, recorded[i].samples, dict, dsize);
+
+    free(dict);
+    return 0;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file innodb_status.c
+ * @author Snyo
+ * @brief Benchmark the SHOW ENGINE INNODB STATUS parser
+ *
+ * A captured monitor output is grown to 10KB - 1MB by repeating its
+ * transaction list, as on a server with many sessions, and parsed
+ * repeatedly. The previous strlen/strncmp scan is timed up to 100KB.
+ *
+ * usage: bench_innodb_status [status.txt]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "plugins/mysql/innodb.h"
+
+#define SAMPLE "bench/data/innodb_status.txt"
+#define BENCH_MS 300
+
+static char *load(const char *path, size_t *len) {
+    FILE *fp = fopen(path, "rb");
+    if(!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    *len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = malloc(*len+1);
+    if(buf && fread(buf, 1, *len, fp) != *len) {
+        free(buf);
+        buf = NULL;
+    }
+    if(buf) buf[*len] = '\0';
+    fclose(fp);
+    return buf;
+}
+
+/*
+ * Repeat the transaction list of the sample until 'size' bytes
+ */
+static char *grow(const char *sample, size_t len, size_t size) {
+    const char *list = strstr(sample, "LIST OF TRANSACTIONS FOR EACH SESSION:\n");
+    const char *tail = strstr(sample, "--------\nFILE I/O");
+    if(!list || !tail || size <= len) {
+        char *copy = strdup(sample);
+        return copy;
+    }
+    list = strchr(list, '\n') + 1;
+
+    char *buf = malloc(size+len+1), *p = buf;
+    memcpy(p, sample, list-sample);
+    p += list-sample;
+    while(p-buf + (tail-list) + (sample+len-tail) < size) {
+        memcpy(p, list, tail-list);
+        p += tail-list;
+    }
+    memcpy(p, tail, sample+len-tail);
+    p += sample+len-tail;
+    *p = '\0';
+    return buf;
+}
+
+/*
+ * The scan this parser replaced
+ */
+static unsigned long long old_scan(const char *text) {
+    unsigned long long total = 0, free = 0, used = 0;
+    for(int i=0; i<strlen(text); ++i)
+        if(strncmp(text+i, "Ibuf", 4) == 0)
+            sscanf(text+i, "Ibuf: size %llu, free list len %llu, seg size %llu", &used, &free, &total);
+    return total;
+}
+
+int main(int argc, char **argv) {
+    size_t len;
+    char *sample = load(argc > 1 ? argv[1] : SAMPLE, &len);
+    if(!sample) {
+        fprintf(stderr, "Cannot read %s\n", argc > 1 ? argv[1] : SAMPLE);
+        return 1;
+    }
+
+    size_t sizes[] = {10*BPKB, 100*BPKB, 1000*BPKB};
+    innodb_status_t st;
+
+    printf("%10s %8s %12s %10s %12s\n", "size", "trx", "parse(us)", "MB/s", "old(us)");
+    for(int s=0; s<sizeof(sizes)/sizeof(sizes[0]); s++) {
+        char *text = grow(sample, len, sizes[s]);
+        size_t n = strlen(text);
+
+        unsigned long iters = 0;
+        epoch_t begin = epoch_time();
+        while(epoch_time()-begin < BENCH_MS) {
+            innodb_status_parse(text, n, &st);
+            iters++;
+        }
+        double us = (double)(epoch_time()-begin) * 1000 / iters;
+
+        char old[32] = "-";
+        if(n <= 100*BPKB) {
+            unsigned long old_iters = 0;
+            begin = epoch_time();
+            do {
+                old_scan(text);
+                old_iters++;
+            } while(epoch_time()-begin < BENCH_MS);
+            snprintf(old, sizeof(old), "%.1f", (double)(epoch_time()-begin) * 1000 / old_iters);
+        }
+
+        printf("%9zuB %8lu %12.1f %10.1f %12s\n", n, st.trx_count, us, n/us, old);
+        free(text);
+    }
+
+    printf("\nhistory list length %llu, lsn %llu, checkpoint age %llu, semaphore waits %lu, deadlock %016llx (%s)\n",
+            st.history_list_length, st.lsn, st.lsn-st.checkpoint, st.semaphore_waits, st.deadlock.hash, st.deadlock.time);
+
+    free(sample);
+    return 0;
+}
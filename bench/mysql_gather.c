@@ -0,0 +1,214 @@
+/**
+ * @file mysql_gather.c
+ * @author Snyo
+ * @brief Benchmark mysql_gather against the stand-in server
+ *
+ * Starts bin/mysql_standin, loads the plugin the way plugin.conf does and
+ * runs gather ticks back to back. Every malloc of the process, including
+ * those of libmysqlclient, is counted by wrapping the libc allocator.
+ *
+ * usage: bench_mysql_gather [-p port] [-r rows] [-l latency_ms] [-n ticks] [-d] [-w file] [option=value ...]
+ *        -d prints the last packet to stderr
+ *        -w then gathers metric packets of SAMPLES ticks as plugin_gather
+ *           does, encodes them in the binary format and writes the last
+ *           one to 'file' and its JSON to 'file'.json
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "packet.h"
+#include "plugin.h"
+#include "util.h"
+#include "wire.h"
+
+#define STANDIN  "bin/mysql_standin"
+#define TICKS    200
+#define ROWS     "100"
+#define LATENCY  "0"
+#define PORT     "3307"
+#define SAMPLES  10
+#define BATCHES  5
+#define ENCODES  50
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void  __libc_free(void *);
+
+int load_mysql_module(plugin_t *p, int argc, char *argv[]);
+
+static volatile unsigned long long allocs, bytes;
+
+void *malloc(size_t size) {
+    __sync_fetch_and_add(&allocs, 1);
+    __sync_fetch_and_add(&bytes, size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    __sync_fetch_and_add(&allocs, 1);
+    __sync_fetch_and_add(&bytes, n*size);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __sync_fetch_and_add(&allocs, 1);
+    __sync_fetch_and_add(&bytes, size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+/*
+ * Metric packets as the sender gets them, in both formats
+ */
+static void encode(plugin_t *p, packet_t *pkt, const char *path) {
+    wire_t w;
+    wire_init(&w);
+    unsigned long long json = 0, binary = 0;
+    epoch_t spent = 0;
+
+    for(int b=0; b<BATCHES; b++) {
+        packet_reset(pkt);
+        packet_append(pkt, "{\"license\":\"%032d\",\"tid\":%llu,\"metrics\":[", 0, 1ULL);
+        for(int t=0; t<SAMPLES; t++) {
+            packet_transaction(pkt);
+            packet_append(pkt, "%s{\"timestamp\":%llu,", t?",":"", epoch_time());
+            if(packet_gather(pkt, "values", p->gather, p->module) == ENONE)
+                packet_append(pkt, "}");
+            else
+                packet_rollback(pkt);
+        }
+        packet_append(pkt, "]}");
+        pkt->state = READY;
+
+        epoch_t begin = epoch_time();
+        for(int e=0; e<ENCODES; e++) {
+            if(wire_encode(&w, pkt) < 0) {
+                fprintf(stderr, "Cannot encode the packet\n");
+                break;
+            }
+        }
+        spent += epoch_time() - begin;
+        json += pkt->size;
+        binary += w.size;
+        pkt->state = EMPTY;
+    }
+
+    printf("\n%d packets of %d samples\n", BATCHES, SAMPLES);
+    printf("%12s %12s %8s %12s %12s\n", "json B", "binary B", "ratio", "encode(us)", "MB/s");
+    printf("%12.1f %12.1f %7.1fx %12.1f %12.1f\n", (double)json/BATCHES, (double)binary/BATCHES, binary ? (double)json/binary : 0.0,
+            (double)spent*1000/BATCHES/ENCODES, spent ? (double)json*ENCODES/spent/1000 : 0.0);
+
+    char name[BFSZ*2];
+    snprintf(name, sizeof(name), "%s.json", path);
+    FILE *fp = fopen(path, "wb"), *text = fopen(name, "w");
+    if(fp && text) {
+        fwrite(w.data, 1, w.size, fp);
+        packet_print(pkt, text);
+        fprintf(text, "\n");
+    }
+    if(fp) fclose(fp);
+    if(text) fclose(text);
+    wire_fini(&w);
+}
+
+int main(int argc, char **argv) {
+    const char *port = PORT, *rows = ROWS, *latency = LATENCY;
+    const char *wire = NULL;
+    int ticks = TICKS, dump = 0;
+
+    int opt;
+    while((opt = getopt(argc, argv, "p:r:l:n:dw:")) != -1) {
+        switch(opt) {
+            case 'p': port = optarg; break;
+            case 'r': rows = optarg; break;
+            case 'l': latency = optarg; break;
+            case 'n': ticks = atoi(optarg); break;
+            case 'd': dump = 1; break;
+            case 'w': wire = optarg; break;
+            default:
+            fprintf(stderr, "usage: %s [-p port] [-r rows] [-l latency_ms] [-n ticks] [-d] [-w file] [option=value ...]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    pid_t standin = fork();
+    if(standin == 0) {
+        execl(STANDIN, STANDIN, "-p", port, "-r", rows, "-l", latency, (char *)NULL);
+        perror(STANDIN);
+        _exit(1);
+    }
+
+    // Arguments as sparse() hands them to the plugin
+    char args[10][BFSZ];
+    int nargs = 0;
+    snprintf(args[nargs++], BFSZ, "127.0.0.1/%s/bench/bench", port);
+    for(int i=optind; i<argc && nargs<10; i++)
+        snprintf(args[nargs++], BFSZ, "%s", argv[i]);
+
+    plugin_t p;
+    memset(&p, 0, sizeof(p));
+    if(load_mysql_module(&p, nargs, (char **)args) < 0) {
+        fprintf(stderr, "Cannot load the module with these options\n");
+        kill(standin, SIGTERM);
+        return 1;
+    }
+
+    int ready = 0;
+    for(int i=0; i<50 && !ready; i++) {
+        snyo_sleep(0.1);
+        ready = p.prep(p.module) == 0;
+    }
+    if(!ready) {
+        fprintf(stderr, "Cannot connect to the stand-in on port %s\n", port);
+        kill(standin, SIGTERM);
+        return 1;
+    }
+
+    packet_t *pkt = packet_alloc(METRIC);
+
+    unsigned long long size = 0, min = -1ULL, max = 0;
+    unsigned long long allocs0 = allocs, bytes0 = bytes;
+    int failed = 0;
+
+    epoch_t begin = epoch_time();
+    for(int t=0; t<ticks; t++) {
+        packet_reset(pkt);
+        packet_append(pkt, "{");
+        if(packet_gather(pkt, "values", p.gather, p.module) != ENONE)
+            failed++;
+
+        size += pkt->size;
+        if(pkt->size < min) min = pkt->size;
+        if(pkt->size > max) max = pkt->size;
+    }
+    epoch_t elapsed = epoch_time() - begin;
+    unsigned long long nallocs = allocs-allocs0, nbytes = bytes-bytes0;
+
+    printf("rows %s, latency %sms, %d ticks in %llums, %d without data\n", rows, latency, ticks, elapsed, failed);
+    printf("%12s %12s %14s %14s %12s %12s\n", "ticks/s", "allocs/tick", "alloc B/tick", "packet B/tick", "min B", "max B");
+    printf("%12.1f %12.1f %14.1f %14.1f %12llu %12llu\n",
+            elapsed ? ticks*1000.0/elapsed : 0.0, (double)nallocs/ticks, (double)nbytes/ticks, (double)size/ticks, min, max);
+
+    if(dump) {
+        packet_print(pkt, stderr);
+        fprintf(stderr, "}\n");
+    }
+
+    if(wire)
+        encode(&p, pkt, wire);
+
+    p.fini(p.module);
+    packet_free(pkt);
+    kill(standin, SIGTERM);
+    waitpid(standin, NULL, 0);
+
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file packet_escape.c
+ * @author Snyo
+ * @brief Benchmark escaped string columns against the printf path
+ *
+ * Statements shaped like those of a processlist or a slow log, from short
+ * point selects to long ORM queries spread over lines, are written as a
+ * column with "%s\"%.*s\"", which escapes nothing, with a byte-by-byte
+ * escaper and with packet_str.
+ *
+ * usage: bench_packet_escape [statements per column]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "escape.h"
+#include "packet.h"
+#include "util.h"
+
+#define STATEMENTS 1024
+#define BENCH_MS   300
+
+static const char *samples[] = {
+    "SELECT c FROM sbtest1 WHERE id=50123",
+    "UPDATE sbtest7 SET k=k+1 WHERE id=49871",
+    "INSERT INTO orders (customer_id, status, total, created_at) VALUES (8812, 'NEW', 129.90, NOW())",
+    "SELECT o.id, o.status, c.name, c.email FROM orders o JOIN customers c ON c.id = o.customer_id WHERE o.created_at > '2024-01-01 00:00:00' AND o.status IN ('NEW', 'PAID') ORDER BY o.created_at DESC LIMIT 50",
+    "SELECT\n    `t0`.`id` AS `id`,\n    `t0`.`name` AS `name`,\n    `t0`.`updated_at` AS `updated_at`\nFROM `product` `t0`\nWHERE `t0`.`category_id` = 12\n  AND `t0`.`deleted` = 0\nORDER BY `t0`.`updated_at` DESC\nLIMIT 20",
+    "/* app=billing,controller=invoice */ SELECT SUM(amount) FROM invoice_line WHERE invoice_id IN (1001,1002,1003,1004,1005,1006,1007,1008)",
+    "DELETE FROM session WHERE expires_at < NOW() - INTERVAL 1 DAY",
+    "SELECT * FROM audit_log WHERE message LIKE '%\"action\":\"login\"%' AND user_id = 42",
+    "CALL refresh_stats('daily', @rows)",
+    "COMMIT",
+};
+
+typedef void (*writer_t)(packet_t *pkt, const char **sql, const int *len, int n);
+
+static void printf_str(packet_t *pkt, const char **sql, const int *len, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_append(pkt, "%s\"%.*s\"", i?",":"", len[i], sql[i]);
+    packet_append(pkt, "]");
+}
+
+/*
+ * One byte at a time, as a plain escaper would
+ */
+static void scalar_str(packet_t *pkt, const char **sql, const int *len, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++) {
+        char buf[2048];
+        int o = 0;
+        if(i) buf[o++] = ',';
+        buf[o++] = '"';
+        for(int j=0; j<len[i]; j++) {
+            unsigned char c = sql[i][j];
+            if(c < 0x20 || c == '"' || c == '\\')
+                o += escape_seq(c, buf+o);
+            else
+                buf[o++] = c;
+        }
+        buf[o++] = '"';
+        packet_write(pkt, buf, o);
+    }
+    packet_append(pkt, "]");
+}
+
+static void packet_strs(packet_t *pkt, const char **sql, const int *len, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_str(pkt, i?',':0, sql[i], len[i]);
+    packet_append(pkt, "]");
+}
+
+/*
+ * Nanoseconds per statement
+ */
+static double run(writer_t w, packet_t *pkt, const char **sql, const int *len, int n) {
+    unsigned long iters = 0;
+    epoch_t begin = epoch_time();
+    while(epoch_time()-begin < BENCH_MS) {
+        packet_reset(pkt);
+        w(pkt, sql, len, n);
+        iters++;
+    }
+    return (double)(epoch_time()-begin) * 1000000 / iters / n;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : STATEMENTS;
+    if(n <= 0) n = STATEMENTS;
+
+    int nsamples = sizeof(samples)/sizeof(samples[0]);
+    const char **sql = malloc(n*sizeof(char *));
+    int *len = malloc(n*sizeof(int));
+    unsigned long long bytes = 0;
+    srand(42);
+    for(int i=0; i<n; i++) {
+        sql[i] = samples[rand()%nsamples];
+        len[i] = strlen(sql[i]);
+        bytes += len[i];
+    }
+
+    packet_t *pkt = packet_alloc(METRIC);
+    struct {
+        const char *name;
+        writer_t w;
+    } cases[] = {
+        {"printf", printf_str},
+        {"scalar", scalar_str},
+        {escape_impl(), packet_strs},
+    };
+
+    printf("%d statements per column, %.1f bytes each\n", n, (double)bytes/n);
+    printf("%10s %10s %10s %8s\n", "", "ns/stmt", "MB/s", "escaped");
+    for(int c=0; c<sizeof(cases)/sizeof(cases[0]); c++) {
+        double ns = run(cases[c].w, pkt, sql, len, n);
+        packet_reset(pkt);
+        cases[c].w(pkt, sql, len, n);
+        printf("%10s %10.1f %10.1f %8s\n", cases[c].name, ns, bytes/(double)n/ns*1000, c ? "yes" : "no");
+    }
+
+    packet_free(pkt);
+    free(sql);
+    free(len);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file packet_format.c
+ * @author Snyo
+ * @brief Benchmark number appenders against the printf path
+ *
+ * Columns of counters as gathers emit them, from small counts to byte
+ * totals, are written one element per packet_append and with the
+ * dedicated appenders. Both outputs are compared byte by byte. Some
+ * decimals are past 2^52, up to 1e18.
+ *
+ * usage: bench_packet_format [values per column]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "packet.h"
+#include "util.h"
+
+#define VALUES   4096
+#define BENCH_MS 300
+
+typedef struct row_t {
+    unsigned long long u;
+    long long i;
+    double f;
+} row_t;
+
+typedef void (*writer_t)(packet_t *pkt, const row_t *rows, int n);
+
+static void printf_u64(packet_t *pkt, const row_t *rows, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_append(pkt, "%s%llu", i?",":"", rows[i].u);
+    packet_append(pkt, "]");
+}
+
+static void scalar_u64(packet_t *pkt, const row_t *rows, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_u64(pkt, i?',':0, rows[i].u);
+    packet_append(pkt, "]");
+}
+
+static void column_u64(packet_t *pkt, const row_t *rows, int n) {
+    packet_u64s(pkt, &rows[0].u, sizeof(rows[0]), n);
+}
+
+static void printf_i64(packet_t *pkt, const row_t *rows, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_append(pkt, "%s%lld", i?",":"", rows[i].i);
+    packet_append(pkt, "]");
+}
+
+static void column_i64(packet_t *pkt, const row_t *rows, int n) {
+    packet_i64s(pkt, &rows[0].i, sizeof(rows[0]), n);
+}
+
+static void printf_f64(packet_t *pkt, const row_t *rows, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_append(pkt, "%s%.2f", i?",":"", rows[i].f);
+    packet_append(pkt, "]");
+}
+
+static void column_f64(packet_t *pkt, const row_t *rows, int n) {
+    packet_f64s(pkt, &rows[0].f, sizeof(rows[0]), n, 2);
+}
+
+static void printf_f64_whole(packet_t *pkt, const row_t *rows, int n) {
+    packet_append(pkt, "[");
+    for(int i=0; i<n; i++)
+        packet_append(pkt, "%s%.0f", i?",":"", rows[i].f);
+    packet_append(pkt, "]");
+}
+
+static void column_f64_whole(packet_t *pkt, const row_t *rows, int n) {
+    packet_f64s(pkt, &rows[0].f, sizeof(rows[0]), n, 0);
+}
+
+/*
+ * Nanoseconds per value
+ */
+static double run(writer_t w, packet_t *pkt, const row_t *rows, int n) {
+    unsigned long iters = 0;
+    epoch_t begin = epoch_time();
+    while(epoch_time()-begin < BENCH_MS) {
+        packet_reset(pkt);
+        w(pkt, rows, n);
+        iters++;
+    }
+    return (double)(epoch_time()-begin) * 1000000 / iters / n;
+}
+
+static char *contents(packet_t *pkt, writer_t w, const row_t *rows, int n) {
+    packet_reset(pkt);
+    w(pkt, rows, n);
+    char *buf = malloc(pkt->size+1);
+    packet_reader_t r;
+    pkt->state = READY;
+    packet_fetch(pkt, &r);
+    buf[packet_read(&r, buf, pkt->size)] = '\0';
+    pkt->state = EMPTY;
+    return buf;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : VALUES;
+    if(n <= 0) n = VALUES;
+
+    // Magnitudes spread from a few to a few hundred terabytes
+    row_t *rows = malloc(n*sizeof(row_t));
+    srand(42);
+    for(int i=0; i<n; i++) {
+        int digits = 1 + rand()%15;
+        unsigned long long v = 0;
+        for(int d=0; d<digits; d++)
+            v = v*10 + rand()%10;
+        rows[i].u = v;
+        rows[i].i = rand()%2 ? -(long long)v : (long long)v;
+        rows[i].f = (double)(v % 100000000) / (1 + rand()%1000);
+        // And from 2^52 up, where a double has no fraction left
+        if(i%8 == 0)
+            rows[i].f = (double)v * (1 + rand()%1000);
+    }
+    rows[0].f = 1e16;
+    if(n > 1) rows[1].f = 1.23e17;
+
+    packet_t *pkt = packet_alloc(METRIC);
+    struct {
+        const char *name;
+        writer_t base, fast;
+    } cases[] = {
+        {"u64 scalar", printf_u64, scalar_u64},
+        {"u64 column", printf_u64, column_u64},
+        {"i64 column", printf_i64, column_i64},
+        {"f64 column", printf_f64, column_f64},
+        {"f64 whole", printf_f64_whole, column_f64_whole},
+    };
+
+    printf("%d values per column\n", n);
+    printf("%12s %14s %14s %8s %8s\n", "", "printf(ns)", "appender(ns)", "speedup", "same");
+    for(int c=0; c<sizeof(cases)/sizeof(cases[0]); c++) {
+        double base = run(cases[c].base, pkt, rows, n);
+        double fast = run(cases[c].fast, pkt, rows, n);
+
+        char *a = contents(pkt, cases[c].base, rows, n);
+        char *b = contents(pkt, cases[c].fast, rows, n);
+        printf("%12s %14.1f %14.1f %7.1fx %8s\n", cases[c].name, base, fast, base/fast, strcmp(a, b) ? "no" : "yes");
+        free(a);
+        free(b);
+    }
+
+    packet_free(pkt);
+    free(rows);
+    return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * @file wire_series.c
+ * @author Snyo
+ * @brief Benchmark series columns of the binary format on recorded packets
+ *
+ * A recorded metric packet is cut into packets of a few samples, as
+ * plugin_gather closes one every PACKET_EXP seconds, and each is encoded
+ * with and without series. Numbers of delta and xor columns are counted
+ * as samples of a series.
+ *
+ * bench/data/os_metrics.json holds 20 samples of the os plugin taken at
+ * its tick on an idle host. bench/data/mysql_metrics.json holds 12 samples
+ * of the mysql plugin against bin/mysql_standin, whose counters grow at a
+ * steady rate, so it is the best case for deltas.
+ *
+ * usage: bench_wire_series [packet.json ...]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "packet.h"
+#include "util.h"
+#include "wire.h"
+
+#define ENCODES 200
+
+static const char *recorded[] = {
+    "bench/data/os_metrics.json",
+    "bench/data/mysql_metrics.json",
+};
+
+static const int batches[] = {1, 2, 3, 4, 6, 12, 20};
+
+typedef struct sample_t {
+    const char *s;
+    int len;
+} sample_t;
+
+static char *load(const char *path, long *size) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    *size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    char *buf = malloc(*size+1);
+    if(buf && fread(buf, 1, *size, fp) != (size_t)*size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    return buf;
+}
+
+/*
+ * Elements of the "metrics" array, returns their count
+ */
+static int split(char *text, long size, sample_t *samples, int max, int *head) {
+    char *p = strstr(text, "\"metrics\":[");
+    if(!p) return -1;
+    p += strlen("\"metrics\":[");
+    *head = p - text;
+
+    int n = 0, depth = 0, quoted = 0;
+    const char *start = p;
+    for(; p < text+size; p++) {
+        if(quoted) {
+            if(*p == '\\') p++;
+            else if(*p == '"') quoted = 0;
+            continue;
+        }
+        switch(*p) {
+            case '"': quoted = 1; break;
+            case '{': case '[': depth++; break;
+            case '}': case ']':
+            if(depth-- == 0) return n;
+            if(depth == 0 && n < max) {
+                samples[n].s = start;
+                samples[n++].len = p+1 - start;
+            }
+            break;
+            case ',':
+            if(depth == 0) start = p+1;
+            break;
+        }
+    }
+    return -1;
+}
+
+static void bench(const char *path) {
+    long size;
+    char *text = load(path, &size);
+    sample_t samples[64];
+    int head, n = text ? split(text, size, samples, 64, &head) : -1;
+    if(n <= 0) {
+        fprintf(stderr, "Cannot read the metrics of %s\n", path);
+        free(text);
+        return;
+    }
+
+    packet_t *pkt = packet_alloc(METRIC);
+    wire_t plain, series;
+    wire_init(&plain);
+    wire_init(&series);
+    plain.series = 0;
+
+    printf("%s, %d samples\n", path, n);
+    printf("%8s %12s %12s %12s %10s %10s %8s %12s\n", "samples", "json B", "binary B", "series B", "numbers", "bits/num", "xor", "encode(us)");
+    for(int b=0; b<sizeof(batches)/sizeof(batches[0]) && batches[b] <= n; b++) {
+        int k = batches[b], packets = 0;
+        unsigned long long json = 0, bytes[2] = {0, 0}, values = 0, bits = 0, xor = 0;
+        epoch_t spent = 0;
+
+        for(int first=0; first+k <= n; first += k, packets++) {
+            packet_reset(pkt);
+            packet_write(pkt, text, head);
+            for(int i=first; i<first+k; i++) {
+                if(i > first) packet_write(pkt, ",", 1);
+                packet_write(pkt, samples[i].s, samples[i].len);
+            }
+            packet_write(pkt, "]}", 2);
+            pkt->state = READY;
+
+            if(wire_encode(&plain, pkt) < 0 || wire_encode(&series, pkt) < 0) {
+                fprintf(stderr, "Cannot encode %d samples of %s\n", k, path);
+                break;
+            }
+            epoch_t begin = epoch_time();
+            for(int e=0; e<ENCODES; e++)
+                wire_encode(&series, pkt);
+            spent += epoch_time() - begin;
+
+            json += pkt->size;
+            bytes[0] += plain.size;
+            bytes[1] += series.size;
+            values += series.delta_values + series.xor_values;
+            bits += (series.delta_bytes + series.xor_bytes) * 8;
+            xor += series.xor_values;
+            pkt->state = EMPTY;
+        }
+
+        unsigned long long total = (unsigned long long)packets * k;
+        printf("%8d %12.1f %12.1f %12.1f %10.1f %10.2f %7.0f%% %12.1f\n", k,
+                (double)json/total, (double)bytes[0]/total, (double)bytes[1]/total,
+                (double)values/total, values ? (double)bits/values : 0.0,
+                values ? 100.0*xor/values : 0.0, (double)spent*1000/packets/ENCODES);
+    }
+    printf("\n");
+
+    wire_fini(&plain);
+    wire_fini(&series);
+    packet_free(pkt);
+    free(text);
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1) {
+        for(int i=1; i<argc; i++)
+            bench(argv[i]);
+    } else {
+        for(int i=0; i<sizeof(recorded)/sizeof(recorded[0]); i++)
+            bench(recorded[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,60 @@
+/**
+ * @file arena.h
+ * @author Snyo
+ * @brief Growable bump allocator reused across ticks
+ */
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+#define ARENA_CHUNK 16384
+
+typedef struct arena_chunk_t arena_chunk_t;
+
+/**
+ * Chunks are kept on reset, so a steady workload stops allocating after
+ * the first ticks. Pointers stay valid until the next reset.
+ */
+typedef struct arena_t {
+    arena_chunk_t *head;
+    arena_chunk_t *cur;
+    size_t used;
+} arena_t;
+
+/**
+ * Initialize an empty arena
+ * @param a an arena
+ */
+void arena_init(arena_t *a);
+
+/**
+ * Free every chunk of an arena
+ * @param a an arena
+ */
+void arena_fini(arena_t *a);
+
+/**
+ * Allocate 'size' bytes aligned for any type
+ * @param a an arena
+ * @param size bytes to allocate
+ * @return If success returns a pointer, else returns NULL
+ */
+void *arena_alloc(arena_t *a, size_t size);
+
+/**
+ * Copy 'len' bytes of a string and terminate it
+ * @param a an arena
+ * @param s a string
+ * @param len bytes to copy
+ * @return If success returns the copy, else returns NULL
+ */
+char *arena_strndup(arena_t *a, const char *s, size_t len);
+
+/**
+ * Release every allocation at once, keeping the chunks
+ * @param a an arena
+ */
+void arena_reset(arena_t *a);
+
+#endif
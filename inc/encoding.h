@@ -0,0 +1,117 @@
+/**
+ * @file encoding.h
+ * @author Snyo
+ * @brief Compression of request bodies
+ *
+ * A body is compressed as gzip or, when built with HAVE_ZSTD, as zstd
+ * with an optional dictionary. The frame carries the id of the dictionary
+ * so the receiver can pick the same one.
+ *
+ * The level follows a CPU budget: every ENCODING_WINDOW seconds the CPU
+ * time spent compressing is compared to the budget, the level goes down
+ * one when over and up one when under a quarter of it.
+ */
+#ifndef _ENCODING_H_
+#define _ENCODING_H_
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "packet.h"
+#include "util.h"
+
+#define ENCODING_WINDOW 10
+
+typedef enum encoding_type {IDENTITY, GZIP, ZSTD} encoding_type;
+
+/**
+ * Contexts and the output buffer are kept across bodies, so nothing is
+ * allocated once they have grown to the largest body.
+ */
+typedef struct encoding_t {
+    encoding_type type;
+    unsigned char *data;
+    size_t size, cap;
+
+    /* Level and its bounds */
+    int level, min, max;
+
+    /* Share of a core compression may take, and what it took */
+    double budget;
+    epoch_t window;
+    unsigned long long spent;   // ns
+
+    z_stream z;
+    int zinit;
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *cctx;
+    ZSTD_CDict *cdict;      // The dictionary digested at 'dlevel'
+    int dlevel;
+#endif
+    const void *dict;
+    size_t dsize;
+} encoding_t;
+
+/**
+ * Type of an encoding name
+ * @param name identity, gzip or zstd
+ * @return Returns the type, or -1 if unknown or not built in
+ */
+int encoding_type_of(const char *name);
+
+/**
+ * Initialize an encoder
+ * @param e an encoder
+ * @param type an encoding type
+ * @param dict a zstd dictionary kept by the caller, or NULL
+ * @param dsize its size
+ * @param budget share of a core, 0.01 is 1%
+ * @return If success returns 0, else returns -1
+ */
+int encoding_init(encoding_t *e, encoding_type type, const void *dict, size_t dsize, double budget);
+
+/**
+ * Free an encoder
+ * @param e an encoder
+ */
+void encoding_fini(encoding_t *e);
+
+/**
+ * Content-Encoding header of an encoder
+ * @param e an encoder
+ * @return Returns the header, or NULL for identity
+ */
+const char *encoding_header(encoding_t *e);
+
+/**
+ * Compress a buffer into e->data and e->size
+ * @param e an encoder
+ * @param buf a buffer
+ * @param len its length
+ * @return If success returns 0, else returns -1
+ */
+int encoding_buffer(encoding_t *e, const void *buf, size_t len);
+
+/**
+ * Compress the segments of a ready packet into e->data and e->size
+ * @param e an encoder
+ * @param pkt a packet
+ * @return If success returns 0, else returns -1
+ */
+int encoding_packet(encoding_t *e, packet_t *pkt);
+
+/**
+ * Compress pieces of a body in turn into e->data and e->size
+ * @param e an encoder
+ * @param iov the pieces
+ * @param n their count
+ * @return If success returns 0, else returns -1
+ */
+int encoding_iov(encoding_t *e, const struct iovec *iov, int n);
+
+#endif
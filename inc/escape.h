@@ -0,0 +1,54 @@
+/**
+ * @file escape.h
+ * @author Snyo
+ * @brief Escape text for JSON strings
+ */
+#ifndef _ESCAPE_H_
+#define _ESCAPE_H_
+
+#include <stddef.h>
+
+/**
+ * Find the first byte that cannot stand in a JSON string as it is, a
+ * quote, a backslash or a control character. Blocks of 32 or 16 bytes
+ * are checked at once with AVX2 or SSE2, whichever the CPU has.
+ * @param s text, need not be terminated
+ * @param len bytes of 's'
+ * @return its offset, or 'len' if there is none
+ */
+size_t escape_scan(const char *s, size_t len);
+
+/**
+ * The escape sequence of a byte escape_scan stopped at
+ * @param c the byte
+ * @param out receives up to 6 bytes, not terminated
+ * @return bytes written to 'out'
+ */
+int escape_seq(unsigned char c, char *out);
+
+/**
+ * Escape text into a buffer large enough for the worst case
+ * @param out receives the escaped text, not terminated, 6*'len' bytes
+ * @param s text, need not be terminated
+ * @param len bytes of 's'
+ * @return bytes written to 'out'
+ */
+size_t escape_copy(char *out, const char *s, size_t len);
+
+/**
+ * Escape text into a buffer, as snprintf would
+ * @param out receives the escaped text, terminated if 'cap' is not 0
+ * @param cap size of 'out'
+ * @param s text, need not be terminated
+ * @param len bytes of 's'
+ * @return bytes the escaped text needs, 'cap' or more if it was cut
+ */
+size_t escape_json(char *out, size_t cap, const char *s, size_t len);
+
+/**
+ * Name of the scan in use
+ * @return "avx2", "sse2" or "scalar"
+ */
+const char *escape_impl();
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * @file intern.h
+ * @author Snyo
+ * @brief Deduplicated strings that live until the table is renewed twice
+ */
+#ifndef _INTERN_H_
+#define _INTERN_H_
+
+#include <stddef.h>
+
+#include "arena.h"
+
+/**
+ * Each distinct string is copied once, so names repeated every tick can be
+ * kept and compared as pointers. Renewing moves the strings to 'old' and
+ * frees those moved there before, so only the ones interned again live on.
+ */
+typedef struct intern_t {
+    arena_t arena;
+    arena_t old;
+    unsigned int cap;
+    unsigned int n;
+    const char **slot;
+} intern_t;
+
+/**
+ * Initialize an empty table
+ * @param t a table
+ */
+void intern_init(intern_t *t);
+
+/**
+ * Free the table and every string in it
+ * @param t a table
+ */
+void intern_fini(intern_t *t);
+
+/**
+ * Find or copy a string
+ * @param t a table
+ * @param s a string, need not be terminated
+ * @param len bytes of 's'
+ * @return If success returns the kept string, else returns NULL
+ */
+const char *intern(intern_t *t, const char *s, size_t len);
+
+/**
+ * Start over with an empty table. Strings of the one before stay valid until
+ * the next renewal, so their holders can intern again those they keep.
+ * @param t a table
+ */
+void intern_renew(intern_t *t);
+
+#endif
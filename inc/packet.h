@@ -11,13 +11,75 @@
 
 #include "util.h"
 
-#define PKTSZ 32768
+#define PKTSZ  (1024*1024) // Size gathers budget for, writes past it still succeed
+#define PKTSEG 4096        // Bytes of a segment
+#define PKTPOOL 256        // Free segments kept for reuse
+#define PKTCOLS 16         // Columns of a builder
 
 #define packet_append(pkt, fmt, ...) \
-    (pkt)->size += snprintf((pkt)->payload+pkt->size, PKTSZ-pkt->size, fmt, ##__VA_ARGS__)
+    packet_printf(pkt, fmt, ##__VA_ARGS__)
+
+/* What packet_gather and the gathers of plugins return */
+enum plugin_gather_error {ENONE, ENODATA, EPLUGUP, EPLUGDOWN};
 
 typedef struct packet_t packet_t;
 
+/**
+ * A piece of a payload. Segments are filled in order, but a write that does
+ * not fit in the rest of one may start the next, so sizes differ.
+ */
+typedef struct packet_seg_t {
+    struct packet_seg_t *next;
+    int size;
+    char data[PKTSEG];
+} packet_seg_t;
+
+/**
+ * Position of a reader in a payload
+ */
+typedef struct packet_reader_t {
+    packet_seg_t *seg;
+    int offset;
+} packet_reader_t;
+
+/**
+ * Type of a column of a builder
+ *  COL_U64, COL_I64  integers
+ *  COL_F64           numbers with the decimals of the column, floats too
+ *  COL_STR           strings, escaped, NULL is ""
+ *  COL_HEX           integers as 16 hex digits in quotes, 0 is ""
+ *  COL_RAW           text of a number as the server gave it, NULL or "" is null
+ */
+typedef enum packet_col_type {COL_U64, COL_I64, COL_F64, COL_STR, COL_HEX, COL_RAW} packet_col_type;
+
+typedef union packet_cell_t {
+    unsigned long long u;
+    long long i;
+    double f;
+    struct {
+        const char *s;
+        int len;
+    };
+} packet_cell_t;
+
+/**
+ * Rows pushed once and written column by column, as "key":[...] pairs.
+ * Cells of a row are put in the order of the columns. Strings are not
+ * copied, they must live until the columns are written.
+ */
+typedef struct packet_cols_t {
+    int ncols, nrows, cap;
+    int at;         // Next cell of the last row
+    int broken;     // A row could not be had or a cell was put out of order
+    packet_cell_t *cells;   // One block, 'cap' cells of each column in turn
+    struct {
+        const char *key;
+        packet_col_type type;
+        int precision;
+        packet_cell_t *cell;
+    } col[PKTCOLS];
+} packet_cols_t;
+
 typedef enum packet_type  {METRIC, REGISTER, ALERT} packet_type;
 typedef enum packet_state {EMPTY, BEGIN, WROTE, READY, DONE, FREE} packet_state;
 typedef enum packet_response {
@@ -48,9 +110,11 @@ struct packet_t {
     int size;
     int rollback_point;
     int attempt;
+    int broken;     // A segment could not be had, what follows is lost
 
     /* Paylaod */
-    char payload[PKTSZ];
+    packet_seg_t *head;
+    packet_seg_t *tail;
 
     /* Control */
     int spin;
@@ -71,12 +135,186 @@ packet_t *packet_alloc(int type);
  */
 void packet_free(packet_t *pkt);
 
+/**
+ * Drop the payload, its segments go back to the pool
+ * @param pkt a packet
+ */
+void packet_reset(packet_t *pkt);
+
+/**
+ * Append formatted text, taking segments as needed
+ * @param pkt a packet
+ * @param fmt printf format
+ * @return If success returns the bytes written, else returns -1
+ */
+int packet_printf(packet_t *pkt, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * Append bytes, taking segments as needed
+ * @param pkt a packet
+ * @param buf bytes to append
+ * @param len bytes of 'buf'
+ * @return If success returns 0, else returns -1
+ */
+int packet_write(packet_t *pkt, const char *buf, int len);
+
+/**
+ * Append an unsigned integer without going through printf
+ * @param pkt a packet
+ * @param sep a byte written before it, or '\0' for none
+ * @param v the value
+ * @return If success returns the bytes written, else returns -1
+ */
+int packet_u64(packet_t *pkt, char sep, unsigned long long v);
+
+/**
+ * Append a signed integer without going through printf
+ * @param pkt a packet
+ * @param sep a byte written before it, or '\0' for none
+ * @param v the value
+ * @return If success returns the bytes written, else returns -1
+ */
+int packet_i64(packet_t *pkt, char sep, long long v);
+
+/**
+ * Append a number with a fixed count of decimals, the same digits "%.*f"
+ * gives. NaN and infinities are written as null.
+ * @param pkt a packet
+ * @param sep a byte written before it, or '\0' for none
+ * @param v the value
+ * @param precision decimals, 0 to 9
+ * @return If success returns the bytes written, else returns -1
+ */
+int packet_f64(packet_t *pkt, char sep, double v, int precision);
+
+/**
+ * Append a JSON array of a field of an array of structures, such as
+ * [1,2,3] of dev[i].tot with 'base' &dev[0].tot and 'stride' sizeof(dev[0])
+ * @param pkt a packet
+ * @param base the field of the first element
+ * @param stride bytes from one element to the next
+ * @param n count of elements
+ * @return If success returns 0, else returns -1
+ */
+int packet_u64s(packet_t *pkt, const void *base, int stride, int n);
+int packet_i64s(packet_t *pkt, const void *base, int stride, int n);
+
+/**
+ * Append a JSON array of doubles or floats, see packet_u64s and packet_f64
+ * @param precision decimals, 0 to 9
+ */
+int packet_f64s(packet_t *pkt, const void *base, int stride, int n, int precision);
+int packet_f32s(packet_t *pkt, const void *base, int stride, int n, int precision);
+
+/**
+ * Append a quoted JSON string, escaping what needs it. Like "%.*s" it
+ * stops at a NUL before 'len' bytes.
+ * @param pkt a packet
+ * @param sep a byte written before it, or '\0' for none
+ * @param s text, NULL is written as ""
+ * @param len most bytes of 's' to write, -1 for all
+ * @return If success returns 0, else returns -1
+ */
+int packet_str(packet_t *pkt, char sep, const char *s, int len);
+
+/**
+ * Initialize a column builder
+ * @param c a builder
+ * @param rows rows expected, room for them is taken with the first
+ */
+void packet_cols_init(packet_cols_t *c, int rows);
+
+/**
+ * Free the cells of a builder
+ * @param c a builder
+ */
+void packet_cols_fini(packet_cols_t *c);
+
+/**
+ * Declare a column, before the first row
+ * @param c a builder
+ * @param key JSON field name, kept
+ * @param type a column type
+ * @param precision decimals of COL_F64, 0 to 9
+ * @return If success returns the column, else returns -1
+ */
+int packet_col(packet_cols_t *c, const char *key, packet_col_type type, int precision);
+
+/**
+ * Start a row, cells left out at its end are 0
+ * @param c a builder
+ * @return If success returns the row, else returns -1
+ */
+int packet_row(packet_cols_t *c);
+
+/**
+ * Put the next cell of the last row, its column must be of the same type
+ * @param c a builder
+ * @param v the value
+ */
+void packet_put_u64(packet_cols_t *c, unsigned long long v);
+void packet_put_i64(packet_cols_t *c, long long v);
+void packet_put_f64(packet_cols_t *c, double v);
+void packet_put_hex(packet_cols_t *c, unsigned long long v);
+
+/**
+ * Put the next cell of the last row, a string as packet_str takes it
+ * @param c a builder
+ * @param s text, kept until the columns are written
+ * @param len most bytes of 's', -1 for all
+ */
+void packet_put_str(packet_cols_t *c, const char *s, int len);
+void packet_put_raw(packet_cols_t *c, const char *s);
+
+/**
+ * Append every column, after a ',' unless the object is just opened. A
+ * builder that lost a row breaks the packet instead, so the gather fails.
+ * @param pkt a packet
+ * @param c a builder
+ * @return If success returns 0, else returns -1
+ */
+int packet_cols(packet_t *pkt, packet_cols_t *c);
+
+/**
+ * Overwrite bytes already written
+ * @param pkt a packet
+ * @param offset where to start, from the beginning of the payload
+ * @param buf bytes to write
+ * @param len bytes of 'buf', 'offset'+'len' must not pass the size
+ * @return If success returns 0, else returns -1
+ */
+int packet_patch(packet_t *pkt, int offset, const char *buf, int len);
+
+/**
+ * Cut the payload back to 'size' bytes
+ * @param pkt a packet
+ * @param size bytes to keep
+ */
+void packet_truncate(packet_t *pkt, int size);
+
 /**
  * Atomic fetch the content(json string) of a packet
  * @param pkt a packet
- * @return If success returns a json string, else returns NULL
+ * @param r receives a reader at the beginning of the payload
+ * @return If the packet is ready returns 0, else returns -1
  */
-char *packet_fetch(packet_t *pkt);
+int packet_fetch(packet_t *pkt, packet_reader_t *r);
+
+/**
+ * Copy the next bytes of a payload
+ * @param r a reader
+ * @param buf receives the bytes
+ * @param len size of 'buf'
+ * @return bytes copied, 0 at the end
+ */
+int packet_read(packet_reader_t *r, char *buf, int len);
+
+/**
+ * Write the payload to a stream
+ * @param pkt a packet
+ * @param fp a stream
+ */
+void packet_print(packet_t *pkt, FILE *fp);
 
 /**
  * Atomic change operation of a packet state to 'to' if the state is 'from'
@@ -87,6 +325,16 @@ char *packet_fetch(packet_t *pkt);
  */
 int packet_change_state(packet_t *pkt, enum packet_state from, enum packet_state to);
 
+/**
+ * Last byte written (inline)
+ * @param pkt a packet
+ * @return the byte, or '\0' if the payload is empty
+ */
+static inline
+char packet_last(packet_t *pkt) {
+    return pkt->tail && pkt->tail->size ? pkt->tail->data[pkt->tail->size-1] : '\0';
+}
+
 /**
  * Check if a minute elapsed after the first record
  * @param pkt a packet
@@ -118,8 +366,7 @@ void packet_commit(packet_t *pkt) {
  */
 static inline
 void packet_rollback(packet_t *pkt) {
-    pkt->size = pkt->rollback_point;
-    pkt->payload[pkt->size] = '\0';
+    packet_truncate(pkt, pkt->rollback_point);
 }
 
 /**
@@ -128,22 +375,23 @@ void packet_rollback(packet_t *pkt) {
  * @param tag json field name
  * @param func gathering process
  * @param module userdata of the func
- * @returns 0 for success, an error code for corresponding error
+ * @returns ENONE for success, an error code for corresponding error
  */
 static inline
 int packet_gather(packet_t *pkt, const char *tag, void *func, void *module) {
     int rollback_point = pkt->size;
 
-    packet_append(pkt, "%s\"%s\":{", pkt->payload[pkt->size-1]=='}'?",":"", tag);
+    packet_append(pkt, "%s\"%s\":{", packet_last(pkt)=='}'?",":"", tag);
     int res = ((int (*)(void *, packet_t *))func)(module, pkt);
-    if(res != 0) {
-        pkt->size = rollback_point;
-        pkt->payload[pkt->size] = '\0';
+    if(res == ENONE && pkt->broken)
+        res = ENODATA; // A part of it is lost
+    if(res != ENONE) {
+        packet_truncate(pkt, rollback_point);
         return res;
     }
     packet_append(pkt, "}");
 
-    return 0;
+    return ENONE;
 }
 
 #endif
@@ -9,10 +9,9 @@
 
 #include "routine.h"
 #include "packet.h"
+#include "schema.h"
 #include "util.h"
 
-enum plugin_gather_error {ENONE, ENODATA, EPLUGUP, EPLUGDOWN};
-
 typedef struct plugin_t {
 
     union {
@@ -26,11 +25,14 @@ typedef struct plugin_t {
 
     packet_t *working;
     packet_t *oob;
+    packet_t *sample;   // The last gathered, waits here while its schema registers
+    schema_t schema;
 
     int (*prep)(void *);
 	int (*fini)(void *);
 
 	int (*gather)(void *, packet_t *);
+    void (*regr)(void *, packet_t *); // Appends to the registration, optional
     int (*cmp)(void *, void *, int);
     int module_size;
     void *module;
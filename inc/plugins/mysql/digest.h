@@ -0,0 +1,24 @@
+/**
+ * @file digest.h
+ * @author Snyo
+ * @brief Normalize SQL text and fingerprint it
+ */
+#ifndef _DIGEST_H_
+#define _DIGEST_H_
+
+#include <stddef.h>
+
+/**
+ * Normalize a statement: literals become '?', lists of them '(?+)', rows
+ * of a multi-row VALUES one '(?+)', comments go away, whitespace collapses
+ * and words are lowercased.
+ * @param sql a statement, need not be terminated
+ * @param len bytes of 'sql'
+ * @param out receives the normalized text, not terminated
+ * @param cap size of 'out', the text is cut there
+ * @param fingerprint receives a 64-bit hash of the normalized text, may be NULL
+ * @return bytes written to 'out'
+ */
+size_t digest_normalize(const char *sql, size_t len, char *out, size_t cap, unsigned long long *fingerprint);
+
+#endif
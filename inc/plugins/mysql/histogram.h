@@ -0,0 +1,40 @@
+/**
+ * @file histogram.h
+ * @author Snyo
+ * @brief Fixed log-linear latency buckets that merge across servers
+ */
+#ifndef _HISTOGRAM_H_
+#define _HISTOGRAM_H_
+
+/**
+ * Bucket b of a value v in microseconds: v itself below 16, above that 16
+ * linear sub-buckets per power of two, (log2(v)-3)*16 + (v>>(log2(v)-4))-16.
+ * The layout never changes, so histograms of any server add up bucket by bucket.
+ */
+#define HISTOGRAM_SUB     16
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB*45) // Up to 2^48 us
+
+/**
+ * Bucket of a latency
+ * @param us microseconds
+ * @return the bucket
+ */
+int histogram_bucket(unsigned long long us);
+
+/**
+ * Lowest latency of a bucket
+ * @param b a bucket
+ * @return microseconds
+ */
+unsigned long long histogram_low(int b);
+
+/**
+ * Spread a count over the buckets of [low, high), in proportion to overlap
+ * @param count buckets of the layout, added to
+ * @param low lower bound in microseconds
+ * @param high upper bound in microseconds, exclusive
+ * @param n how many fell in the range
+ */
+void histogram_add(unsigned long long *count, double low, double high, unsigned long long n);
+
+#endif
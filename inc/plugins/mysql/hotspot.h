@@ -0,0 +1,90 @@
+/**
+ * @file hotspot.h
+ * @author Snyo
+ * @brief Interval deltas of cumulative per-object counters and their top-N
+ */
+#ifndef _HOTSPOT_H_
+#define _HOTSPOT_H_
+
+#include <stddef.h>
+
+#include "intern.h"
+
+#define HOTSPOT_PARTS  3
+#define HOTSPOT_VALUES 4
+
+/**
+ * An object such as (schema, table, index) and its counters.
+ * value[0] ranks the top-N, value[1] breaks ties.
+ */
+typedef struct hotspot_entry_t {
+    unsigned long long hash;
+    const char *part[HOTSPOT_PARTS];
+    unsigned long long value[HOTSPOT_VALUES];
+    unsigned long long delta[HOTSPOT_VALUES];
+    unsigned int seen;
+} hotspot_entry_t;
+
+/**
+ * Entries live in a dense array indexed by an open-addressing table.
+ * Objects missing from a whole snapshot are dropped when the table grows.
+ */
+typedef struct hotspot_t {
+    intern_t *names;
+    unsigned int gen;
+
+    unsigned int cap;
+    unsigned int *slot;
+
+    unsigned int n, size;
+    hotspot_entry_t *entry;
+} hotspot_t;
+
+/**
+ * Initialize an empty table
+ * @param h a table
+ * @param names where object names are kept, may be shared
+ */
+void hotspot_init(hotspot_t *h, intern_t *names);
+
+/**
+ * Free a table, but not its names
+ * @param h a table
+ */
+void hotspot_fini(hotspot_t *h);
+
+/**
+ * Start a snapshot
+ * @param h a table
+ */
+void hotspot_begin(hotspot_t *h);
+
+/**
+ * Record the counters of an object in the current snapshot.
+ * Names are copied only the first time an object is seen.
+ * @param h a table
+ * @param part name parts, NULL is taken as ""
+ * @param len lengths of the name parts
+ * @param value cumulative counters
+ * @return If success returns 0, else returns -1
+ */
+int hotspot_update(hotspot_t *h, char **part, const unsigned long *len, const unsigned long long *value);
+
+/**
+ * Objects of the current snapshot with the largest deltas, in descending order
+ * @param h a table
+ * @param top receives up to 'n' entries
+ * @param n size of 'top'
+ * @return the number of entries
+ */
+int hotspot_top(hotspot_t *h, hotspot_entry_t **top, int n);
+
+/**
+ * Drop objects missing from the last two snapshots and intern the names of
+ * the others again, after intern_renew of the names
+ * @param h a table
+ * @return If success returns 0, else returns -1
+ */
+int hotspot_renew(hotspot_t *h);
+
+#endif
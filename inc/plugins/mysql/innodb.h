@@ -0,0 +1,108 @@
+/**
+ * @file innodb.h
+ * @author Snyo
+ * @brief Parse SHOW ENGINE INNODB STATUS
+ */
+#ifndef _INNODB_H_
+#define _INNODB_H_
+
+#include <stddef.h>
+
+/**
+ * Sections of the monitor output, bits of innodb_status_t.found
+ */
+enum innodb_section {
+    INNODB_NONE,
+    INNODB_BACKGROUND,
+    INNODB_SEMAPHORES,
+    INNODB_FOREIGN_KEY,
+    INNODB_DEADLOCK,
+    INNODB_TRANSACTIONS,
+    INNODB_FILE_IO,
+    INNODB_INSERT_BUFFER,
+    INNODB_LOG,
+    INNODB_BUFFER_POOL,
+    INNODB_ROW_OPERATIONS
+};
+
+/**
+ * Latest deadlock or foreign key error, identified by a hash of its text
+ */
+typedef struct innodb_event_t {
+    unsigned long long hash;
+    char time[32];
+} innodb_event_t;
+
+typedef struct innodb_status_t {
+    unsigned int found;
+
+    /* SEMAPHORES */
+    unsigned long semaphore_waits;
+    unsigned long long reservation_count;
+    unsigned long long signal_count;
+    unsigned long long spin_waits;
+    unsigned long long spin_rounds;
+    unsigned long long os_waits;
+
+    /* LATEST FOREIGN KEY ERROR, LATEST DETECTED DEADLOCK */
+    innodb_event_t fk_error;
+    innodb_event_t deadlock;
+
+    /* TRANSACTIONS */
+    unsigned long long trx_id_counter;
+    unsigned long long history_list_length;
+    unsigned long trx_count;
+    unsigned long trx_active;
+
+    /* FILE I/O */
+    unsigned long pending_reads;
+    unsigned long pending_writes;
+    unsigned long pending_ibuf_reads;
+    unsigned long pending_log_io;
+    unsigned long pending_sync_io;
+    unsigned long pending_fsync_log;
+    unsigned long pending_fsync_bp;
+
+    /* INSERT BUFFER AND ADAPTIVE HASH INDEX */
+    unsigned long long ibuf_size;
+    unsigned long long ibuf_free;
+    unsigned long long ibuf_seg;
+
+    /* LOG */
+    unsigned long long lsn;
+    unsigned long long lsn_flushed;
+    unsigned long long pages_flushed;
+    unsigned long long checkpoint;
+    unsigned long pending_log_flushes;
+    unsigned long pending_chkp_writes;
+
+    /* ROW OPERATIONS */
+    unsigned long queries_inside;
+    unsigned long queries_queued;
+    double inserts;
+    double updates;
+    double deletes;
+    double reads;
+} innodb_status_t;
+
+/**
+ * Parse the monitor output in a single pass
+ * @param text the Status column of SHOW ENGINE INNODB STATUS
+ * @param len length of the text
+ * @param st parsed values, zeroed first
+ * @return If any section is found returns 0, else returns -1
+ */
+int innodb_status_parse(const char *text, size_t len, innodb_status_t *st);
+
+/**
+ * Check if a section is found (inline)
+ * @param st parsed values
+ * @param section a section
+ * @return If found returns 1, else returns 0
+ */
+static inline
+int innodb_status_has(const innodb_status_t *st, enum innodb_section section) {
+    return (st->found >> section) & 1;
+}
+
+#endif
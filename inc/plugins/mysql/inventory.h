@@ -0,0 +1,128 @@
+/**
+ * @file inventory.h
+ * @author Snyo
+ * @brief Table sizes kept up to date by a walk spread over many ticks
+ */
+#ifndef _INVENTORY_H_
+#define _INVENTORY_H_
+
+#include <stddef.h>
+
+#include "intern.h"
+
+#define INVENTORY_VALUES 3 // data_length, index_length, data_free
+
+/**
+ * A table and its last known sizes
+ */
+typedef struct inventory_entry_t {
+    unsigned long long hash;
+    const char *schema;
+    const char *name;
+    unsigned long long value[INVENTORY_VALUES];
+    unsigned int seen;      // Pass that last saw it
+    unsigned dirty : 1;     // Changed since it was last taken
+    unsigned gone : 1;      // Missing from the last whole pass
+} inventory_entry_t;
+
+/**
+ * Entries live in a dense array indexed by an open-addressing table.
+ * The walk goes schema by schema and resumes after the last table name.
+ */
+typedef struct inventory_t {
+    intern_t *names;
+    unsigned int pass;
+
+    unsigned int cap;
+    unsigned int *slot;
+
+    unsigned int n, size;
+    inventory_entry_t *entry;
+    unsigned int ndirty;
+
+    /* Cursor */
+    int nschema, schema;
+    const char **schemas;
+    unsigned long long seed;    // Hash of the current schema name
+    const char *after;      // Last table name read in the current schema, NULL at its start
+} inventory_t;
+
+/**
+ * Initialize an empty inventory
+ * @param v an inventory
+ * @param names where names are kept, may be shared
+ */
+void inventory_init(inventory_t *v, intern_t *names);
+
+/**
+ * Free an inventory, but not its names
+ * @param v an inventory
+ */
+void inventory_fini(inventory_t *v);
+
+/**
+ * Start a pass over the given schemas
+ * @param v an inventory
+ * @param schema schema names, copied
+ * @param len lengths of the schema names
+ * @param n number of schemas
+ * @return If success returns 0, else returns -1
+ */
+int inventory_begin(inventory_t *v, char **schema, const unsigned long *len, int n);
+
+/**
+ * Record a table of the current schema and move the cursor past it
+ * @param v an inventory
+ * @param name a table name, need not be terminated
+ * @param len bytes of 'name'
+ * @param value its sizes
+ * @return If success returns 0, else returns -1
+ */
+int inventory_update(inventory_t *v, const char *name, size_t len, const unsigned long long *value);
+
+/**
+ * Move the cursor to the next schema
+ * @param v an inventory
+ * @return 1 when the pass is over, else 0
+ */
+int inventory_next(inventory_t *v);
+
+/**
+ * Mark tables missing from the pass that just ended as gone
+ * @param v an inventory
+ * @return the number of tables gone
+ */
+int inventory_end(inventory_t *v);
+
+/**
+ * Take entries that changed or went away, in table order of the walk.
+ * Taken entries are no longer dirty, the gone ones stay until inventory_purge.
+ * @param v an inventory
+ * @param out receives up to 'n' entries
+ * @param n size of 'out'
+ * @return the number of entries
+ */
+int inventory_changes(inventory_t *v, inventory_entry_t **out, int n);
+
+/**
+ * Drop the gone entries already taken. Pointers from inventory_changes are invalid after.
+ * @param v an inventory
+ * @return If success returns 0, else returns -1
+ */
+int inventory_purge(inventory_t *v);
+
+/**
+ * Order independent digest of every known table and its sizes
+ * @param v an inventory
+ * @return a 64-bit checksum
+ */
+unsigned long long inventory_checksum(inventory_t *v);
+
+/**
+ * Intern every name again, after intern_renew of the names
+ * @param v an inventory
+ * @return If success returns 0, else returns -1
+ */
+int inventory_renew(inventory_t *v);
+
+#endif
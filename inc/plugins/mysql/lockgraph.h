@@ -0,0 +1,81 @@
+/**
+ * @file lockgraph.h
+ * @author Snyo
+ * @brief Wait-for graph of sessions, its root blockers and cycles
+ */
+#ifndef _LOCKGRAPH_H_
+#define _LOCKGRAPH_H_
+
+#include <stddef.h>
+
+/**
+ * A session nobody blocks but somebody waits for
+ */
+typedef struct lockgraph_root_t {
+    int node;
+    int direct;         // Sessions waiting on it
+    int total;          // Sessions waiting on it through any chain
+    const char *object; // What one of them waits for
+} lockgraph_root_t;
+
+/**
+ * Nodes are sessions by thread id, an edge goes from a waiter to its blocker.
+ * Arrays are kept across resets, analysis results until the next reset.
+ */
+typedef struct lockgraph_t {
+    int n, ncap;
+    unsigned long long *id;
+    unsigned int scap;
+    unsigned int *slot;
+
+    int m, mcap;
+    int *from, *to;
+    const char **object;
+
+    /* Analysis */
+    int waits;          // Distinct edges
+    int waiters;        // Sessions waiting on any other
+    int nroots;
+    lockgraph_root_t *root;
+    int ncycles;
+    int *cycle_start;   // ncycles+1 offsets into cycle
+    int *cycle;
+} lockgraph_t;
+
+/**
+ * Initialize an empty graph
+ * @param g a graph
+ */
+void lockgraph_init(lockgraph_t *g);
+
+/**
+ * Free a graph
+ * @param g a graph
+ */
+void lockgraph_fini(lockgraph_t *g);
+
+/**
+ * Forget every node and edge
+ * @param g a graph
+ */
+void lockgraph_reset(lockgraph_t *g);
+
+/**
+ * Add a wait, duplicates are merged by lockgraph_analyze
+ * @param g a graph
+ * @param waiter thread id of the waiting session
+ * @param blocker thread id of the session holding the lock
+ * @param object the locked object, kept as a pointer
+ * @return If success returns 0, else returns -1
+ */
+int lockgraph_add(lockgraph_t *g, unsigned long long waiter, unsigned long long blocker, const char *object);
+
+/**
+ * Find root blockers, ordered by direct waiters, and cycles
+ * @param g a graph
+ * @param roots how many roots to count transitive waiters for
+ * @return If success returns 0, else returns -1
+ */
+int lockgraph_analyze(lockgraph_t *g, int roots);
+
+#endif
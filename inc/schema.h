@@ -0,0 +1,78 @@
+/**
+ * @file schema.h
+ * @author Snyo
+ * @brief Keys of metric samples, registered once instead of sent in each
+ *
+ * A sample such as {"timestamp":1,"values":{"cpu":{"user":0.1,"sys":0.2}}}
+ * is sent as [1,[[0.1,0.2]]]: every object becomes the array of its values
+ * in the order of its keys in the schema. A key missing from the sample is
+ * null, and left out when no later key of the object is present.
+ *
+ * The schema is registered as a version and its keys, where a key whose
+ * value is an object is followed by its own keys:
+ *
+ *  {"version":1,"keys":["timestamp",{"values":[{"cpu":["user","sys"]}]}]}
+ *
+ * Keys are only added, at the end of their object, so a sub-gather that
+ * skips a tick costs a null instead of a new version.
+ */
+#ifndef _SCHEMA_H_
+#define _SCHEMA_H_
+
+#include "packet.h"
+
+typedef struct schema_node_t schema_node_t;
+typedef struct schema_member_t schema_member_t;
+
+/**
+ * The sample is read in place, in its segments. The buffer of members is
+ * kept across samples, as in wire_t
+ */
+typedef struct schema_t {
+    unsigned int version;   // 0 until a sample is learned
+    schema_node_t *keys;
+
+    /* Members of the objects being read */
+    unsigned int nmembers, mcap;
+    schema_member_t *member;
+} schema_t;
+
+/**
+ * Initialize an empty schema
+ * @param s a schema
+ */
+void schema_init(schema_t *s);
+
+/**
+ * Free a schema
+ * @param s a schema
+ */
+void schema_fini(schema_t *s);
+
+/**
+ * Add the keys of a sample the schema lacks, the version goes up if any
+ * @param s a schema
+ * @param sample a JSON object
+ * @return Returns 1 if the schema changed, even if the sample was not
+ *         read to its end, 0 if not, -1 on error
+ */
+int schema_learn(schema_t *s, packet_t *sample);
+
+/**
+ * Append a learned sample as arrays of values
+ * @param s a schema
+ * @param sample a JSON object
+ * @param pkt a packet
+ * @return If success returns 0, else returns -1
+ */
+int schema_write(schema_t *s, packet_t *sample, packet_t *pkt);
+
+/**
+ * Append the version and the keys
+ * @param s a schema
+ * @param pkt a packet
+ * @return If success returns 0, else returns -1
+ */
+int schema_print(schema_t *s, packet_t *pkt);
+
+#endif
@@ -7,18 +7,81 @@
 #ifndef _SENDER_H_
 #define _SENDER_H_
 
+#include <sys/uio.h>
+
 #include <curl/curl.h>
 
+#include "encoding.h"
 #include "packet.h"
+#include "wire.h"
+
+#define SENDER_BATCH 16   // Most packets of a request
+
+typedef enum sender_format {JSON, BINARY} sender_format;
+
+/**
+ * A body as the pieces it is sent from, segments of packets and what goes
+ * around them. curl reads them in turn, nothing is joined beforehand.
+ */
+typedef struct sender_body_t {
+    struct iovec *iov;
+    int n, cap;
+    size_t size;
+
+    /* Piece being read and where */
+    int i;
+    size_t offset;
+} sender_body_t;
 
 typedef struct sender_t {
     CURL *curl;
     int spin;
+    enum sender_format format;
+    wire_t wire;
+    encoding_t encoding;
+    sender_body_t body;
 } sender_t;
 
 int sender_init();
 int sender_fini();
 
+/**
+ * Body format of an endpoint, known once sender_init has read the config
+ * @param type a packet type
+ * @return Returns JSON or BINARY
+ */
+sender_format sender_format_of(int type);
+
+/**
+ * Packets of a request to an endpoint, 1 unless "batch=" is set for JSON
+ * metrics
+ * @param type a packet type
+ * @return Returns 1 to SENDER_BATCH
+ */
+int sender_batch_of(int type);
+
+/**
+ * Whether samples go as positional arrays of a registered schema, only
+ * with "schema=on" for JSON metrics, as the server must know the schema
+ * @param type a packet type
+ * @return Returns 1 if so, else 0
+ */
+int sender_schema_of(int type);
+
+/**
+ * Post a ready packet
+ * @param pkt a packet
+ * @return If success returns 0, else returns -1
+ */
 int post(packet_t *pkt);
 
+/**
+ * Post ready packets of one type in a request, as a JSON array of them
+ * when there are more than one. Each gets the response.
+ * @param pkts packets
+ * @param n their count, up to SENDER_BATCH
+ * @return If success returns 0, else returns -1
+ */
+int post_batch(packet_t **pkts, int n);
+
 #endif
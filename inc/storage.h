@@ -1,7 +1,15 @@
 /**
  * @file storage.h
- * @author Snyo 
+ * @author Snyo
  * @brief Send packets
+ *
+ * Metric packets wait in a queue until they are sent. The queued payload is
+ * bounded by "memory=" of /etc/maxgaugeair/storage.conf, and each tick the
+ * oldest ready packets make room by "overflow=":
+ *  drop     the oldest are dropped
+ *  summary  the oldest keep every other sample, the latest always, and one
+ *           that holds a single sample is dropped
+ * Registrations and alerts are never counted, they always get a packet.
  */
 
 #ifndef _STORAGE_H_
@@ -13,6 +21,19 @@
 int storage_init(routine_t *storage);
 int storage_fini(routine_t *storage);
 
+/**
+ * Take an empty packet from the spares of its type, or a new one. Metric
+ * packets join the send queue and go back once sent or set DONE. Others are
+ * posted by their owner and given back with put_packet.
+ * @param type a packet type
+ * @return If success returns a packet, else returns NULL
+ */
 packet_t *get_packet(enum packet_type type);
 
+/**
+ * Give back a packet that is not queued, its segments go to the pool
+ * @param pkt a packet, or NULL
+ */
+void put_packet(packet_t *pkt);
+
 #endif
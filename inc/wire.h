@@ -0,0 +1,126 @@
+/**
+ * @file wire.h
+ * @author Snyo
+ * @brief Compact binary columnar encoding of packets
+ *
+ * A packet is "MGB" and a version byte, then one value. A value is a tag
+ * byte and its payload; integers are LEB128 varints, zigzagged if signed.
+ *
+ *  0x00 null, 0x01 false, 0x02 true
+ *  0x03 integer     zigzag
+ *  0x04 fixed       scale byte, zigzag mantissa, the value is m/10^scale
+ *  0x05 string      length, bytes; it takes the next index of the table
+ *  0x06 string ref  index of a string sent before in the packet
+ *  0x07 number      length, text of a number that fits neither
+ *  0x08 array       count, values
+ *  0x09 integers    count, zigzag first, zigzag deltas to the previous
+ *  0x0a fixeds      scale byte, count, mantissas as 0x09 at that scale
+ *  0x0b schema      id, count, keys as length and bytes, then the values;
+ *                   it defines the id for the rest of the packet
+ *  0x0c object      id of a schema, values in the order of its keys
+ *  0x0d series      an array of objects sharing keys, as the header of
+ *                   0x0b or 0x0c without values, count, then a column of
+ *                   each key over the objects
+ *
+ * A column of a series holds one value per object and starts with a byte
+ *
+ *  0x0e values      the values one after another
+ *  0x0f delta       scale byte, zigzag first mantissa, then bits of the
+ *                   change of each delta: '0' none, then '10', '110',
+ *                   '1110', '11110' and '11111' with a zigzag of 7, 9,
+ *                   12, 32 and 64 bits
+ *  0x10 xor         scale byte, then bits: 64 of the first mantissa as a
+ *                   double, then its XOR with the previous one: '0' none,
+ *                   '10' the bits inside the previous window, '11' 5 bits
+ *                   of leading zeros, 6 of length (0 for 64) and the bits
+ *  0x11 fields      objects sharing keys, as the header of 0x0b or 0x0c
+ *                   without values, then a column of each key
+ *  0x12 elements    arrays of one length, length, then a column of each
+ *                   position
+ *
+ * Bits go from the most significant and a column ends on a byte. Numbers
+ * of a column share the largest scale; 0x0f and 0x10 are both tried and
+ * the shorter is sent, as in Gorilla for timestamps and gauges.
+ *
+ * The id of a schema is the FNV-1a hash of its keys, so each sub-gather
+ * keeps one id across samples and agents while its columns stay the same.
+ */
+#ifndef _WIRE_H_
+#define _WIRE_H_
+
+#include <stddef.h>
+
+#include "packet.h"
+
+#define WIRE_MAGIC   "MGB"
+#define WIRE_VERSION 1
+
+enum wire_tag {
+    WIRE_NULL, WIRE_FALSE, WIRE_TRUE, WIRE_INT, WIRE_FIXED, WIRE_STR, WIRE_STRREF,
+    WIRE_NUMBER, WIRE_ARRAY, WIRE_INTS, WIRE_FIXEDS, WIRE_SCHEMA, WIRE_OBJECT,
+    WIRE_SERIES, WIRE_VALUES, WIRE_DELTA, WIRE_XOR, WIRE_FIELDS, WIRE_ELEMENTS
+};
+
+typedef struct wire_string_t wire_string_t;
+typedef struct wire_node_t wire_node_t;
+
+/**
+ * Buffers are kept across packets, so encoding stops allocating once
+ * they have grown to the largest packet.
+ */
+typedef struct wire_t {
+    unsigned char *data;
+    size_t size, cap;
+
+    /* Text of the packet */
+    char *text;
+    size_t tsize, tcap;
+
+    /* Strings sent so far */
+    unsigned int nstrings, scap;
+    wire_string_t *slot;
+
+    /* Schemas sent so far */
+    unsigned int nschemas, ncap;
+    unsigned int *schema;
+
+    /* Values of the packet, parsed */
+    unsigned int nnodes, nodecap;
+    wire_node_t *node;
+
+    /* Values of the columns being encoded */
+    unsigned int ncols, colcap;
+    unsigned int *col;
+
+    /* Mantissas of a column */
+    unsigned int mcap;
+    long long *mant;
+
+    /* Arrays of objects sharing keys are sent as a series, on by default */
+    int series;
+
+    /* Numbers of the last packet sent in delta and xor columns, and their bytes */
+    size_t delta_values, delta_bytes, xor_values, xor_bytes;
+} wire_t;
+
+/**
+ * Initialize an encoder
+ * @param w an encoder
+ */
+void wire_init(wire_t *w);
+
+/**
+ * Free an encoder
+ * @param w an encoder
+ */
+void wire_fini(wire_t *w);
+
+/**
+ * Encode the JSON payload of a ready packet into w->data and w->size
+ * @param w an encoder
+ * @param pkt a packet
+ * @return If success returns 0, else returns -1
+ */
+int wire_encode(wire_t *w, packet_t *pkt);
+
+#endif
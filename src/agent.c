@@ -51,7 +51,8 @@ int main(int argc, char **argv) {
     if(dirp) {
         struct dirent *ep;
         while((ep = readdir(dirp)) != NULL) {
-            if(ep->d_ino != 0 && strcmp(ep->d_name, ".") && strcmp(ep->d_name, "..")) {
+            // Hidden files are state kept by plugins
+            if(ep->d_ino != 0 && ep->d_name[0] != '.') {
                 char plugin_id[BFSZ];
                 snprintf(plugin_id, BFSZ, "res/%s", ep->d_name);
                 FILE *fp = fopen(plugin_id, "rb");
@@ -0,0 +1,72 @@
+/**
+ * @file arena.c
+ * @author Snyo
+ */
+#include "arena.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN sizeof(long long)
+
+struct arena_chunk_t {
+    arena_chunk_t *next;
+    size_t size;
+    char data[];
+};
+
+void arena_init(arena_t *a) {
+    a->head = NULL;
+    a->cur  = NULL;
+    a->used = 0;
+}
+
+void arena_fini(arena_t *a) {
+    while(a->head) {
+        arena_chunk_t *c = a->head;
+        a->head = c->next;
+        free(c);
+    }
+    a->cur  = NULL;
+    a->used = 0;
+}
+
+void *arena_alloc(arena_t *a, size_t size) {
+    size = (size + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1);
+
+    if(a->cur && a->used+size <= a->cur->size) {
+        void *ptr = a->cur->data + a->used;
+        a->used += size;
+        return ptr;
+    }
+
+    // Move to a kept chunk before growing
+    arena_chunk_t *c = a->cur ? a->cur->next : a->head;
+    if(!c || c->size < size) {
+        size_t chunk = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        arena_chunk_t *fresh = malloc(sizeof(arena_chunk_t) + chunk);
+        if(!fresh) return NULL;
+        fresh->size = chunk;
+        fresh->next = c;
+        if(a->cur) a->cur->next = fresh;
+        else       a->head = fresh;
+        c = fresh;
+    }
+
+    a->cur  = c;
+    a->used = size;
+    return c->data;
+}
+
+char *arena_strndup(arena_t *a, const char *s, size_t len) {
+    char *copy = arena_alloc(a, len+1);
+    if(!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+void arena_reset(arena_t *a) {
+    a->cur  = NULL;
+    a->used = 0;
+}
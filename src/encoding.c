@@ -0,0 +1,214 @@
+/**
+ * @file encoding.c
+ * @author Snyo
+ */
+#include "encoding.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define GZIP_LEVEL 6
+#define GZIP_MAX   9
+#define ZSTD_LEVEL 3
+#define ZSTD_MAX   19
+
+int encoding_type_of(const char *name) {
+    if(!strcmp(name, "identity")) return IDENTITY;
+    if(!strcmp(name, "gzip"))     return GZIP;
+#ifdef HAVE_ZSTD
+    if(!strcmp(name, "zstd"))     return ZSTD;
+#endif
+    return -1;
+}
+
+int encoding_init(encoding_t *e, encoding_type type, const void *dict, size_t dsize, double budget) {
+    memset(e, 0, sizeof(encoding_t));
+    e->type = type;
+    e->budget = budget;
+    e->window = epoch_time();
+    e->min = 1;
+
+    switch(type) {
+        case GZIP:
+        e->level = GZIP_LEVEL;
+        e->max = GZIP_MAX;
+        // 15+16 bits of window for a gzip header
+        if(deflateInit2(&e->z, e->level, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            return -1;
+        e->zinit = 1;
+        return 0;
+
+#ifdef HAVE_ZSTD
+        case ZSTD:
+        e->level = ZSTD_LEVEL;
+        e->max = ZSTD_MAX;
+        e->dict = dict;
+        e->dsize = dict ? dsize : 0;
+        return (e->cctx = ZSTD_createCCtx()) ? 0 : -1;
+#endif
+
+        default:
+        return type == IDENTITY ? 0 : -1;
+    }
+}
+
+void encoding_fini(encoding_t *e) {
+    if(e->zinit)
+        deflateEnd(&e->z);
+#ifdef HAVE_ZSTD
+    ZSTD_freeCDict(e->cdict);
+    ZSTD_freeCCtx(e->cctx);
+#endif
+    free(e->data);
+    memset(e, 0, sizeof(encoding_t));
+}
+
+const char *encoding_header(encoding_t *e) {
+    switch(e->type) {
+        case GZIP: return "Content-Encoding: gzip";
+        case ZSTD: return "Content-Encoding: zstd";
+        default:   return NULL;
+    }
+}
+
+static int encoding_room(encoding_t *e, size_t n) {
+    if(n <= e->cap)
+        return 0;
+    unsigned char *data = realloc(e->data, n);
+    if(!data) return -1;
+    e->data = data;
+    e->cap = n;
+    return 0;
+}
+
+/*
+ * Level for the next window of the budget
+ */
+static void encoding_adapt(encoding_t *e, unsigned long long ns) {
+    e->spent += ns;
+    epoch_t now = epoch_time();
+    if(now - e->window < ENCODING_WINDOW*MSPS)
+        return;
+
+    double share = (double)e->spent / NSPMS / (now - e->window);
+    if(share > e->budget && e->level > e->min)
+        e->level--;
+    else if(share < e->budget/4 && e->level < e->max)
+        e->level++;
+    e->window = now;
+    e->spent = 0;
+}
+
+static unsigned long long encoding_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Chunks of a body of 'total' bytes, the output has room for all of it
+ */
+static int encoding_begin(encoding_t *e, size_t total) {
+    e->size = 0;
+    switch(e->type) {
+        case GZIP:
+        if(deflateReset(&e->z) != Z_OK || deflateParams(&e->z, e->level, Z_DEFAULT_STRATEGY) != Z_OK
+                || encoding_room(e, deflateBound(&e->z, total)) < 0)
+            return -1;
+        e->z.next_out = e->data;
+        e->z.avail_out = e->cap;
+        return 0;
+
+#ifdef HAVE_ZSTD
+        case ZSTD:
+        if(e->dict && (!e->cdict || e->dlevel != e->level)) {
+            ZSTD_freeCDict(e->cdict);
+            if(!(e->cdict = ZSTD_createCDict(e->dict, e->dsize, e->level)))
+                return -1;
+            e->dlevel = e->level;
+        }
+        ZSTD_CCtx_reset(e->cctx, ZSTD_reset_session_only);
+        if(ZSTD_isError(e->cdict ? ZSTD_CCtx_refCDict(e->cctx, e->cdict) : ZSTD_CCtx_setParameter(e->cctx, ZSTD_c_compressionLevel, e->level))
+                || ZSTD_isError(ZSTD_CCtx_setPledgedSrcSize(e->cctx, total))
+                || encoding_room(e, ZSTD_compressBound(total)) < 0)
+            return -1;
+        return 0;
+#endif
+
+        default:
+        return -1;
+    }
+}
+
+static int encoding_chunk(encoding_t *e, const void *buf, size_t len, int last) {
+    if(!len && !last)
+        return 0;
+
+    switch(e->type) {
+        case GZIP: {
+            e->z.next_in = (Bytef *)buf;
+            e->z.avail_in = len;
+            int ret = deflate(&e->z, last ? Z_FINISH : Z_NO_FLUSH);
+            if(last ? ret != Z_STREAM_END : ret != Z_OK || e->z.avail_in)
+                return -1;
+            e->size = e->cap - e->z.avail_out;
+            return 0;
+        }
+
+#ifdef HAVE_ZSTD
+        case ZSTD: {
+            ZSTD_inBuffer in = {buf, len, 0};
+            ZSTD_outBuffer out = {e->data, e->cap, e->size};
+            size_t left;
+            do {
+                left = ZSTD_compressStream2(e->cctx, &out, &in, last ? ZSTD_e_end : ZSTD_e_continue);
+                if(ZSTD_isError(left) || (out.pos == out.size && left))
+                    return -1;
+            } while(last ? left != 0 : in.pos < in.size);
+            e->size = out.pos;
+            return 0;
+        }
+#endif
+
+        default:
+        return -1;
+    }
+}
+
+int encoding_buffer(encoding_t *e, const void *buf, size_t len) {
+    unsigned long long begin = encoding_clock();
+    int error = encoding_begin(e, len) < 0 || encoding_chunk(e, buf, len, 1) < 0 ? -1 : 0;
+    encoding_adapt(e, encoding_clock() - begin);
+    return error;
+}
+
+int encoding_packet(encoding_t *e, packet_t *pkt) {
+    packet_reader_t r;
+    if(packet_fetch(pkt, &r) < 0)
+        return -1;
+
+    unsigned long long begin = encoding_clock();
+    int error = encoding_begin(e, pkt->size);
+    for(packet_seg_t *seg=r.seg; seg && !error; seg=seg->next)
+        error = encoding_chunk(e, seg->data, seg->size, !seg->next);
+    if(!r.seg && !error)
+        error = encoding_chunk(e, "", 0, 1);
+    encoding_adapt(e, encoding_clock() - begin);
+    return error;
+}
+
+int encoding_iov(encoding_t *e, const struct iovec *iov, int n) {
+    size_t total = 0;
+    for(int i=0; i<n; i++)
+        total += iov[i].iov_len;
+
+    unsigned long long begin = encoding_clock();
+    int error = encoding_begin(e, total);
+    for(int i=0; i<n && !error; i++)
+        error = encoding_chunk(e, iov[i].iov_base, iov[i].iov_len, i == n-1);
+    if(!n && !error)
+        error = encoding_chunk(e, "", 0, 1);
+    encoding_adapt(e, encoding_clock() - begin);
+    return error;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file escape.c
+ * @author Snyo
+ */
+#include "escape.h"
+
+#include <string.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+static size_t escape_scan_scalar(const char *s, size_t len) {
+    for(size_t i=0; i<len; i++) {
+        unsigned char c = s[i];
+        if(c < 0x20 || c == '"' || c == '\\')
+            return i;
+    }
+    return len;
+}
+
+#ifdef __x86_64__
+/*
+ * Bytes up to 0x1f compare as unsigned through max, the rest are exact
+ */
+static size_t escape_scan_sse2(const char *s, size_t len) {
+    const __m128i ctrl = _mm_set1_epi8(0x1f), quote = _mm_set1_epi8('"'), slash = _mm_set1_epi8('\\');
+    size_t i = 0;
+    for(; i+16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s+i));
+        __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl);
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, slash));
+        int mask = _mm_movemask_epi8(m);
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + escape_scan_scalar(s+i, len-i);
+}
+
+__attribute__((target("avx2")))
+static size_t escape_scan_avx2(const char *s, size_t len) {
+    const __m256i ctrl = _mm256_set1_epi8(0x1f), quote = _mm256_set1_epi8('"'), slash = _mm256_set1_epi8('\\');
+    size_t i = 0;
+    for(; i+32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s+i));
+        __m256i m = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl);
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, slash));
+        unsigned int mask = _mm256_movemask_epi8(m);
+        if(mask) {
+            _mm256_zeroupper();
+            return i + __builtin_ctz(mask);
+        }
+    }
+    // The SSE2 tail would pay for the dirty upper halves on every call
+    _mm256_zeroupper();
+    return i + escape_scan_sse2(s+i, len-i);
+}
+#endif
+
+static size_t (*escape_scan_impl)(const char *, size_t) = escape_scan_scalar;
+static const char *escape_name = "scalar";
+
+static void __attribute__((constructor)) escape_init() {
+#ifdef __x86_64__
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        escape_scan_impl = escape_scan_avx2;
+        escape_name = "avx2";
+    } else {
+        escape_scan_impl = escape_scan_sse2;
+        escape_name = "sse2";
+    }
+#endif
+}
+
+size_t escape_scan(const char *s, size_t len) {
+    return escape_scan_impl(s, len);
+}
+
+int escape_seq(unsigned char c, char *out) {
+    static const char hex[] = "0123456789abcdef";
+    out[0] = '\\';
+    switch(c) {
+        case '"':  out[1] = '"';  return 2;
+        case '\\': out[1] = '\\'; return 2;
+        case '\n': out[1] = 'n';  return 2;
+        case '\r': out[1] = 'r';  return 2;
+        case '\t': out[1] = 't';  return 2;
+        case '\b': out[1] = 'b';  return 2;
+        case '\f': out[1] = 'f';  return 2;
+    }
+    memcpy(out+1, "u00", 3);
+    out[4] = hex[c >> 4];
+    out[5] = hex[c & 0xf];
+    return 6;
+}
+
+size_t escape_copy(char *out, const char *s, size_t len) {
+    size_t o = 0;
+    for(;;) {
+        size_t k = escape_scan_impl(s, len);
+        memcpy(out+o, s, k);
+        o += k;
+        if(k == len)
+            return o;
+        o += escape_seq(s[k], out+o);
+        s += k+1;
+        len -= k+1;
+    }
+}
+
+size_t escape_json(char *out, size_t cap, const char *s, size_t len) {
+    if(len < cap/6) {
+        size_t o = escape_copy(out, s, len);
+        out[o] = '\0';
+        return o;
+    }
+
+    size_t o = 0;
+    while(len > 0) {
+        size_t k = escape_scan_impl(s, len);
+        if(o < cap)
+            memcpy(out+o, s, o+k < cap ? k : cap-o);
+        o += k;
+        if(k == len)
+            break;
+
+        char seq[6];
+        int n = escape_seq(s[k], seq);
+        if(o < cap)
+            memcpy(out+o, seq, o+n < cap ? n : cap-o);
+        o += n;
+        s += k+1;
+        len -= k+1;
+    }
+    if(cap)
+        out[o < cap ? o : cap-1] = '\0';
+    return o;
+}
+
+const char *escape_impl() {
+    return escape_name;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file intern.c
+ * @author Snyo
+ */
+#include "intern.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define INTERN_MIN 1024
+
+static unsigned long long intern_hash(const char *s, size_t len) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for(size_t i=0; i<len; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+void intern_init(intern_t *t) {
+    arena_init(&t->arena);
+    arena_init(&t->old);
+    t->cap  = 0;
+    t->n    = 0;
+    t->slot = NULL;
+}
+
+void intern_fini(intern_t *t) {
+    arena_fini(&t->arena);
+    arena_fini(&t->old);
+    free(t->slot);
+    t->cap  = 0;
+    t->n    = 0;
+    t->slot = NULL;
+}
+
+static int intern_grow(intern_t *t) {
+    unsigned int cap = t->cap ? t->cap*2 : INTERN_MIN;
+    const char **slot = calloc(cap, sizeof(const char *));
+    if(!slot) return -1;
+
+    for(unsigned int i=0; i<t->cap; i++) {
+        if(!t->slot[i]) continue;
+        unsigned int j = intern_hash(t->slot[i], strlen(t->slot[i])) & (cap-1);
+        while(slot[j]) j = (j+1) & (cap-1);
+        slot[j] = t->slot[i];
+    }
+
+    free(t->slot);
+    t->slot = slot;
+    t->cap  = cap;
+    return 0;
+}
+
+const char *intern(intern_t *t, const char *s, size_t len) {
+    if(t->n*4 >= t->cap*3 && intern_grow(t) < 0)
+        return NULL;
+
+    unsigned int i = intern_hash(s, len) & (t->cap-1);
+    for(; t->slot[i]; i=(i+1)&(t->cap-1))
+        if(!strncmp(t->slot[i], s, len) && t->slot[i][len] == '\0')
+            return t->slot[i];
+
+    const char *copy = arena_strndup(&t->arena, s, len);
+    if(!copy) return NULL;
+    t->slot[i] = copy;
+    t->n++;
+    return copy;
+}
+
+void intern_renew(intern_t *t) {
+    arena_t old = t->old;
+    t->old   = t->arena;
+    t->arena = old;
+    arena_reset(&t->arena);
+
+    // The index grows back to what is kept
+    free(t->slot);
+    t->cap  = 0;
+    t->n    = 0;
+    t->slot = NULL;
+}
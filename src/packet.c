@@ -1,12 +1,77 @@
 #include "packet.h"
 
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "util.h"
+#include "escape.h"
 
 #define PACKET_EXP 6.033F
 
+#define PACKET_NUM 32   // Room a number with a separator may need
+
+/* Free segments shared by every packet */
+static packet_seg_t *pool;
+static int pool_size;
+static int pool_spin;
+
+static packet_seg_t *packet_seg_get() {
+    packet_seg_t *seg = NULL;
+
+    while(!__sync_bool_compare_and_swap(&pool_spin, 0, 1));
+    if(pool) {
+        seg = pool;
+        pool = seg->next;
+        pool_size--;
+    }
+    pool_spin = 0;
+
+    if(!seg && !(seg = malloc(sizeof(packet_seg_t))))
+        return NULL;
+    seg->next = NULL;
+    seg->size = 0;
+    return seg;
+}
+
+static void packet_seg_put(packet_seg_t *seg) {
+    while(seg) {
+        packet_seg_t *next = seg->next;
+
+        while(!__sync_bool_compare_and_swap(&pool_spin, 0, 1));
+        if(pool_size < PKTPOOL) {
+            seg->next = pool;
+            pool = seg;
+            pool_size++;
+            seg = NULL;
+        }
+        pool_spin = 0;
+
+        free(seg);
+        seg = next;
+    }
+}
+
+/*
+ * A segment with at least 'len' bytes left, or the next new one
+ */
+static packet_seg_t *packet_seg_room(packet_t *pkt, int len) {
+    if(pkt->tail && PKTSEG-pkt->tail->size >= len)
+        return pkt->tail;
+
+    packet_seg_t *seg = packet_seg_get();
+    if(!seg) {
+        pkt->broken = 1;
+        return NULL;
+    }
+    if(pkt->tail)
+        pkt->tail->next = seg;
+    else
+        pkt->head = seg;
+    pkt->tail = seg;
+    return seg;
+}
+
 packet_t *packet_alloc(int type) {
     if(type < 0 || type >=3)
         return NULL;
@@ -22,18 +87,527 @@ packet_t *packet_alloc(int type) {
 }
 
 void packet_free(packet_t *pkt) {
-    if(pkt) free(pkt);
+    if(pkt) {
+        packet_seg_put(pkt->head);
+        free(pkt);
+    }
+}
+
+void packet_reset(packet_t *pkt) {
+    packet_seg_put(pkt->head);
+    pkt->head = pkt->tail = NULL;
+    pkt->size = 0;
+    pkt->rollback_point = 0;
+    pkt->broken = 0;
+}
+
+int packet_printf(packet_t *pkt, const char *fmt, ...) {
+    va_list ap, again;
+    if(pkt->broken)
+        return -1;
+
+    // Most fit in what is left of the tail
+    int room = pkt->tail ? PKTSEG-pkt->tail->size : 0;
+    va_start(ap, fmt);
+    va_copy(again, ap);
+    int len = room > 0 ? vsnprintf(pkt->tail->data+pkt->tail->size, room, fmt, ap) : vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+
+    if(len < 0) {
+        va_end(again);
+        return -1;
+    }
+    if(len < room) {
+        pkt->tail->size += len;
+        pkt->size += len;
+        va_end(again);
+        return len;
+    }
+
+    if(len < PKTSEG) {
+        // Into a fresh segment, the rest of the tail stays unused
+        packet_seg_t *seg = packet_seg_room(pkt, len+1);
+        if(seg) {
+            vsnprintf(seg->data+seg->size, PKTSEG-seg->size, fmt, again);
+            seg->size += len;
+            pkt->size += len;
+        }
+        va_end(again);
+        return seg ? len : -1;
+    }
+
+    // Larger than a segment, formatted aside and spread over several
+    char *buf = malloc(len+1);
+    if(!buf) {
+        pkt->broken = 1;
+        va_end(again);
+        return -1;
+    }
+    vsnprintf(buf, len+1, fmt, again);
+    va_end(again);
+    int error = packet_write(pkt, buf, len);
+    free(buf);
+    return error < 0 ? -1 : len;
+}
+
+int packet_write(packet_t *pkt, const char *buf, int len) {
+    if(pkt->broken)
+        return -1;
+
+    while(len > 0) {
+        packet_seg_t *seg = packet_seg_room(pkt, 1);
+        if(!seg) return -1;
+        int n = PKTSEG-seg->size < len ? PKTSEG-seg->size : len;
+        memcpy(seg->data+seg->size, buf, n);
+        seg->size += n;
+        pkt->size += n;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static const char packet_digits[200] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const unsigned long long packet_pow10[10] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL, 1000000000ULL
+};
+
+/*
+ * Decimal digits of 'v', two at a time from the end
+ */
+static inline int packet_utoa(char *out, unsigned long long v) {
+    char buf[20];
+    int i = sizeof(buf);
+    while(v >= 100) {
+        unsigned int r = v % 100;
+        v /= 100;
+        i -= 2;
+        memcpy(buf+i, packet_digits+r*2, 2);
+    }
+    if(v >= 10) {
+        i -= 2;
+        memcpy(buf+i, packet_digits+v*2, 2);
+    } else {
+        buf[--i] = '0'+v;
+    }
+    memcpy(out, buf+i, sizeof(buf)-i);
+    return sizeof(buf)-i;
+}
+
+/*
+ * Exactly 'width' digits of 'v', zero padded
+ */
+static inline void packet_utoa_fixed(char *out, unsigned long long v, int width) {
+    while(width >= 2) {
+        width -= 2;
+        memcpy(out+width, packet_digits+(v%100)*2, 2);
+        v /= 100;
+    }
+    if(width)
+        out[0] = '0'+v%10;
+}
+
+/*
+ * Room for a number at the end of the payload, written in place
+ */
+static inline char *packet_num_room(packet_t *pkt) {
+    if(pkt->broken)
+        return NULL;
+    packet_seg_t *seg = packet_seg_room(pkt, PACKET_NUM);
+    return seg ? seg->data+seg->size : NULL;
+}
+
+static inline void packet_num_done(packet_t *pkt, int len) {
+    pkt->tail->size += len;
+    pkt->size += len;
+}
+
+/*
+ * Scaled exactly from the binary value, so the digits are those of printf
+ */
+static inline int packet_ftoa(char *out, double v, int precision) {
+    if(!isfinite(v)) {
+        memcpy(out, "null", 4);
+        return 4;
+    }
+    unsigned long long scale = packet_pow10[precision];
+    if(fabs(v)*scale >= 1e18)
+        return -1;
+
+    // |v| is m*2^-s, below 2^60 after scaling. From 2^52 up s <= 0 and v is whole.
+    int exp;
+    unsigned long long m = ldexp(frexp(fabs(v), &exp), 53);
+    int s = 53-exp;
+    unsigned __int128 p = (unsigned __int128)m * scale;
+    unsigned long long x = 0;
+    if(s <= 0) {
+        x = p << -s;
+    } else if(s < 128) {
+        x = p >> s;
+        unsigned __int128 rem = p - ((unsigned __int128)x << s);
+        unsigned __int128 half = (unsigned __int128)1 << (s-1);
+        if(rem > half || (rem == half && (x & 1)))
+            x++;
+    }
+
+    int n = 0;
+    if(signbit(v))
+        out[n++] = '-';
+    n += packet_utoa(out+n, x/scale);
+    if(precision) {
+        out[n++] = '.';
+        packet_utoa_fixed(out+n, x%scale, precision);
+        n += precision;
+    }
+    return n;
+}
+
+int packet_u64(packet_t *pkt, char sep, unsigned long long v) {
+    char *p = packet_num_room(pkt);
+    if(!p) return -1;
+
+    int n = 0;
+    if(sep) p[n++] = sep;
+    n += packet_utoa(p+n, v);
+    packet_num_done(pkt, n);
+    return n;
+}
+
+int packet_i64(packet_t *pkt, char sep, long long v) {
+    char *p = packet_num_room(pkt);
+    if(!p) return -1;
+
+    int n = 0;
+    if(sep) p[n++] = sep;
+    if(v < 0) p[n++] = '-';
+    n += packet_utoa(p+n, v < 0 ? -(unsigned long long)v : (unsigned long long)v);
+    packet_num_done(pkt, n);
+    return n;
+}
+
+int packet_f64(packet_t *pkt, char sep, double v, int precision) {
+    if(precision < 0) precision = 0;
+    if(precision > 9) precision = 9;
+
+    char *p = packet_num_room(pkt);
+    if(!p) return -1;
+
+    int n = sep ? 1 : 0;
+    int len = packet_ftoa(p+n, v, precision);
+    if(len < 0)
+        return sep ? packet_printf(pkt, "%c%.*f", sep, precision, v) : packet_printf(pkt, "%.*f", precision, v);
+    if(sep) p[0] = sep;
+    packet_num_done(pkt, n+len);
+    return n+len;
+}
+
+int packet_u64s(packet_t *pkt, const void *base, int stride, int n) {
+    const char *at = base;
+    for(int i=0; i<n; i++, at+=stride)
+        if(packet_u64(pkt, i?',':'[', *(const unsigned long long *)at) < 0)
+            return -1;
+    return packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+}
+
+int packet_i64s(packet_t *pkt, const void *base, int stride, int n) {
+    const char *at = base;
+    for(int i=0; i<n; i++, at+=stride)
+        if(packet_i64(pkt, i?',':'[', *(const long long *)at) < 0)
+            return -1;
+    return packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+}
+
+int packet_f64s(packet_t *pkt, const void *base, int stride, int n, int precision) {
+    const char *at = base;
+    for(int i=0; i<n; i++, at+=stride)
+        if(packet_f64(pkt, i?',':'[', *(const double *)at, precision) < 0)
+            return -1;
+    return packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+}
+
+int packet_f32s(packet_t *pkt, const void *base, int stride, int n, int precision) {
+    const char *at = base;
+    for(int i=0; i<n; i++, at+=stride)
+        if(packet_f64(pkt, i?',':'[', *(const float *)at, precision) < 0)
+            return -1;
+    return packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+}
+
+int packet_str(packet_t *pkt, char sep, const char *s, int len) {
+    if(pkt->broken)
+        return -1;
+
+    size_t n = !s ? 0 : len < 0 ? strlen(s) : strnlen(s, len);
+
+    // Escaped in place when even the worst case fits in a segment
+    if(n*6+3 <= PKTSEG) {
+        packet_seg_t *seg = packet_seg_room(pkt, n*6+3);
+        if(!seg) return -1;
+        char *p = seg->data+seg->size, *o = p;
+        if(sep) *o++ = sep;
+        *o++ = '"';
+        o += escape_copy(o, s, n);
+        *o++ = '"';
+        seg->size += o-p;
+        pkt->size += o-p;
+        return 0;
+    }
+
+    char quote[2] = {sep, '"'};
+    if(packet_write(pkt, sep ? quote : quote+1, sep ? 2 : 1) < 0)
+        return -1;
+
+    // Clean runs are copied as they are, most strings are one run
+    while(n > 0) {
+        size_t k = escape_scan(s, n);
+        if(packet_write(pkt, s, k) < 0)
+            return -1;
+        if(k == n)
+            break;
+
+        char seq[6];
+        if(packet_write(pkt, seq, escape_seq(s[k], seq)) < 0)
+            return -1;
+        s += k+1;
+        n -= k+1;
+    }
+    return packet_write(pkt, "\"", 1);
+}
+
+void packet_cols_init(packet_cols_t *c, int rows) {
+    memset(c, 0, sizeof(packet_cols_t));
+    c->cap = rows > 0 ? rows : 0;
+}
+
+void packet_cols_fini(packet_cols_t *c) {
+    free(c->cells);
+    memset(c, 0, sizeof(packet_cols_t));
+}
+
+int packet_col(packet_cols_t *c, const char *key, packet_col_type type, int precision) {
+    if(c->ncols == PKTCOLS || c->nrows) {
+        c->broken = 1;
+        return -1;
+    }
+    int i = c->ncols++;
+    c->col[i].key = key;
+    c->col[i].type = type;
+    c->col[i].precision = precision < 0 ? 0 : precision > 9 ? 9 : precision;
+    c->col[i].cell = NULL;
+    return i;
+}
+
+int packet_row(packet_cols_t *c) {
+    if(c->broken)
+        return -1;
+
+    // Columns share one block, moved column by column when it grows
+    if(c->nrows == c->cap || !c->cells) {
+        int cap = c->nrows < c->cap ? c->cap : c->cap ? c->cap*2 : 16;
+        packet_cell_t *cells = malloc((size_t)cap*c->ncols*sizeof(packet_cell_t));
+        if(!cells) {
+            c->broken = 1;
+            return -1;
+        }
+        for(int i=0; i<c->ncols; i++) {
+            if(c->nrows)
+                memcpy(cells+i*cap, c->col[i].cell, c->nrows*sizeof(packet_cell_t));
+            c->col[i].cell = cells+i*cap;
+        }
+        free(c->cells);
+        c->cells = cells;
+        c->cap = cap;
+    }
+
+    for(int i=0; i<c->ncols; i++)
+        memset(&c->col[i].cell[c->nrows], 0, sizeof(packet_cell_t));
+    c->at = 0;
+    return c->nrows++;
+}
+
+/*
+ * Next cell of the last row, whose column must be of 'type'
+ */
+static inline packet_cell_t *packet_cell(packet_cols_t *c, packet_col_type type) {
+    if(c->broken || !c->nrows)
+        return NULL;
+    if(c->at >= c->ncols || c->col[c->at].type != type) {
+        c->broken = 1;
+        return NULL;
+    }
+    return &c->col[c->at++].cell[c->nrows-1];
+}
+
+void packet_put_u64(packet_cols_t *c, unsigned long long v) {
+    packet_cell_t *cell = packet_cell(c, COL_U64);
+    if(cell) cell->u = v;
+}
+
+void packet_put_i64(packet_cols_t *c, long long v) {
+    packet_cell_t *cell = packet_cell(c, COL_I64);
+    if(cell) cell->i = v;
 }
 
-char *packet_fetch(packet_t *pkt) {
-    char *payload = NULL;
+void packet_put_f64(packet_cols_t *c, double v) {
+    packet_cell_t *cell = packet_cell(c, COL_F64);
+    if(cell) cell->f = v;
+}
+
+void packet_put_hex(packet_cols_t *c, unsigned long long v) {
+    packet_cell_t *cell = packet_cell(c, COL_HEX);
+    if(cell) cell->u = v;
+}
+
+void packet_put_str(packet_cols_t *c, const char *s, int len) {
+    packet_cell_t *cell = packet_cell(c, COL_STR);
+    if(cell) {
+        cell->s = s;
+        cell->len = len;
+    }
+}
+
+void packet_put_raw(packet_cols_t *c, const char *s) {
+    packet_cell_t *cell = packet_cell(c, COL_RAW);
+    if(cell) {
+        cell->s = s;
+        cell->len = s ? strlen(s) : 0;
+    }
+}
+
+int packet_cols(packet_t *pkt, packet_cols_t *c) {
+    if(c->broken) {
+        pkt->broken = 1;
+        return -1;
+    }
+
+    int n = c->nrows;
+    for(int i=0; i<c->ncols; i++) {
+        char last = packet_last(pkt);
+        packet_append(pkt, "%s\"%s\":", last && last != '{' ? "," : "", c->col[i].key);
+
+        const packet_cell_t *cell = c->col[i].cell;
+        switch(c->col[i].type) {
+            case COL_U64:
+            packet_u64s(pkt, &cell->u, sizeof(packet_cell_t), n);
+            break;
+
+            case COL_I64:
+            packet_i64s(pkt, &cell->i, sizeof(packet_cell_t), n);
+            break;
+
+            case COL_F64:
+            packet_f64s(pkt, &cell->f, sizeof(packet_cell_t), n, c->col[i].precision);
+            break;
+
+            case COL_STR:
+            for(int r=0; r<n; r++)
+                packet_str(pkt, r?',':'[', cell[r].s, cell[r].len);
+            packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+            break;
+
+            case COL_HEX:
+            for(int r=0; r<n; r++) {
+                if(cell[r].u)
+                    packet_append(pkt, "%c\"%016llx\"", r?',':'[', cell[r].u);
+                else
+                    packet_write(pkt, r ? ",\"\"" : "[\"\"", 3);
+            }
+            packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+            break;
+
+            case COL_RAW:
+            for(int r=0; r<n; r++) {
+                packet_write(pkt, r ? "," : "[", 1);
+                if(cell[r].len)
+                    packet_write(pkt, cell[r].s, cell[r].len);
+                else
+                    packet_write(pkt, "null", 4);
+            }
+            packet_write(pkt, n ? "]" : "[]", n ? 1 : 2);
+            break;
+        }
+    }
+
+    return pkt->broken ? -1 : 0;
+}
+
+int packet_patch(packet_t *pkt, int offset, const char *buf, int len) {
+    if(offset < 0 || offset+len > pkt->size)
+        return -1;
+
+    for(packet_seg_t *seg=pkt->head; seg && len>0; seg=seg->next) {
+        if(offset >= seg->size) {
+            offset -= seg->size;
+            continue;
+        }
+        int n = seg->size-offset < len ? seg->size-offset : len;
+        memcpy(seg->data+offset, buf, n);
+        buf += n;
+        len -= n;
+        offset = 0;
+    }
+    return 0;
+}
+
+void packet_truncate(packet_t *pkt, int size) {
+    if(size <= 0) {
+        packet_reset(pkt);
+        return;
+    }
+    if(size > pkt->size)
+        return;
+
+    int left = size;
+    packet_seg_t *seg = pkt->head;
+    while(left > seg->size) {
+        left -= seg->size;
+        seg = seg->next;
+    }
+    seg->size = left;
+    packet_seg_put(seg->next);
+    seg->next = NULL;
+    pkt->tail = seg;
+    pkt->size = size;
+    pkt->broken = 0;
+}
+
+int packet_fetch(packet_t *pkt, packet_reader_t *r) {
+    int error = -1;
 
     while(!__sync_bool_compare_and_swap(&pkt->spin, 0, 1));
-    if(pkt && pkt->state==READY)
-        payload = pkt->payload;
+    if(pkt && pkt->state==READY) {
+        r->seg = pkt->head;
+        r->offset = 0;
+        error = 0;
+    }
     pkt->spin = 0;
 
-    return payload;
+    return error;
+}
+
+int packet_read(packet_reader_t *r, char *buf, int len) {
+    int n = 0;
+    while(r->seg && n < len) {
+        if(r->offset == r->seg->size) {
+            r->seg = r->seg->next;
+            r->offset = 0;
+            continue;
+        }
+        int c = r->seg->size-r->offset < len-n ? r->seg->size-r->offset : len-n;
+        memcpy(buf+n, r->seg->data+r->offset, c);
+        r->offset += c;
+        n += c;
+    }
+    return n;
+}
+
+void packet_print(packet_t *pkt, FILE *fp) {
+    for(packet_seg_t *seg=pkt->head; seg; seg=seg->next)
+        fwrite(seg->data, 1, seg->size, fp);
 }
 
 int packet_change_state(packet_t *pkt, enum packet_state from, enum packet_state to) {
@@ -13,6 +13,7 @@
 
 #include "metadata.h"
 #include "packet.h"
+#include "schema.h"
 #include "sender.h"
 #include "storage.h"
 #include "util.h"
@@ -21,6 +22,7 @@ int plugin_fini(plugin_t *p);
 int plugin_prep(plugin_t *p);
 int plugin_regr(plugin_t *p);
 int plugin_gather(plugin_t *p);
+int plugin_record(plugin_t *p, epoch_t begin);
 
 int plugin_init(plugin_t *p) {
     if(!p) return -1;
@@ -31,6 +33,8 @@ int plugin_init(plugin_t *p) {
     p->tid = 0;
     p->working = 0;
     p->oob = 0;
+    p->sample = 0;
+    schema_init(&p->schema);
 
     routine_change_task(&p->r, plugin_prep);
 
@@ -43,7 +47,14 @@ int plugin_fini(plugin_t *p) {
     DEBUG(zlog_debug(p->tag, "Finialize"));
 
     if(p->fini) p->fini(p);
-    packet_free(p->working);
+    // Queued, storage frees it
+    if(p->working)
+        p->working->state = DONE;
+    p->working = 0;
+    put_packet(p->oob);
+    p->oob = 0;
+    packet_free(p->sample);
+    schema_fini(&p->schema);
 
     return 0;
 }
@@ -74,14 +85,22 @@ int plugin_regr(plugin_t *p) {
         if(!p->tid)
             p->tid = epoch_time()*epoch_time()*epoch_time();
 
-        p->oob = packet_alloc(REGISTER);
+        p->oob = get_packet(REGISTER);
         p->oob->state = READY;
         packet_append(p->oob, "{\"license\":\"%s\",\"aid\":%llu,\"tid\":", license, aid);
         packet_transaction(p->oob);
-        packet_append(p->oob, "%20llu,\"agent_type\":\"%s\",\"target_type\":\"%s\",\"os\":\"%s\",\"hostname\":\"%s\",\"ip\":\"%s\"%s%s%s}", p->tid, type, p->type, os, host, aip, p->tip?",\"target_ip\":\"":"", p->tip?p->tip:"", p->tip?"\"":"");
+        packet_append(p->oob, "%20llu,\"agent_type\":\"%s\",\"target_type\":\"%s\",\"os\":\"%s\",\"hostname\":\"%s\",\"ip\":\"%s\"%s%s%s", p->tid, type, p->type, os, host, aip, p->tip?",\"target_ip\":\"":"", p->tip?p->tip:"", p->tip?"\"":"");
+        if(p->regr)
+            p->regr(p->module, p->oob);
+        if(p->schema.version) {
+            packet_append(p->oob, ",\"schema\":");
+            schema_print(&p->schema, p->oob);
+        }
+        packet_append(p->oob, "}");
     } else {
-        sprintf(p->oob->payload+p->oob->rollback_point, "%20llu", p->tid);
-        p->oob->payload[p->oob->rollback_point+20] = ',';
+        char tid[24];
+        snprintf(tid, sizeof(tid), "%20llu,", p->tid);
+        packet_patch(p->oob, p->oob->rollback_point, tid, 21);
     }
 
     if(post(p->oob) < 0) {
@@ -115,7 +134,7 @@ int plugin_regr(plugin_t *p) {
         return -1;
     }
 
-    packet_free(p->oob);
+    put_packet(p->oob);
     p->oob = 0;
 
     char m_name[BFSZ];
@@ -131,19 +150,23 @@ int plugin_regr(plugin_t *p) {
 
     routine_change_task(&p->r, plugin_gather);
 
+    // The sample that changed the schema
+    if(p->sample && p->sample->size)
+        plugin_record(p, epoch_time());
+
     return 0;
 }
 
 int plugin_alert(plugin_t *p, const char *stat) {
     if(!p->oob) {
-        p->oob = packet_alloc(ALERT);
+        p->oob = get_packet(ALERT);
         p->oob->state = READY;
         packet_append(p->oob, "{\"license\":\"%s\",\"tid\":%llu,\"status\":\"%s\"}", license, p->tid, stat);
     }
     if(post(p->oob) < 0)
         return -1;
 
-    packet_free(p->oob);
+    put_packet(p->oob);
     p->oob = 0;
     routine_change_task(&p->r, plugin_gather);
 
@@ -158,64 +181,145 @@ int plugin_alert_down(plugin_t *p) {
     return plugin_alert(p, "down");
 }
 
-int plugin_gather(plugin_t *p) {
-    DEBUG(zlog_debug(p->tag, ".. Gather"));
-
+/*
+ * The working packet, begun if new
+ */
+static packet_t *plugin_working(plugin_t *p, epoch_t begin) {
     if(!p->working)
         p->working = get_packet(METRIC);
 
     packet_t *pkt = p->working;
 
     if(pkt->state == EMPTY) {
-        packet_append(pkt, "{\"license\":\"%s\",\"tid\":%llu,\"metrics\":[", license, p->tid);
+        packet_append(pkt, "{\"license\":\"%s\",\"tid\":%llu,", license, p->tid);
+        if(p->schema.version)
+            packet_append(pkt, "\"schema\":%u,", p->schema.version);
+        packet_append(pkt, "\"metrics\":[");
         pkt->state = BEGIN;
     }
 
-    epoch_t begin = epoch_time();
     if(pkt->state == BEGIN)
         pkt->started = begin;
 
-    packet_transaction(pkt);
-    if(pkt->state == WROTE)
-        packet_append(pkt, ",");
+    return pkt;
+}
+
+/*
+ * Storage may take the working packet back as soon as it is ready or done
+ */
+static void plugin_close(plugin_t *p) {
+    packet_t *pkt = p->working;
+    if(!pkt)
+        return;
+
+    p->working = 0;
+    if(pkt->state == WROTE) {
+        packet_append(pkt, "]}");
+        pkt->state = READY;
+    } else {
+        pkt->state = DONE;
+    }
+}
+
+int plugin_gather(plugin_t *p) {
+    DEBUG(zlog_debug(p->tag, ".. Gather"));
+
+    epoch_t begin = epoch_time();
+    packet_t *pkt;
+
+    // A keyed sample goes straight into the working packet, a positional one is learned first
+    int positional = sender_schema_of(METRIC);
+    if(positional) {
+        if(!p->sample && !(p->sample = packet_alloc(METRIC)))
+            return -1;
+        pkt = p->sample;
+        packet_reset(pkt);
+    } else {
+        pkt = plugin_working(p, begin);
+        packet_transaction(pkt);
+        if(pkt->state == WROTE)
+            packet_append(pkt, ",");
+    }
 
     packet_append(pkt, "{\"timestamp\":%llu,", begin);
-    switch(packet_gather(pkt, "values", p->gather, p->module)) {
+    int res = packet_gather(pkt, "values", p->gather, p->module);
+    switch(res) {
         case ENONE:
         packet_append(pkt, "}");
-        if(pkt->state == BEGIN)
-            pkt->state = WROTE;
-        packet_commit(pkt);
-        break;
-        
-        case ENODATA:
-        packet_rollback(pkt);
         break;
 
         case EPLUGUP:
-        packet_rollback(pkt);
         routine_change_task(&p->r, plugin_alert_up);
         break;
 
         case EPLUGDOWN:
-        packet_rollback(pkt);
         routine_change_task(&p->r, plugin_alert_down);
         break;
     }
 
-    if(packet_expired(pkt)) {
-        if(pkt->state == WROTE) {
-            packet_append(pkt, "]}");
-            pkt->state = READY;
-            p->working = 0;
+    if(!positional) {
+        if(res == ENONE && !pkt->broken) {
+            if(pkt->state == BEGIN)
+                pkt->state = WROTE;
+            packet_commit(pkt);
         } else {
-            pkt->state = DONE;
-            p->working = 0;
+            packet_rollback(pkt);
         }
+
+        DEBUG(zlog_debug(p->tag, ".. %d bytes, in %llums", pkt->size, epoch_time()-begin));
+
+        if(packet_expired(pkt))
+            plugin_close(p);
+        return 0;
+    }
+
+    if(res != ENONE)
+        packet_reset(pkt);
+
+    // New keys, the packet of the old version is closed and the new one registered first
+    if(pkt->size) {
+        switch(schema_learn(&p->schema, pkt)) {
+            case 1:
+            plugin_close(p);
+            routine_change_task(&p->r, plugin_regr);
+            return plugin_regr(p);
+
+            case -1:
+            packet_reset(pkt);
+            break;
+        }
+    }
+
+    return plugin_record(p, begin);
+}
+
+/*
+ * Writes the sample into the working packet by the schema
+ */
+int plugin_record(plugin_t *p, epoch_t begin) {
+    packet_t *pkt = plugin_working(p, begin);
+    packet_t *sample = p->sample;
+
+    if(sample->size) {
+        packet_transaction(pkt);
+        if(pkt->state == WROTE)
+            packet_append(pkt, ",");
+
+        if(schema_write(&p->schema, sample, pkt) < 0 || pkt->broken) {
+            packet_rollback(pkt);
+        } else {
+            if(pkt->state == BEGIN)
+                pkt->state = WROTE;
+            packet_commit(pkt);
+        }
+        packet_reset(sample);
     }
 
     DEBUG(zlog_debug(p->tag, ".. %d bytes, in %llums", pkt->size, epoch_time()-begin));
 
+    if(packet_expired(pkt))
+        plugin_close(p);
+
     return 0;
 }
 
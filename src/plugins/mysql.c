@@ -8,16 +8,247 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sys/inotify.h>
 
 #include <mysql/mysql.h>
 
+#include "arena.h"
+#include "escape.h"
+#include "intern.h"
 #include "metadata.h"
 #include "packet.h"
 #include "sender.h"
 #include "util.h"
+#include "plugins/mysql/digest.h"
+#include "plugins/mysql/histogram.h"
+#include "plugins/mysql/hotspot.h"
+#include "plugins/mysql/innodb.h"
+#include "plugins/mysql/inventory.h"
+#include "plugins/mysql/lockgraph.h"
 
 #define MYSQL_TICK 4.973F
 
+#define SLOW_PAGE    100
+#define SLOW_PAGES   5
+#define SLOW_ROWS    (SLOW_PAGE*SLOW_PAGES)
+#define SLOW_SQL_MAX 4096
+#define SLOW_CHUNK   16384
+#define SLOW_STATE   "res/.slow_%s_%u"   // Hidden, next to the saved plugins
+
+#define THREAD_COLS     12
+#define THREAD_INFO     2
+#define THREAD_INFO_MAX 1024
+
+#define DIGEST_SENT     2048
+#define DIGEST_INTERVAL 300
+
+#define ASH_TICK      1.0F
+#define ASH_SLOTS     64
+#define ASH_SLOT_KEYS 64
+#define ASH_KEYS      256
+
+#define METRICS_MAX     512
+#define METRICS_REFRESH 600
+
+#define REPLICA_COLS      12
+#define REPLICA_CHANNELS  64
+#define REPLICA_WORKERS   256
+#define REPLICA_ERROR_MAX 512
+
+#define META_MAX 2048
+
+#define ADAPT_TIMEOUT      2000
+#define ADAPT_BUSY_THREADS 32
+#define ADAPT_BUSY_COST    1000
+#define ADAPT_EVERY_MAX    16
+
+#define HOTSPOT_TOP     10
+#define HOTSPOT_TOP_MAX 100
+
+#define NAMES_MIN 4096  // Interned names before the first renewal
+
+#define LOCK_ROOTS     8
+#define LOCK_CYCLES    8
+#define LOCK_CYCLE_MAX 16
+#define LOCK_INFO_MAX  256
+
+#define INVENTORY_BUDGET 500
+#define INVENTORY_SEND   512
+
+#define STMT_BUCKETS     450 // Of events_statements_histogram_global
+#define STMT_ACCOUNT_TOP 20
+
+#define TRX_AGE     60
+#define TRX_MAX     64
+#define TRX_SQL_MAX 512
+
+#define MYSQL_SUBS 13
+
+#define MYSQL_ARGV(argv, i) ((char *)(argv) + (i)*BFSZ)
+
+enum mysql_slow_source {SLOW_NONE, SLOW_TABLE, SLOW_FILE};
+
+/**
+ * What the server has and the account may read, probed on every connect
+ */
+enum mysql_cap {
+    CAP_PS             = 1<<0,  // performance_schema=ON
+    CAP_PS_STATUS      = 1<<1,  // performance_schema.global_status
+    CAP_IS_STATUS      = 1<<2,  // information_schema.global_status, before 5.7
+    CAP_WAITS_CURRENT  = 1<<3,  // Consumer events_waits_current
+    CAP_STMTS_CURRENT  = 1<<4,  // Consumer events_statements_current
+    CAP_PROCESS        = 1<<5,  // innodb_trx and engine status, PROCESS privilege
+    CAP_INNODB_METRICS = 1<<6,
+    CAP_HISTOGRAM      = 1<<7,  // events_statements_histogram_global, 8.0
+    CAP_LOCK_WAITS     = 1<<8,  // Either kind of lock waits below
+    CAP_DATA_LOCKS     = 1<<9,  // performance_schema.data_lock_waits, 8.0
+    CAP_REPLICA        = 1<<10, // Either status statement, REPLICATION CLIENT privilege
+    CAP_REPLICA_STATUS = 1<<11, // SHOW REPLICA STATUS, 8.0.22 and MariaDB 10.5
+    CAP_SLOW_TABLE     = 1<<12, // mysql.slow_log
+};
+enum mysql_meta_group {META_VARIABLES, META_VERSION, META_SERVER_ID, META_ENGINES, META_CONSUMERS, META_GROUPS};
+
+/**
+ * Metadata groups, each a query of (name, value) rows and its default TTL in seconds
+ */
+static const struct {
+    const char *key;
+    const char *query;
+    unsigned int ttl;
+} meta_groups[META_GROUPS] = {
+    {"variables", "show global variables where variable_name in ('innodb_buffer_pool_size','innodb_buffer_pool_instances','innodb_log_file_size','innodb_flush_log_at_trx_commit','innodb_io_capacity','max_connections','sync_binlog','long_query_time','read_only','performance_schema');", 3600},
+    {"version",   "show global variables where variable_name in ('version','version_comment');", 86400},
+    {"server_id", "show global variables where variable_name in ('server_id','server_uuid');", 86400},
+    {"engines",   "select engine,support from information_schema.engines;", 86400},
+    {"consumers", "select name,enabled from performance_schema.setup_consumers;", 600},
+};
+
+static const char *thread_cols[THREAD_COLS] = {
+    "id", "thread_id", "info", "user", "host", "db",
+    "time", "timer_wait", "event_id", "event_name", "command", "state"
+};
+
+/**
+ * SHOW REPLICA STATUS column, by its current and pre-8.0.22 name
+ */
+static const struct {
+    const char *key;
+    const char *name[2];
+    int number;
+} replica_cols[REPLICA_COLS] = {
+    {"channel",         {"Channel_Name", "Channel_Name"}, 0},
+    {"source",          {"Source_Host", "Master_Host"}, 0},
+    {"io_running",      {"Replica_IO_Running", "Slave_IO_Running"}, 0},
+    {"sql_running",     {"Replica_SQL_Running", "Slave_SQL_Running"}, 0},
+    {"lag",             {"Seconds_Behind_Source", "Seconds_Behind_Master"}, 1},
+    {"relay_log_space", {"Relay_Log_Space", "Relay_Log_Space"}, 1},
+    {"read_pos",        {"Read_Source_Log_Pos", "Read_Master_Log_Pos"}, 1},
+    {"exec_pos",        {"Exec_Source_Log_Pos", "Exec_Master_Log_Pos"}, 1},
+    {"io_errno",        {"Last_IO_Errno", "Last_IO_Errno"}, 1},
+    {"io_error",        {"Last_IO_Error", "Last_IO_Error"}, 0},
+    {"sql_errno",       {"Last_SQL_Errno", "Last_SQL_Errno"}, 1},
+    {"sql_error",       {"Last_SQL_Error", "Last_SQL_Error"}, 0},
+};
+
+static const char *lock_cols[6] = {
+    "thread_id", "id", "user", "command", "time", "info"
+};
+
+typedef struct mysql_ash_key_t {
+    unsigned long long hash;
+    char state[BFSZ/2];
+    char event[BFSZ];
+    char digest[65];    // 64 hex characters in 8.0
+} mysql_ash_key_t;
+
+/**
+ * One second of sampled sessions, counted by key
+ */
+typedef struct mysql_ash_slot_t {
+    epoch_t time;
+    int n;
+    unsigned short key[ASH_SLOT_KEYS];
+    unsigned int count[ASH_SLOT_KEYS];
+    unsigned int other;
+} mysql_ash_slot_t;
+
+/**
+ * Active session history, a ring of seconds filled by the sampler thread
+ * and drained every tick. The size does not depend on the session count.
+ */
+typedef struct mysql_ash_t {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    volatile int alive;
+    MYSQL *mysql;
+    unsigned long tid;
+
+    int nkeys;
+    mysql_ash_key_t keys[ASH_KEYS];
+    unsigned short index[ASH_KEYS*2];
+    mysql_ash_key_t seen[ASH_SLOT_KEYS];   // Of the second being sampled, the sampler's own
+
+    int head, tail;
+    unsigned long dropped;
+    mysql_ash_slot_t slots[ASH_SLOTS];
+} mysql_ash_t;
+
+typedef struct mysql_metric_t {
+    char name[BFSZ]; // First, so an entry compares as its name
+    unsigned counter : 1;
+    unsigned valid : 1;
+    long long value;
+    long long delta;
+} mysql_metric_t;
+
+/**
+ * Enabled counters of information_schema.innodb_metrics ordered by name
+ */
+typedef struct mysql_metrics_t {
+    epoch_t refreshed;
+    char *query;
+    int n;
+    mysql_metric_t counter[METRICS_MAX];
+} mysql_metrics_t;
+
+typedef struct mysql_meta_t {
+    epoch_t fetched;
+    unsigned dirty : 1;
+    int len;
+    char json[META_MAX];
+} mysql_meta_t;
+
+typedef struct mysql_thread_t {
+    struct mysql_thread_t *next;
+    char *col[THREAD_COLS];
+    int len[THREAD_COLS];
+    unsigned long long fingerprint; // Of the normalized info
+} mysql_thread_t;
+
+/**
+ * A transaction older than trx_age, followed by its trx_id
+ */
+typedef struct mysql_trx_t {
+    unsigned long long id;
+    unsigned long long rows_modified;
+    unsigned long age;
+    unsigned int seen;
+} mysql_trx_t;
+
+/**
+ * Cost of a sub-gather and how many ticks it waits between runs
+ */
+typedef struct mysql_adapt_t {
+    epoch_t cost;
+    unsigned int every;
+    unsigned int wait;
+} mysql_adapt_t;
+
 typedef struct mysql_module_t {
     unsigned on : 1;
 
@@ -29,31 +260,263 @@ typedef struct mysql_module_t {
 	MYSQL *mysql;
     unsigned long tid;
 
+    /* Options */
+    struct {
+        unsigned ash : 1;
+        unsigned int metrics_refresh;
+        char heartbeat[BFSZ];
+        unsigned int ttl[META_GROUPS];
+        unsigned int hotspot_top;
+        unsigned int timeout;
+        unsigned long busy_threads;
+        unsigned long long busy_cost;
+        unsigned int digest_interval;
+        unsigned int inventory_budget;
+        unsigned int trx_age;
+    } opt;
+
+    /* Probed on connect, see mysql_cap */
+    unsigned int caps;
+    unsigned long version;
+
+    /* Adaptive collection */
+    unsigned long threads_running;
+    mysql_adapt_t adapt[MYSQL_SUBS];
+
+    arena_t arena;
+    mysql_ash_t *ash;
+    mysql_metrics_t *metrics;
+
+    mysql_meta_t meta[META_GROUPS];
+
+    /* Table, index and file I/O */
+    intern_t names;
+    unsigned int names_kept;    // Left by the last renewal
+    struct {
+        hotspot_t table;
+        hotspot_t file;
+    } hotspot;
+
+    /* Statement latency and accounts, performance_schema of 8.0 */
+    struct {
+        int n;                  // Buckets of the last read, 0 before the first
+        unsigned long long count[STMT_BUCKETS];
+        hotspot_t accounts;
+    } stmt;
+
+    /* Long transactions and the undo history they hold */
+    struct {
+        unsigned int tick;
+        int n;
+        mysql_trx_t list[TRX_MAX*2]; // Those of the last tick and as many new
+        long long history;      // -1 before the first read
+    } trx;
+
+    /* Table sizes, walked a budget of tables per tick */
+    struct {
+        inventory_t tables;
+        epoch_t started;
+        epoch_t cost;       // Of the whole pass so far
+        unsigned long rows;
+    } inventory;
+
+    /* Lock waits */
+    struct {
+        lockgraph_t graph;
+    } lock;
+
+    /* SHOW ENGINE INNODB STATUS */
+    innodb_status_t innodb;
+    unsigned long long deadlock_hash;
+    unsigned long long fk_error_hash;
+
+    /* Fingerprints whose text went out, open addressing, 0 is empty */
+    struct {
+        epoch_t since;
+        int n;
+        unsigned long long sent[DIGEST_SENT];
+    } digest;
+
+    /* Slow query cursor */
+    struct {
+        enum mysql_slow_source source;
+        char state[BFSZ*2];
+
+        // mysql.slow_log
+        epoch_t start_us;
+        unsigned long thread_id;
+
+        // slow_query_log_file
+        char path[BFSZ*2];
+        int fd, ifd, wd;
+        unsigned long ino;
+        long offset;
+        int pending;
+        char *buf;
+    } slow;
+
+    /* What the running sub-gather sent, kept only if its object stays in the packet */
+    struct {
+        unsigned long long deadlock_hash;
+        unsigned long long fk_error_hash;
+        int ndigest;
+        unsigned long long digest[SLOW_ROWS];   // Fingerprints whose text went out
+        int slow;               // The slow query cursor below moves
+        epoch_t start_us;
+        unsigned long thread_id;
+        long offset;
+        int unread;             // Of the slow log past 'offset'
+    } pending;
+
 } mysql_module_t;
 
+typedef struct mysql_slow_entry_t {
+    const char *begin;
+    const char *user;
+    const char *sql;
+    int user_len;
+    int sql_len;
+    unsigned long long query_time;
+    epoch_t start_time;
+    unsigned long rows_sent;
+    unsigned long rows_examined;
+} mysql_slow_entry_t;
+
+typedef struct mysql_slow_group_t {
+    unsigned long long fingerprint;
+    mysql_slow_entry_t *first;
+    const char *sql;    // NULL when the text went out this interval
+    int sql_len;
+    unsigned int count;
+    unsigned long long query_time;
+    unsigned long long query_time_max;
+    unsigned long rows_sent;
+    unsigned long rows_examined;
+} mysql_slow_group_t;
+
 int mysql_prep(void *_m);
 int mysql_fini(void *_m);
 int mysql_module_cmp(void *_m1, void *_m2, int size);
 int mysql_gather(void *_p, packet_t *pkt);
+void mysql_regr(void *_m, packet_t *pkt);
 
 int _mysql_gather_crud(mysql_module_t *m, packet_t *pkt);
 int _mysql_gather_query(mysql_module_t *m, packet_t *pkt);
 int _mysql_gather_innodb(mysql_module_t *m, packet_t *pkt);
 int _mysql_gather_thread(mysql_module_t *m, packet_t *pkt);
 int _mysql_gather_replica(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_ash(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_metrics(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_meta(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_hotspot(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_inventory(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_statement(mysql_module_t *m, packet_t *pkt);
+
+int _mysql_gather_lock(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_trx(mysql_module_t *m, packet_t *pkt);
+int _mysql_gather_collect(mysql_module_t *m, packet_t *pkt);
+
+int _mysql_option(mysql_module_t *m, const char *opt);
+
+void _mysql_session(MYSQL *mysql, unsigned int timeout);
+void _mysql_caps(mysql_module_t *m);
+int  _mysql_probe(mysql_module_t *m, const char *query);
+int  _mysql_adapt_skip(mysql_module_t *m, int i);
+void _mysql_adapt(mysql_module_t *m, int i, epoch_t cost);
+void _mysql_innodb_emit(mysql_module_t *m, packet_t *pkt);
+int  _mysql_meta_fetch(mysql_module_t *m, int g);
+int  _mysql_meta_emit(mysql_module_t *m, packet_t *pkt, int all);
+int  _mysql_hotspot_scan(mysql_module_t *m, hotspot_t *h, const char *query);
+void _mysql_hotspot_emit(packet_t *pkt, hotspot_entry_t **e, int k, int parts, const char **keys);
+int  _mysql_lock_scan(mysql_module_t *m, const char *query);
+int  _mysql_inventory_walk(mysql_module_t *m, int budget);
+void _mysql_commit(mysql_module_t *m);
+void _mysql_names_renew(mysql_module_t *m);
+void _mysql_replica_workers(mysql_module_t *m, packet_t *pkt);
+void _mysql_replica_heartbeat(mysql_module_t *m, packet_t *pkt);
+int  _mysql_metrics_refresh(mysql_module_t *m);
+int  _mysql_metric_cmp(const void *name, const void *c);
+
+int  _mysql_ash_start(mysql_module_t *m);
+void _mysql_ash_stop(mysql_module_t *m);
+void *_mysql_ash_main(void *_m);
+int  _mysql_ash_sample(mysql_ash_t *ash);
+unsigned long long _mysql_ash_hash(const char *state, const char *event, const char *digest);
+int  _mysql_ash_key(mysql_ash_t *ash, const mysql_ash_key_t *k);
+void _mysql_ash_clear(mysql_ash_t *ash);
+
+int  _mysql_slow_prep(mysql_module_t *m);
+int  _mysql_slow_open(mysql_module_t *m);
+void _mysql_slow_save(mysql_module_t *m);
+int  _mysql_slow_table(mysql_module_t *m, packet_t *pkt);
+int  _mysql_slow_file(mysql_module_t *m, packet_t *pkt);
+void _mysql_slow_emit(mysql_module_t *m, packet_t *pkt, mysql_slow_entry_t *slow_queries, int k);
+int  _mysql_digest_sent(mysql_module_t *m, unsigned long long fingerprint);
+void _mysql_digest_mark(mysql_module_t *m, unsigned long long fingerprint);
 
 MYSQL_RES *query_result(MYSQL *mysql, const char *query);
 
+/**
+ * Sub-gathers in packet order. Expensive ones back off under load, and
+ * those whose capabilities are missing do not run until a reconnect.
+ */
+static const struct {
+    const char *tag;
+    int (*func)(mysql_module_t *, packet_t *);
+    int expensive;
+    unsigned int caps;
+} mysql_subs[MYSQL_SUBS] = {
+    {"curd",      _mysql_gather_crud,      0, 0},
+    {"query",     _mysql_gather_query,     0, 0},
+    {"statement", _mysql_gather_statement, 0, CAP_HISTOGRAM},
+    {"innodb",    _mysql_gather_innodb,    1, CAP_PROCESS},
+    {"metrics",   _mysql_gather_metrics,   0, CAP_INNODB_METRICS},
+    {"meta",      _mysql_gather_meta,      0, 0},
+    {"thread",    _mysql_gather_thread,    1, 0},
+    {"hotspot",   _mysql_gather_hotspot,   1, CAP_PS},
+    {"inventory", _mysql_gather_inventory, 1, 0},
+    {"lock",      _mysql_gather_lock,      1, CAP_LOCK_WAITS},
+    {"trx",       _mysql_gather_trx,       0, CAP_PROCESS},
+    {"replica",   _mysql_gather_replica,   0, CAP_REPLICA},
+    {"ash",       _mysql_gather_ash,       0, 0},
+};
+
 int load_mysql_module(plugin_t *p, int argc, char *argv[]) {
-    if(!p || argc!=1) return -1;
+    if(!p || argc<1) return -1;
 
     mysql_module_t *m = malloc(sizeof(mysql_module_t));
     if(!m) return -1;
+    memset(m, 0, sizeof(mysql_module_t));
+    m->slow.fd = m->slow.ifd = m->slow.wd = -1;
+    m->opt.metrics_refresh = METRICS_REFRESH;
+    for(int g=0; g<META_GROUPS; g++)
+        m->opt.ttl[g] = meta_groups[g].ttl;
+    m->opt.hotspot_top = HOTSPOT_TOP;
+    m->opt.timeout = ADAPT_TIMEOUT;
+    m->opt.busy_threads = ADAPT_BUSY_THREADS;
+    m->opt.busy_cost = ADAPT_BUSY_COST;
+    m->opt.digest_interval = DIGEST_INTERVAL;
+    m->opt.inventory_budget = INVENTORY_BUDGET;
+    m->opt.trx_age = TRX_AGE;
+    m->trx.history = -1;
+    arena_init(&m->arena);
+    intern_init(&m->names);
+    hotspot_init(&m->hotspot.table, &m->names);
+    hotspot_init(&m->hotspot.file, &m->names);
+    inventory_init(&m->inventory.tables, &m->names);
+    hotspot_init(&m->stmt.accounts, &m->names);
+    lockgraph_init(&m->lock.graph);
 
-    if(sscanf((char *)(argv+0), "%128[^/]/%u/%128[^/]/%128[^/]\n", m->host, &m->port, m->user, m->pass) != 4) {
+    if(sscanf(MYSQL_ARGV(argv, 0), "%128[^/]/%u/%128[^/]/%128[^/]\n", m->host, &m->port, m->user, m->pass) != 4) {
         free(m);
         return -1;
     }
+    for(int i=1; i<argc; i++) {
+        if(_mysql_option(m, MYSQL_ARGV(argv, i)) < 0) {
+            free(m);
+            return -1;
+        }
+    }
     m->on = 1;
 
     p->tick = MYSQL_TICK;
@@ -64,6 +527,7 @@ int load_mysql_module(plugin_t *p, int argc, char *argv[]) {
     p->prep = mysql_prep;
 	p->fini = mysql_fini;
 	p->gather = mysql_gather;
+    p->regr = mysql_regr;
     p->cmp = mysql_module_cmp;
     
     p->module_size = sizeof(mysql_module_t);
@@ -72,6 +536,62 @@ int load_mysql_module(plugin_t *p, int argc, char *argv[]) {
 	return 0;
 }
 
+/*
+ * Options follow the target as "key=value"
+ *
+ * ash=on                samples active sessions every second
+ * metrics_refresh=600   seconds between lookups of enabled InnoDB metrics
+ * heartbeat=db.table    measures replication lag from the ts column
+ * ttl_<group>=3600      seconds a metadata group is cached, see meta_groups
+ * hotspot_top=10        tables and files sent by I/O wait, 0 turns it off
+ * timeout=2000          milliseconds a statement may wait or run, 0 for no limit
+ * busy_threads=32       threads_running that slows down expensive gathers
+ * busy_cost=1000        milliseconds of a gather that slows it down
+ * digest_interval=300   seconds before the text of a fingerprint is sent again
+ * inventory_budget=500  tables whose sizes are read per tick, 0 turns it off
+ * trx_age=60            seconds after which a transaction is followed, 0 turns it off
+ */
+int _mysql_option(mysql_module_t *m, const char *opt) {
+    char key[BFSZ], val[BFSZ];
+    if(sscanf(opt, "%127[^=]=%127s", key, val) != 2)
+        return -1;
+
+    if(!strcmp(key, "ash"))
+        m->opt.ash = !strcmp(val, "on");
+    else if(!strcmp(key, "metrics_refresh"))
+        m->opt.metrics_refresh = strtoul(val, NULL, 10);
+    else if(!strcmp(key, "heartbeat")) {
+        // Spliced into a query, so only an identifier is accepted
+        if(strspn(val, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_$.") != strlen(val))
+            return -1;
+        strcpy(m->opt.heartbeat, val);
+    } else if(!strcmp(key, "timeout")) {
+        m->opt.timeout = strtoul(val, NULL, 10);
+    } else if(!strcmp(key, "busy_threads")) {
+        m->opt.busy_threads = strtoul(val, NULL, 10);
+    } else if(!strcmp(key, "busy_cost")) {
+        m->opt.busy_cost = strtoull(val, NULL, 10);
+    } else if(!strcmp(key, "digest_interval")) {
+        m->opt.digest_interval = strtoul(val, NULL, 10);
+    } else if(!strcmp(key, "inventory_budget")) {
+        m->opt.inventory_budget = strtoul(val, NULL, 10);
+    } else if(!strcmp(key, "trx_age")) {
+        m->opt.trx_age = strtoul(val, NULL, 10);
+    } else if(!strcmp(key, "hotspot_top")) {
+        m->opt.hotspot_top = strtoul(val, NULL, 10);
+    } else if(!strncmp(key, "ttl_", 4)) {
+        int g = 0;
+        while(g < META_GROUPS && strcmp(key+4, meta_groups[g].key))
+            g++;
+        if(g == META_GROUPS)
+            return -1;
+        m->opt.ttl[g] = strtoul(val, NULL, 10);
+    } else
+        return -1;
+
+    return 0;
+}
+
 int mysql_module_cmp(void *_m1, void *_m2, int size) {
     mysql_module_t *m1 = _m1;
     mysql_module_t *m2 = _m2;
@@ -91,14 +611,23 @@ int mysql_prep(void *_m) {
         return -1;
     }
 
+    // Last resort for statements the session limits do not cover
     my_bool b = 1;
+    unsigned int read_timeout = m->opt.timeout ? 5*((m->opt.timeout+MSPS-1)/MSPS) : 0;
     if(0x00 || mysql_options(m->mysql, MYSQL_OPT_RECONNECT, &b) < 0
+            || (read_timeout && mysql_options(m->mysql, MYSQL_OPT_READ_TIMEOUT, &read_timeout) < 0)
             || !mysql_real_connect(m->mysql, m->host, m->user, m->pass, NULL, m->port, NULL, 0)) {
         return -1;
     }
     
     m->on = 1;
     m->tid = mysql_thread_id(m->mysql);
+    _mysql_session(m->mysql, m->opt.timeout);
+    _mysql_caps(m);
+
+    _mysql_slow_prep(m);
+    if(m->opt.ash && m->caps & CAP_PS)
+        _mysql_ash_start(m);
 
     return 0;
 }
@@ -107,8 +636,24 @@ int mysql_fini(void *_m) {
 	if(!_m) return -1;
 
     mysql_module_t *m = _m;
+    _mysql_ash_stop(m);
     if(m->mysql)
         mysql_close(m->mysql);
+    if(m->slow.fd >= 0)
+        close(m->slow.fd);
+    if(m->slow.ifd >= 0)
+        close(m->slow.ifd);
+    free(m->slow.buf);
+    if(m->metrics)
+        free(m->metrics->query);
+    free(m->metrics);
+    arena_fini(&m->arena);
+    hotspot_fini(&m->hotspot.table);
+    hotspot_fini(&m->hotspot.file);
+    inventory_fini(&m->inventory.tables);
+    hotspot_fini(&m->stmt.accounts);
+    lockgraph_fini(&m->lock.graph);
+    intern_fini(&m->names);
     free(m);
 
     return 0;
@@ -126,14 +671,231 @@ int mysql_gather(void *_m, packet_t *pkt) {
     } else if(m->tid != mysql_thread_id(m->mysql)) {
         m->tid = mysql_thread_id(m->mysql);
         m->on = 1;
+        _mysql_session(m->mysql, m->opt.timeout);
+        _mysql_caps(m);
+        _mysql_slow_prep(m);
+        if(m->opt.ash && m->caps & CAP_PS)
+            _mysql_ash_start(m);
+        if(m->metrics)
+            m->metrics->refreshed = 0;
+        for(int g=0; g<META_GROUPS; g++)
+            m->meta[g].fetched = 0;
+        m->stmt.n = 0;
         return EPLUGUP;
     }
 
-    return packet_gather(pkt, "curd",    _mysql_gather_crud, m)
-        & packet_gather(pkt, "query",   _mysql_gather_query, m)
-        & packet_gather(pkt, "innodb",  _mysql_gather_innodb, m)
-        & packet_gather(pkt, "thread",  _mysql_gather_thread, m)
-        & packet_gather(pkt, "replica", _mysql_gather_replica, m);
+    MYSQL_RES *res = query_result(m->mysql, "show global status like 'threads_running';");
+    if(res) {
+        MYSQL_ROW row = mysql_fetch_row(res);
+        if(row && row[1])
+            m->threads_running = strtoul(row[1], NULL, 10);
+        mysql_free_result(res);
+    }
+
+    arena_reset(&m->arena);
+
+    int error = ENODATA;
+    for(int i=0; i<MYSQL_SUBS; i++) {
+        if((m->caps & mysql_subs[i].caps) != mysql_subs[i].caps || _mysql_adapt_skip(m, i))
+            continue;
+
+        epoch_t begin = epoch_time();
+        memset(&m->pending, 0, sizeof(m->pending));
+        int res = packet_gather(pkt, mysql_subs[i].tag, mysql_subs[i].func, m);
+        if(res == ENONE)
+            _mysql_commit(m);
+        error &= res;
+        _mysql_adapt(m, i, epoch_time()-begin);
+    }
+    if(error == ENONE)
+        packet_gather(pkt, "collect", _mysql_gather_collect, m);
+    _mysql_names_renew(m);
+
+    return error;
+}
+
+/*
+ * Remembers what a sub-gather sent once packet_gather kept its object
+ */
+void _mysql_commit(mysql_module_t *m) {
+    if(m->pending.deadlock_hash)
+        m->deadlock_hash = m->pending.deadlock_hash;
+    if(m->pending.fk_error_hash)
+        m->fk_error_hash = m->pending.fk_error_hash;
+    for(int i=0; i<m->pending.ndigest; i++)
+        _mysql_digest_mark(m, m->pending.digest[i]);
+    if(m->pending.slow) {
+        m->slow.start_us = m->pending.start_us;
+        m->slow.thread_id = m->pending.thread_id;
+        m->slow.offset = m->pending.offset;
+        m->slow.pending = m->pending.unread;
+        _mysql_slow_save(m);
+    }
+}
+
+/*
+ * Names of objects that went away, such as #sql-* tables and rotated files,
+ * are dropped once twice as many names are held as the last renewal kept
+ */
+void _mysql_names_renew(mysql_module_t *m) {
+    if(m->names.n < 2*m->names_kept + NAMES_MIN)
+        return;
+
+    intern_renew(&m->names);
+    hotspot_renew(&m->hotspot.table);
+    hotspot_renew(&m->hotspot.file);
+    hotspot_renew(&m->stmt.accounts);
+    inventory_renew(&m->inventory.tables);
+    m->names_kept = m->names.n;
+}
+
+/*
+ * Session limits, so a locked metadata object makes a statement fail
+ * instead of queueing the agent behind it. They are lost on reconnect.
+ * A timeout of 0 keeps the server defaults.
+ */
+void _mysql_session(MYSQL *mysql, unsigned int timeout) {
+    char query[BFSZ];
+    unsigned int sec = (timeout+MSPS-1) / MSPS;
+    if(!timeout)
+        return;
+
+    snprintf(query, BFSZ, "set session lock_wait_timeout=%u;", sec);
+    mysql_query(mysql, query);
+    snprintf(query, BFSZ, "set session innodb_lock_wait_timeout=%u;", sec);
+    mysql_query(mysql, query);
+
+    // SELECT only, 5.7.8 and later or MariaDB 10.1 and later
+    snprintf(query, BFSZ, "set session max_execution_time=%u;", timeout);
+    if(mysql_query(mysql, query)) {
+        snprintf(query, BFSZ, "set session max_statement_time=%u.%03u;", timeout/1000, timeout%1000);
+        mysql_query(mysql, query);
+    }
+}
+
+/*
+ * Which tables, consumers and statements this server and account allow
+ *
+ * Each is tried once with a statement that returns no rows, so a missing
+ * table or privilege costs one error per connect instead of one per tick.
+ * A server is a replica if it has a replication status, so one that becomes
+ * a replica is followed from the next reconnect.
+ */
+void _mysql_caps(mysql_module_t *m) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    unsigned int caps = 0;
+    m->version = mysql_get_server_version(m->mysql);
+
+    if((res = query_result(m->mysql, "show global variables like 'performance_schema';"))) {
+        if((row = mysql_fetch_row(res)) && row[1] && !strcasecmp(row[1], "ON"))
+            caps |= CAP_PS;
+        mysql_free_result(res);
+    }
+    if(caps & CAP_PS && (res = query_result(m->mysql, "select name from performance_schema.setup_consumers where enabled='YES';"))) {
+        while((row = mysql_fetch_row(res))) {
+            if(!strcmp(row[0], "events_waits_current"))
+                caps |= CAP_WAITS_CURRENT;
+            else if(!strcmp(row[0], "events_statements_current"))
+                caps |= CAP_STMTS_CURRENT;
+        }
+        mysql_free_result(res);
+    }
+
+    if(caps & CAP_PS && _mysql_probe(m, "select 1 from performance_schema.global_status limit 0;") == 0)
+        caps |= CAP_PS_STATUS;
+    else if(_mysql_probe(m, "select 1 from information_schema.global_status limit 0;") == 0)
+        caps |= CAP_IS_STATUS;
+    if(_mysql_probe(m, "select 1 from information_schema.innodb_trx limit 0;") == 0)
+        caps |= CAP_PROCESS;
+    if(_mysql_probe(m, "select 1 from information_schema.innodb_metrics limit 0;") == 0)
+        caps |= CAP_INNODB_METRICS;
+    if(caps & CAP_PS && _mysql_probe(m, "select 1 from performance_schema.events_statements_histogram_global limit 0;") == 0)
+        caps |= CAP_HISTOGRAM;
+    if(caps & CAP_PS && _mysql_probe(m, "select 1 from performance_schema.data_lock_waits limit 0;") == 0)
+        caps |= CAP_LOCK_WAITS | CAP_DATA_LOCKS;
+    else if(caps & CAP_PS && caps & CAP_PROCESS && _mysql_probe(m, "select 1 from information_schema.innodb_lock_waits limit 0;") == 0)
+        caps |= CAP_LOCK_WAITS;
+    // Any account with the privilege gets a status, only a replica has a row in it
+    if((res = query_result(m->mysql, "show replica status;"))) {
+        if(mysql_fetch_row(res))
+            caps |= CAP_REPLICA | CAP_REPLICA_STATUS;
+        mysql_free_result(res);
+    } else if((res = query_result(m->mysql, "show slave status;"))) {
+        if(mysql_fetch_row(res))
+            caps |= CAP_REPLICA;
+        mysql_free_result(res);
+    }
+    if(_mysql_probe(m, "select 1 from mysql.slow_log limit 0;") == 0)
+        caps |= CAP_SLOW_TABLE;
+
+    m->caps = caps;
+}
+
+int _mysql_probe(mysql_module_t *m, const char *query) {
+    MYSQL_RES *res = query_result(m->mysql, query);
+    if(!res) return -1;
+    mysql_free_result(res);
+    return 0;
+}
+
+/*
+ * Decides whether an expensive sub-gather runs this tick
+ */
+int _mysql_adapt_skip(mysql_module_t *m, int i) {
+    mysql_adapt_t *a = &m->adapt[i];
+    if(!mysql_subs[i].expensive)
+        return 0;
+
+    // Far over the threshold nothing expensive runs
+    if(m->opt.busy_threads && m->threads_running >= 2*m->opt.busy_threads)
+        return 1;
+    if(a->wait > 0) {
+        a->wait--;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Doubles the interval of an expensive sub-gather while it is slow or the
+ * server is busy, halves it back otherwise
+ */
+void _mysql_adapt(mysql_module_t *m, int i, epoch_t cost) {
+    mysql_adapt_t *a = &m->adapt[i];
+    a->cost = a->cost ? (a->cost*3 + cost) / 4 : cost;
+    if(!mysql_subs[i].expensive)
+        return;
+
+    int busy = (m->opt.busy_cost && a->cost >= m->opt.busy_cost)
+        || (m->opt.busy_threads && m->threads_running >= m->opt.busy_threads);
+    if(busy && a->every < ADAPT_EVERY_MAX)
+        a->every = a->every ? a->every*2 : 2;
+    else if(!busy && a->every > 1)
+        a->every /= 2;
+    a->wait = a->every ? a->every-1 : 0;
+}
+
+int _mysql_gather_collect(mysql_module_t *m, packet_t *pkt) {
+    packet_cols_t cols;
+    packet_cols_init(&cols, MYSQL_SUBS);
+    packet_col(&cols, "tag", COL_STR, 0);
+    packet_col(&cols, "cost", COL_U64, 0);
+    packet_col(&cols, "every", COL_U64, 0);
+    for(int i=0; i<MYSQL_SUBS; i++) {
+        packet_row(&cols);
+        packet_put_str(&cols, mysql_subs[i].tag, -1);
+        packet_put_u64(&cols, m->adapt[i].cost);
+        packet_put_u64(&cols, (m->caps & mysql_subs[i].caps) != mysql_subs[i].caps ? 0 : m->adapt[i].every ? m->adapt[i].every : 1);
+    }
+
+    packet_append(pkt, "\"threads_running\":%lu", m->threads_running);
+    packet_cols(pkt, &cols);
+    packet_append(pkt, ",\"caps\":%u,\"version\":%lu", m->caps, m->version);
+    packet_cols_fini(&cols);
+
+    return ENONE;
 }
 
 int _mysql_gather_crud(mysql_module_t *m, packet_t *pkt) {
@@ -153,8 +915,14 @@ int _mysql_gather_crud(mysql_module_t *m, packet_t *pkt) {
         mysql_free_result(res);
     }
     
-    res = query_result(m->mysql, "select 'alter' name, sum(variable_value) value from information_schema.global_status where variable_name like 'com_alter%' union all select 'create' name, sum(variable_value) value from information_schema.global_status where variable_name like 'com_create%' union all select 'drop' name, sum(variable_value) value from information_schema.global_status where variable_name like 'com_drop%';");
-    if(res) {
+    // information_schema.global_status is gone in 8.0
+    const char *schema = m->caps & CAP_PS_STATUS ? "performance_schema" : m->caps & CAP_IS_STATUS ? "information_schema" : NULL;
+    char query[BFSZ*4];
+    if(schema) {
+        snprintf(query, sizeof(query), "select 'alter' name, sum(variable_value) value from %s.global_status where variable_name like 'com_alter%%' union all select 'create' name, sum(variable_value) value from %s.global_status where variable_name like 'com_create%%' union all select 'drop' name, sum(variable_value) value from %s.global_status where variable_name like 'com_drop%%';", schema, schema, schema);
+        res = query_result(m->mysql, query);
+    }
+    if(schema && res) {
         error = ENONE;
         while((row = mysql_fetch_row(res))) {
             packet_append(pkt, "%s\"%s\":%s", comma?",":"", row[0], row[1]);
@@ -179,217 +947,1707 @@ int _mysql_gather_query(mysql_module_t *m, packet_t *pkt) {
             packet_append(pkt, "\"slow_queries\":%s", row[1]);
         mysql_free_result(res);
     }
-    /*
-	res = query_result(((mysql_m_t *)p->m)->mysql, \
-			"show global variables where variable_name in (\
-		  'slow_query_log',\
-			'slow_query_log_file'\
-			);");
-	int slow_query_log = 0;
-	char slow_query_log_file[100];
-	while((row = mysql_fetch_row(res))) {
-		if(strncmp("slow_query_log_file", row[0], 19) == 0) {
-			strncpy(slow_query_log_file, row[1], 100);
-		} else if(strncmp("slow_query_log", row[0], 14) == 0) {
-			slow_query_log = strncmp("ON", row[1], 2)==0;
-		}
-	}
-	if(slow_query_log) {
-		FILE *log = fopen(slow_query_log_file, "r");
-		if(log) fclose(log);
-	}
-    */
-    res = query_result(m->mysql, "select user_host,ifnull(sql_text, ''),TIME_TO_SEC(query_time),concat(UNIX_TIMESTAMP(start_time),'000'),rows_sent,rows_examined from mysql.slow_log where start_time>=now()-interval 30 minute and sql_text not like '%%#exem_moc#%%' limit 100;");
-    if(!res) return error;
-    int k = 0;
-    struct {
-        char user[BFSZ];
-        char sql_text[BFSZ];
-        unsigned long long query_time;
-        epoch_t start_time;
-        unsigned long rows_sent;
-        unsigned long rows_examined;
-    } slow_queries[BFSZ];
-
-    while ((row = mysql_fetch_row(res))) {
-        sscanf(row[0], "%s", slow_queries[k].user);
-        sscanf(row[1], "%s", slow_queries[k].sql_text);
-        sscanf(row[2], "%llu", &slow_queries[k].query_time);
-        sscanf(row[3], "%llu", &slow_queries[k].start_time);
-        sscanf(row[4], "%lu", &slow_queries[k].rows_sent);
-        sscanf(row[5], "%lu", &slow_queries[k].rows_examined);
-        k++;
-    }
-	mysql_free_result(res);
 
-    if(k == 0) return error;
+    switch(m->slow.source) {
+        case SLOW_TABLE:
+        if(_mysql_slow_table(m, pkt) == ENONE)
+            error = ENONE;
+        break;
 
-    packet_append(pkt, ",\"user\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", slow_queries[k].user);
-    packet_append(pkt, "],\"sql\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", slow_queries[k].sql_text);
-    packet_append(pkt, "],\"query_time\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", slow_queries[k].query_time);
-    packet_append(pkt, "],\"start_time\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", slow_queries[k].start_time);
-    packet_append(pkt, "],\"rows_sent\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%lu", i?",":"", slow_queries[k].rows_sent);
-    packet_append(pkt, "],\"rows_examined\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%lu", i?",":"", slow_queries[k].rows_examined);
-    packet_append(pkt, "]");
+        case SLOW_FILE:
+        if(_mysql_slow_file(m, pkt) == ENONE)
+            error = ENONE;
+        break;
+
+        case SLOW_NONE:
+        break;
+    }
 
     return error;
 }
 
-int _mysql_gather_innodb(mysql_module_t *m, packet_t *pkt) {
-	MYSQL_RES *res;
+/*
+ * Slow queries from mysql.slow_log
+ *
+ * Rows are read in pages after the (start_time, thread_id) cursor. It moves
+ * only once the rows are kept in the packet, so every slow query is packed
+ * once. A burst that does not fit in the packet is drained over the
+ * following ticks.
+ */
+int _mysql_slow_table(mysql_module_t *m, packet_t *pkt) {
+    MYSQL_RES *res[SLOW_PAGES];
     MYSQL_ROW row;
 
-    int error = ENODATA;
+    mysql_slow_entry_t slow_queries[SLOW_ROWS];
+    int k = 0, pages = 0;
+    int room = (PKTSZ - pkt->size) / 2;
 
-    res = query_result(m->mysql, "show global variables where variable_name in ('innodb_buffer_pool_size');");
-    if(res) {
-        error = ENONE;
-        while((row = mysql_fetch_row(res))) {
-            packet_append(pkt, "\"%s\":", row[0]+14);
-            packet_append(pkt, "%s", row[1]);
+    epoch_t start_us = m->slow.start_us;
+    unsigned long thread_id = m->slow.thread_id;
+
+    while(pages < SLOW_PAGES) {
+        char query[BFSZ*8];
+        snprintf(query, sizeof(query), "select user_host,ifnull(sql_text,''),time_to_sec(query_time),floor(unix_timestamp(start_time)*1000),rows_sent,rows_examined,cast(unix_timestamp(start_time)*1000000 as unsigned),thread_id from mysql.slow_log where (start_time>from_unixtime(%llu.%06llu) or (start_time=from_unixtime(%llu.%06llu) and thread_id>%lu)) and sql_text not like '%%#exem_moc#%%' order by start_time,thread_id limit %d;", start_us/1000000, start_us%1000000, start_us/1000000, start_us%1000000, thread_id, SLOW_PAGE);
+        if(!(res[pages] = query_result(m->mysql, query)))
+            break;
+
+        int n = 0;
+        while((row = mysql_fetch_row(res[pages]))) {
+            unsigned long *len = mysql_fetch_lengths(res[pages]);
+            n++;
+
+            mysql_slow_entry_t *e = &slow_queries[k];
+            e->user     = row[0];
+            e->user_len = strcspn(row[0], " ");
+            e->sql      = row[1];
+            e->sql_len  = len[1]<SLOW_SQL_MAX ? len[1] : SLOW_SQL_MAX;
+            if((room -= e->user_len + e->sql_len + BFSZ/2) < 0)
+                break;
+
+            sscanf(row[2], "%llu", &e->query_time);
+            sscanf(row[3], "%llu", &e->start_time);
+            sscanf(row[4], "%lu", &e->rows_sent);
+            sscanf(row[5], "%lu", &e->rows_examined);
+            sscanf(row[6], "%llu", &start_us);
+            sscanf(row[7], "%lu", &thread_id);
+            k++;
         }
-        mysql_free_result(res);
+        pages++;
+
+        if(room < 0 || n < SLOW_PAGE)
+            break;
     }
 
-	res = query_result(m->mysql, "show global status where variable_name in ('innodb_buffer_pool_pages_dirty','innodb_buffer_pool_pages_free','innodb_buffer_pool_pages_data','innodb_buffer_pool_read_requests','innodb_buffer_pool_reads','innodb_buffer_pool_write_requests','innodb_pages_created','innodb_pages_read','innodb_pages_written');");
-    if(res) {
+    int error = ENODATA;
+    if(k > 0) {
+        _mysql_slow_emit(m, pkt, slow_queries, k);
+        m->pending.slow = 1;
+        m->pending.start_us = start_us;
+        m->pending.thread_id = thread_id;
+        m->pending.offset = m->slow.offset;
+        m->pending.unread = m->slow.pending;
         error = ENONE;
-        while((row = mysql_fetch_row(res))) {
-            packet_append(pkt, ",\"%s\":", row[0]+7);
-            packet_append(pkt, "%s", row[1]);
+    }
+
+    while(pages--)
+        mysql_free_result(res[pages]);
+
+    return error;
+}
+
+/*
+ * Slow queries from slow_query_log_file
+ *
+ * The log file is tailed from the saved offset whenever inotify reports a
+ * change. Only complete entries are consumed; an entry still being written
+ * is read again on the next tick. The offset passes the entries sent only
+ * once they are kept in the packet, until then they stay unread.
+ */
+int _mysql_slow_file(mysql_module_t *m, packet_t *pkt) {
+    char events[BFSZ*8];
+    ssize_t len;
+    int reopen = 0;
+
+    while((len = read(m->slow.ifd, events, sizeof(events))) > 0) {
+        for(char *p=events; p<events+len; p+=sizeof(struct inotify_event)+((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if(ev->wd == m->slow.wd && ev->mask & (IN_MOVE_SELF|IN_DELETE_SELF))
+                reopen = 1;
+            m->slow.pending = 1;
         }
-        mysql_free_result(res);
     }
 
-    res = query_result(m->mysql, "show engine innodb status;");
-    if(!res) return error;
-    row = mysql_fetch_row(res);
-    char *match = "Ibuf";
-    unsigned long long total, free, used;
-    for(int i=0; i<strlen(row[2]); ++i) {
-        if(strncmp(row[2]+i, match, 4) == 0)
-            if(sscanf(row[2]+i, "Ibuf: size %llu, free list len %llu, seg size %llu", &used, &free, &total) == 3) {
-                error = ENONE;
-                packet_append(pkt, ",\"cell_count\":%llu", total);
-                packet_append(pkt, ",\"free_cells\":%llu", free);
-                packet_append(pkt, ",\"used_cells\":%llu", used);
+    if(reopen || m->slow.fd < 0)
+        if(_mysql_slow_open(m) < 0)
+            return ENODATA;
+    if(!m->slow.pending)
+        return ENODATA;
+
+    len = pread(m->slow.fd, m->slow.buf, SLOW_CHUNK, m->slow.offset);
+    if(len <= 0) {
+        m->slow.pending = 0;
+        return ENODATA;
+    }
+    int unread = len == SLOW_CHUNK;
+
+    mysql_slow_entry_t slow_queries[SLOW_ROWS];
+    mysql_slow_entry_t *e = NULL;
+    int k = 0;
+    char *end = m->slow.buf + len;
+    char *consumed = m->slow.buf;
+
+    for(char *line=m->slow.buf, *next; line<end; line=next) {
+        char *nl = memchr(line, '\n', end-line);
+        if(!nl) break;
+        next = nl + 1;
+
+        if(!strncmp(line, "# Time:", 7) || !strncmp(line, "# User@Host:", 12)) {
+            if(e && e->sql) {
+                consumed = line;
+                e = NULL;
             }
+            if(!e) {
+                if(k == SLOW_ROWS) break;
+                e = &slow_queries[k++];
+                memset(e, 0, sizeof(*e));
+                e->begin = line;
+            }
+            if(line[2] == 'U') {
+                e->user = line + 13;
+                e->user_len = strcspn(e->user, " \n");
+            }
+        } else if(!e) {
+            // Before the first entry of the chunk
+            consumed = next;
+        } else if(!strncmp(line, "# Query_time:", 13)) {
+            double query_time;
+            if(sscanf(line, "# Query_time: %lf %*s %*s Rows_sent: %lu Rows_examined: %lu", &query_time, &e->rows_sent, &e->rows_examined) >= 1)
+                e->query_time = query_time;
+        } else if(!strncmp(line, "SET timestamp=", 14)) {
+            e->start_time = strtoull(line+14, NULL, 10) * MSPS;
+        } else if(line[0] == '#' || !strncmp(line, "use ", 4)
+                || !strncmp(line, "Tcp port:", 9) || !strncmp(line, "Time  ", 6) || strstr(line, ", Version: ")) {
+            // Comments, default database and the header written by FLUSH LOGS
+        } else if(!e->sql) {
+            e->sql = line;
+            e->sql_len = nl - line;
+        } else {
+            e->sql_len = nl - e->sql;
+        }
+
+        // The server writes an entry at once, so a last line with ';' ends it
+        if(next == end && e && e->sql && nl > line && nl[-1] == ';' && !unread)
+            consumed = end;
     }
-    mysql_free_result(res);
 
-    return error;
+    // Drop the trailing entry that is not complete yet
+    while(k > 0 && (!slow_queries[k-1].sql || slow_queries[k-1].sql >= consumed))
+        k--;
+
+    if(consumed == m->slow.buf && unread) {
+        // An entry larger than a chunk, skip it
+        m->slow.offset += len;
+        m->slow.pending = 1;
+        _mysql_slow_save(m);
+        return ENODATA;
+    }
+
+    int room = (PKTSZ - pkt->size) / 2;
+    for(int i=0; i<k; i++) {
+        mysql_slow_entry_t *e = &slow_queries[i];
+        while(e->sql_len > 0 && strchr(" ;\r\n", e->sql[e->sql_len-1]))
+            e->sql_len--;
+        if(e->sql_len > SLOW_SQL_MAX)
+            e->sql_len = SLOW_SQL_MAX;
+        if((room -= e->user_len + e->sql_len + BFSZ/2) < 0) {
+            consumed = (char *)e->begin;
+            unread = 1;
+            k = i;
+            break;
+        }
+    }
+
+    long offset = m->slow.offset + (consumed - m->slow.buf);
+    if(k == 0) {
+        // Only headers or comments were consumed
+        m->slow.offset = offset;
+        m->slow.pending = unread;
+        _mysql_slow_save(m);
+        return ENODATA;
+    }
+    _mysql_slow_emit(m, pkt, slow_queries, k);
+
+    // Read again next tick unless the packet keeps them
+    m->slow.pending = 1;
+    m->pending.slow = 1;
+    m->pending.start_us = m->slow.start_us;
+    m->pending.thread_id = m->slow.thread_id;
+    m->pending.offset = offset;
+    m->pending.unread = unread;
+
+    return ENONE;
 }
 
-int _mysql_gather_thread(mysql_module_t *m, packet_t *pkt) {
-	MYSQL_RES *res;
-    MYSQL_ROW row;
+/*
+ * Slow queries grouped by fingerprint
+ *
+ * A group carries its count, summed time and rows, and the first user and
+ * start time. The normalized text goes out once per digest_interval, later
+ * groups with the same fingerprint send "".
+ */
+void _mysql_slow_emit(mysql_module_t *m, packet_t *pkt, mysql_slow_entry_t *slow_queries, int k) {
+    mysql_slow_group_t group[SLOW_ROWS];
+    short slot[SLOW_ROWS*2];
+    char sql[SLOW_SQL_MAX];
+    int n = 0;
 
-    int error = ENODATA;
-    int comma = 0;
+    memset(slot, -1, sizeof(slot));
+    for(int i=0; i<k; i++) {
+        mysql_slow_entry_t *e = &slow_queries[i];
+        unsigned long long fingerprint;
+        size_t len = digest_normalize(e->sql ? e->sql : "", e->sql ? e->sql_len : 0, sql, SLOW_SQL_MAX, &fingerprint);
 
-    res = query_result(m->mysql, "show global status where variable_name in ('connections','threads_connected','threads_running');");
-    if(res) {
-        error = ENONE;
-        while((row = mysql_fetch_row(res))) {
-            packet_append(pkt, "%s\"%s\":%s", comma?",":"", row[0], row[1]);
-            comma = 1;
+        int j = fingerprint % (SLOW_ROWS*2);
+        while(slot[j] >= 0 && group[slot[j]].fingerprint != fingerprint)
+            j = (j+1) % (SLOW_ROWS*2);
+        if(slot[j] < 0) {
+            slot[j] = n;
+            memset(&group[n], 0, sizeof(group[n]));
+            group[n].fingerprint = fingerprint;
+            group[n].first = e;
+            if(!_mysql_digest_sent(m, fingerprint)) {
+                group[n].sql = arena_strndup(&m->arena, sql, len);
+                group[n].sql_len = group[n].sql ? len : 0;
+            }
+            n++;
         }
-        mysql_free_result(res);
-    }
 
-    res = query_result(m->mysql, "select a.id,ifnull(b.thread_id,''),ifnull(a.info,''),ifnull(a.user,''),ifnull(a.host,''),ifnull(a.db,''),a.time,ifnull(round(c.timer_wait/1000000000000,3),''),ifnull(c.event_id,''),ifnull(c.event_name,''),a.command,a.state from information_schema.processlist a left join performance_schema.threads b on a.id=b.processlist_id left join performance_schema.events_waits_current c on b.thread_id=c.thread_id where 1=1 and (a.info is null or a.info not like '%#exem_moc#%')");
+        mysql_slow_group_t *g = &group[slot[j]];
+        g->count++;
+        g->query_time += e->query_time;
+        if(e->query_time > g->query_time_max)
+            g->query_time_max = e->query_time;
+        g->rows_sent += e->rows_sent;
+        g->rows_examined += e->rows_examined;
+    }
 
-    int k = 0;
-    struct {
-        unsigned long id;
-        unsigned long thread_id;
-        char info[BFSZ];
-        char user[BFSZ];
-        char host[BFSZ];
-        char db[BFSZ];
-        unsigned long long time;
-        unsigned long long timer_wait;
-        unsigned long event_id;
-        char event_name[BFSZ];
-        char command[BFSZ];
-        char state[BFSZ];
-    } threads[BFSZ];
+    packet_cols_t cols;
+    packet_cols_init(&cols, n);
+    packet_col(&cols, "fingerprint", COL_HEX, 0);
+    packet_col(&cols, "sql", COL_STR, 0);
+    packet_col(&cols, "user", COL_STR, 0);
+    static const char *keys[] = {"count", "query_time", "query_time_max", "start_time", "rows_sent", "rows_examined"};
+    for(int c=0; c<sizeof(keys)/sizeof(keys[0]); c++)
+        packet_col(&cols, keys[c], COL_U64, 0);
+    for(int i=0; i<n; i++) {
+        packet_row(&cols);
+        packet_put_hex(&cols, group[i].fingerprint);
+        packet_put_str(&cols, group[i].sql, group[i].sql_len);
+        packet_put_str(&cols, group[i].first->user, group[i].first->user_len);
+        packet_put_u64(&cols, group[i].count);
+        packet_put_u64(&cols, group[i].query_time);
+        packet_put_u64(&cols, group[i].query_time_max);
+        packet_put_u64(&cols, group[i].first->start_time);
+        packet_put_u64(&cols, group[i].rows_sent);
+        packet_put_u64(&cols, group[i].rows_examined);
+    }
+    if(packet_cols(pkt, &cols) == 0) {
+        for(int i=0; i<n; i++)
+            if(group[i].sql)
+                m->pending.digest[m->pending.ndigest++] = group[i].fingerprint;
+    }
+    packet_cols_fini(&cols);
+}
 
-    if(!res) return error;
-    while ((row = mysql_fetch_row(res))) {
-        sscanf(row[0], "%lu", &threads[k].id);
-        sscanf(row[1], "%lu", &threads[k].thread_id);
-        sscanf(row[2], "%s", threads[k].info);
-        sscanf(row[3], "%s", threads[k].user);
-        sscanf(row[4], "%s", threads[k].host);
-        sscanf(row[5], "%s", threads[k].db);
-        sscanf(row[6], "%llu", &threads[k].time);
-        sscanf(row[7], "%llu", &threads[k].timer_wait);
-        sscanf(row[8], "%lu", &threads[k].event_id);
-        sscanf(row[9], "%s", threads[k].event_name);
-        sscanf(row[10], "%s", threads[k].command);
-        sscanf(row[11], "%s", threads[k].state);
-        k++;
+/*
+ * Whether the text of a fingerprint went out this interval
+ */
+int _mysql_digest_sent(mysql_module_t *m, unsigned long long fingerprint) {
+    epoch_t now = epoch_time();
+    if(now - m->digest.since >= m->opt.digest_interval*MSPS) {
+        memset(m->digest.sent, 0, sizeof(m->digest.sent));
+        m->digest.n = 0;
+        m->digest.since = now;
     }
-    mysql_free_result(res);
 
-    if(k == 0) return error;
+    if(!fingerprint) fingerprint = 1;
+    for(unsigned int i=fingerprint%DIGEST_SENT; m->digest.sent[i]; i=(i+1)%DIGEST_SENT)
+        if(m->digest.sent[i] == fingerprint)
+            return 1;
+    return 0;
+}
 
-    packet_append(pkt, "%s\"id\":[", comma?",":"");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%lu\"", i?",":"", threads[k].id);
-    packet_append(pkt, "],\"thread_id\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%lu\"", i?",":"", threads[k].thread_id);
-    packet_append(pkt, "],\"info\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].info);
-    packet_append(pkt, "],\"user\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].user);
-    packet_append(pkt, "],\"host\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].host);
-    packet_append(pkt, "],\"db\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].db);
-    packet_append(pkt, "],\"time\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%llu\"", i?",":"", threads[k].time);
-    packet_append(pkt, "],\"timer_wait\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%llu\"", i?",":"", threads[k].timer_wait);
-    packet_append(pkt, "],\"event_id\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%lu\"", i?",":"", threads[k].event_id);
-    packet_append(pkt, "],\"event_name\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].event_name);
-    packet_append(pkt, "],\"command\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].command);
-    packet_append(pkt, "],\"state\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", threads[k].state);
-    packet_append(pkt, "]");
+/*
+ * Marks the text of a fingerprint as sent, once it is in the packet
+ */
+void _mysql_digest_mark(mysql_module_t *m, unsigned long long fingerprint) {
+    if(m->digest.n*4 >= DIGEST_SENT*3) {
+        memset(m->digest.sent, 0, sizeof(m->digest.sent));
+        m->digest.n = 0;
+        m->digest.since = epoch_time();
+    }
 
-    return error;
+    if(!fingerprint) fingerprint = 1;
+    unsigned int i = fingerprint % DIGEST_SENT;
+    for(; m->digest.sent[i]; i=(i+1)%DIGEST_SENT)
+        if(m->digest.sent[i] == fingerprint)
+            return;
+    m->digest.sent[i] = fingerprint;
+    m->digest.n++;
 }
 
+/*
+ * Choose where slow queries come from and restore the saved cursor
+ */
+int _mysql_slow_prep(mysql_module_t *m) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    char log_output[BFSZ] = "";
+    m->slow.source = SLOW_NONE;
+
+    res = query_result(m->mysql, "show global variables where variable_name in ('log_output','slow_query_log_file');");
+    if(!res) return -1;
+    while((row = mysql_fetch_row(res))) {
+        if(!strcmp(row[0], "log_output"))
+            snprintf(log_output, BFSZ, "%s", row[1]);
+        else
+            snprintf(m->slow.path, sizeof(m->slow.path), "%s", row[1]);
+    }
+    mysql_free_result(res);
+
+    snprintf(m->slow.state, sizeof(m->slow.state), SLOW_STATE, m->host, m->port);
+    FILE *fp = fopen(m->slow.state, "r");
+    if(fp) {
+        if(fscanf(fp, "%llu%lu%lu%ld", &m->slow.start_us, &m->slow.thread_id, &m->slow.ino, &m->slow.offset) != 4)
+            m->slow.start_us = 0;
+        fclose(fp);
+    }
+
+    if(strstr(log_output, "TABLE") && m->caps & CAP_SLOW_TABLE) {
+        m->slow.source = SLOW_TABLE;
+        if(m->slow.start_us) return 0;
+
+        res = query_result(m->mysql, "select cast(unix_timestamp(now(6)-interval 30 minute)*1000000 as unsigned);");
+        if(!res) return -1;
+        if((row = mysql_fetch_row(res)))
+            sscanf(row[0], "%llu", &m->slow.start_us);
+        mysql_free_result(res);
+    } else if(strstr(log_output, "FILE") && m->slow.path[0] && (!strcmp(m->host, "localhost") || !strcmp(m->host, "127.0.0.1"))) {
+        if(!m->slow.buf && !(m->slow.buf = malloc(SLOW_CHUNK)))
+            return -1;
+        if(m->slow.ifd < 0 && (m->slow.ifd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0)
+            return -1;
+        m->slow.source = SLOW_FILE;
+        _mysql_slow_open(m);
+    }
+
+    return 0;
+}
+
+int _mysql_slow_open(mysql_module_t *m) {
+    struct stat st;
+
+    if(m->slow.fd >= 0) {
+        close(m->slow.fd);
+        m->slow.fd = -1;
+    }
+    if(m->slow.wd >= 0) {
+        inotify_rm_watch(m->slow.ifd, m->slow.wd);
+        m->slow.wd = -1;
+    }
+
+    if((m->slow.fd = open(m->slow.path, O_RDONLY|O_CLOEXEC)) < 0)
+        return -1;
+    if(fstat(m->slow.fd, &st) < 0) {
+        close(m->slow.fd);
+        m->slow.fd = -1;
+        return -1;
+    }
+    m->slow.wd = inotify_add_watch(m->slow.ifd, m->slow.path, IN_MODIFY|IN_MOVE_SELF|IN_DELETE_SELF);
+
+    if(st.st_ino == m->slow.ino && st.st_size >= m->slow.offset) {
+        // Resume where the last run stopped
+    } else if(m->slow.ino == 0) {
+        // The first run, skip the history
+        m->slow.offset = st.st_size;
+    } else {
+        // Rotated or truncated
+        m->slow.offset = 0;
+    }
+    m->slow.ino = st.st_ino;
+    m->slow.pending = 1;
+    _mysql_slow_save(m);
+
+    return 0;
+}
+
+void _mysql_slow_save(mysql_module_t *m) {
+    FILE *fp = fopen(m->slow.state, "w");
+    if(!fp) return;
+    fprintf(fp, "%llu %lu %lu %ld\n", m->slow.start_us, m->slow.thread_id, m->slow.ino, m->slow.offset);
+    fclose(fp);
+}
+
+int _mysql_gather_innodb(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    int error = ENODATA;
+
+	res = query_result(m->mysql, "show global status where variable_name in ('innodb_buffer_pool_pages_dirty','innodb_buffer_pool_pages_free','innodb_buffer_pool_pages_data','innodb_buffer_pool_read_requests','innodb_buffer_pool_reads','innodb_buffer_pool_write_requests','innodb_pages_created','innodb_pages_read','innodb_pages_written');");
+    if(res) {
+        error = ENONE;
+        while((row = mysql_fetch_row(res))) {
+            packet_append(pkt, "%s\"%s\":", packet_last(pkt)=='{'?"":",", row[0]+7);
+            packet_append(pkt, "%s", row[1]);
+        }
+        mysql_free_result(res);
+    }
+
+    res = query_result(m->mysql, "show engine innodb status;");
+    if(!res) return error;
+    row = mysql_fetch_row(res);
+    unsigned long *len = mysql_fetch_lengths(res);
+    if(row && row[2] && innodb_status_parse(row[2], len[2], &m->innodb) == 0) {
+        error = ENONE;
+        _mysql_innodb_emit(m, pkt);
+    }
+    mysql_free_result(res);
+
+    return error;
+}
+
+void _mysql_innodb_emit(mysql_module_t *m, packet_t *pkt) {
+    innodb_status_t *st = &m->innodb;
+
+    packet_append(pkt, "%s\"history_list_length\":%llu", packet_last(pkt)=='{'?"":",", st->history_list_length);
+
+    if(innodb_status_has(st, INNODB_SEMAPHORES))
+        packet_append(pkt, ",\"semaphore_waits\":%lu,\"os_reservations\":%llu,\"os_signals\":%llu,\"spin_waits\":%llu,\"spin_rounds\":%llu,\"os_waits\":%llu", st->semaphore_waits, st->reservation_count, st->signal_count, st->spin_waits, st->spin_rounds, st->os_waits);
+
+    if(innodb_status_has(st, INNODB_TRANSACTIONS))
+        packet_append(pkt, ",\"trx_count\":%lu,\"trx_active\":%lu,\"trx_id_counter\":%llu", st->trx_count, st->trx_active, st->trx_id_counter);
+
+    if(innodb_status_has(st, INNODB_FILE_IO))
+        packet_append(pkt, ",\"pending_reads\":%lu,\"pending_writes\":%lu,\"pending_ibuf_reads\":%lu,\"pending_log_io\":%lu,\"pending_sync_io\":%lu,\"pending_fsync_log\":%lu,\"pending_fsync_bp\":%lu", st->pending_reads, st->pending_writes, st->pending_ibuf_reads, st->pending_log_io, st->pending_sync_io, st->pending_fsync_log, st->pending_fsync_bp);
+
+    if(innodb_status_has(st, INNODB_INSERT_BUFFER))
+        packet_append(pkt, ",\"cell_count\":%llu,\"free_cells\":%llu,\"used_cells\":%llu", st->ibuf_seg, st->ibuf_free, st->ibuf_size);
+
+    if(innodb_status_has(st, INNODB_LOG))
+        packet_append(pkt, ",\"lsn\":%llu,\"flush_lag\":%llu,\"checkpoint_age\":%llu,\"pending_log_flushes\":%lu,\"pending_chkp_writes\":%lu", st->lsn, st->lsn-st->lsn_flushed, st->lsn-st->checkpoint, st->pending_log_flushes, st->pending_chkp_writes);
+
+    if(innodb_status_has(st, INNODB_ROW_OPERATIONS))
+        packet_append(pkt, ",\"queries_inside\":%lu,\"queries_queued\":%lu,\"inserts_s\":%.2f,\"updates_s\":%.2f,\"deletes_s\":%.2f,\"reads_s\":%.2f", st->queries_inside, st->queries_queued, st->inserts, st->updates, st->deletes, st->reads);
+
+    // The latest deadlock and foreign key error stay in the output until the next one
+    if(innodb_status_has(st, INNODB_DEADLOCK) && st->deadlock.hash != m->deadlock_hash) {
+        packet_append(pkt, ",\"deadlock\":{\"hash\":\"%016llx\",\"time\":\"%s\"}", st->deadlock.hash, st->deadlock.time);
+        m->pending.deadlock_hash = st->deadlock.hash;
+    }
+    if(innodb_status_has(st, INNODB_FOREIGN_KEY) && st->fk_error.hash != m->fk_error_hash) {
+        packet_append(pkt, ",\"fk_error\":{\"hash\":\"%016llx\",\"time\":\"%s\"}", st->fk_error.hash, st->fk_error.time);
+        m->pending.fk_error_hash = st->fk_error.hash;
+    }
+}
+
+/*
+ * Slow-changing settings, rendered once per TTL and sent only when they change
+ */
+int _mysql_gather_meta(mysql_module_t *m, packet_t *pkt) {
+    epoch_t now = epoch_time();
+    for(int g=0; g<META_GROUPS; g++)
+        if(!m->meta[g].fetched || now-m->meta[g].fetched >= (epoch_t)m->opt.ttl[g]*MSPS)
+            _mysql_meta_fetch(m, g);
+
+    return _mysql_meta_emit(m, pkt, 0) ? ENONE : ENODATA;
+}
+
+/*
+ * Appends every group to the registration packet
+ */
+void mysql_regr(void *_m, packet_t *pkt) {
+    mysql_module_t *m = _m;
+    for(int g=0; g<META_GROUPS; g++)
+        if(!m->meta[g].fetched)
+            _mysql_meta_fetch(m, g);
+
+    packet_append(pkt, ",\"meta\":{");
+    _mysql_meta_emit(m, pkt, 1);
+    packet_append(pkt, "}");
+}
+
+/*
+ * Renders a group as a JSON object, marks it dirty if it differs from the cache
+ */
+int _mysql_meta_fetch(mysql_module_t *m, int g) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    mysql_meta_t *meta = &m->meta[g];
+    meta->fetched = epoch_time();
+    if(!(res = query_result(m->mysql, meta_groups[g].query)))
+        return -1;
+
+    char json[META_MAX];
+    int len = 0;
+    while((row = mysql_fetch_row(res)) && len < META_MAX) {
+        const char *v = row[1] ? row[1] : "";
+        int number = *v && strspn(v, "0123456789") == strlen(v);
+        len += snprintf(json+len, META_MAX-len, "%s\"%s\":%s", len?",":"", row[0], number?"":"\"");
+        if(len >= META_MAX)
+            break;
+        len += number ? snprintf(json+len, META_MAX-len, "%s", v) : escape_json(json+len, META_MAX-len, v, strlen(v));
+        if(!number && len < META_MAX)
+            json[len++] = '"';
+    }
+    mysql_free_result(res);
+
+    if(len >= META_MAX)
+        return -1;
+    if(len == meta->len && !memcmp(json, meta->json, len))
+        return 0;
+
+    memcpy(meta->json, json, len);
+    meta->len = len;
+    meta->dirty = 1;
+    return 1;
+}
+
+/*
+ * Returns how many groups were written
+ */
+int _mysql_meta_emit(mysql_module_t *m, packet_t *pkt, int all) {
+    int k = 0;
+    for(int g=0; g<META_GROUPS; g++) {
+        mysql_meta_t *meta = &m->meta[g];
+        if(!meta->len || !(all || meta->dirty))
+            continue;
+        if(PKTSZ - pkt->size < meta->len + BFSZ)
+            break;
+
+        packet_append(pkt, "%s\"%s\":{%.*s}", k?",":"", meta_groups[g].key, meta->len, meta->json);
+        meta->dirty = 0;
+        k++;
+    }
+    return k;
+}
+
+/*
+ * InnoDB metrics
+ *
+ * The enabled counters of information_schema.innodb_metrics are looked up
+ * every metrics_refresh seconds. Every tick fetches only those counters by
+ * name and sends deltas of counters and values of gauges.
+ */
+int _mysql_gather_metrics(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    if(!m->metrics) {
+        if(!(m->metrics = malloc(sizeof(mysql_metrics_t))))
+            return ENODATA;
+        memset(m->metrics, 0, sizeof(mysql_metrics_t));
+    }
+    mysql_metrics_t *mt = m->metrics;
+
+    if(!mt->refreshed || epoch_time()-mt->refreshed >= (epoch_t)m->opt.metrics_refresh*MSPS)
+        if(_mysql_metrics_refresh(m) < 0)
+            return ENODATA;
+    if(mt->n == 0 || !(res = query_result(m->mysql, mt->query)))
+        return ENODATA;
+
+    int k = 0;
+    int emit[METRICS_MAX];
+    while((row = mysql_fetch_row(res)) && k < METRICS_MAX) {
+        mysql_metric_t *c = bsearch(row[0], mt->counter, mt->n, sizeof(mysql_metric_t), _mysql_metric_cmp);
+        if(!c) continue;
+
+        long long value = strtoll(row[1], NULL, 10);
+        if(!c->counter) {
+            c->delta = value;
+            emit[k++] = c - mt->counter;
+        } else if(c->valid && value >= c->value) {
+            c->delta = value - c->value;
+            emit[k++] = c - mt->counter;
+        }
+        c->value = value;
+        c->valid = 1;
+    }
+    mysql_free_result(res);
+
+    if(k == 0) return ENODATA;
+
+    packet_cols_t cols;
+    packet_cols_init(&cols, k);
+    packet_col(&cols, "name", COL_STR, 0);
+    packet_col(&cols, "value", COL_I64, 0);
+    for(int i=0; i<k; i++) {
+        packet_row(&cols);
+        packet_put_str(&cols, mt->counter[emit[i]].name, -1);
+        packet_put_i64(&cols, mt->counter[emit[i]].delta);
+    }
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+
+    return ENONE;
+}
+
+int _mysql_metrics_refresh(mysql_module_t *m) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    mysql_metrics_t *mt = m->metrics;
+    mt->refreshed = epoch_time();
+
+    res = query_result(m->mysql, "select name,type from information_schema.innodb_metrics where status='enabled' and type<>'set_owner';");
+    if(!res) return -1;
+
+    mysql_metric_t *old = malloc(sizeof(mt->counter));
+    if(!old) {
+        mysql_free_result(res);
+        return -1;
+    }
+    memcpy(old, mt->counter, sizeof(mt->counter));
+    int old_n = mt->n;
+
+    size_t size = BFSZ*2;
+    mt->n = 0;
+    while((row = mysql_fetch_row(res)) && mt->n < METRICS_MAX) {
+        mysql_metric_t *c = &mt->counter[mt->n];
+        if(strlen(row[0]) >= sizeof(c->name)) continue;
+        snprintf(c->name, sizeof(c->name), "%s", row[0]);
+        c->counter = strcmp(row[1], "value") != 0;
+        c->valid = 0;
+
+        // Keep the last value of a counter that stays enabled
+        mysql_metric_t *prev = bsearch(c->name, old, old_n, sizeof(mysql_metric_t), _mysql_metric_cmp);
+        if(prev && prev->counter == c->counter) {
+            c->value = prev->value;
+            c->valid = prev->valid;
+        }
+
+        size += strlen(c->name) + 3;
+        mt->n++;
+    }
+    mysql_free_result(res);
+    free(old);
+
+    qsort(mt->counter, mt->n, sizeof(mysql_metric_t), _mysql_metric_cmp);
+
+    free(mt->query);
+    if(!(mt->query = malloc(size))) {
+        mt->n = 0;
+        return -1;
+    }
+    int len = sprintf(mt->query, "select name,count from information_schema.innodb_metrics where name in (");
+    for(int i=0; i<mt->n; i++)
+        len += sprintf(mt->query+len, "%s'%s'", i?",":"", mt->counter[i].name);
+    sprintf(mt->query+len, ");");
+
+    return 0;
+}
+
+int _mysql_metric_cmp(const void *name, const void *c) {
+    return strcmp(name, ((const mysql_metric_t *)c)->name);
+}
+
+int _mysql_gather_thread(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    int error = ENODATA;
+    int comma = 0;
+
+    res = query_result(m->mysql, "show global status where variable_name in ('connections','threads_connected','threads_running');");
+    if(res) {
+        error = ENONE;
+        while((row = mysql_fetch_row(res))) {
+            packet_append(pkt, "%s\"%s\":%s", comma?",":"", row[0], row[1]);
+            comma = 1;
+        }
+        mysql_free_result(res);
+    }
+
+    // Rows are streamed, so only what is kept in the arena stays in memory
+    // Wait columns need the consumer, the thread id performance_schema
+    const char *query;
+    if(m->caps & CAP_WAITS_CURRENT)
+        query = "select a.id,ifnull(b.thread_id,''),ifnull(a.info,''),ifnull(a.user,''),ifnull(a.host,''),ifnull(a.db,''),a.time,ifnull(round(c.timer_wait/1000000000000,3),''),ifnull(c.event_id,''),ifnull(c.event_name,''),a.command,ifnull(a.state,'') from information_schema.processlist a left join performance_schema.threads b on a.id=b.processlist_id left join performance_schema.events_waits_current c on b.thread_id=c.thread_id where 1=1 and (a.info is null or a.info not like '%#exem_moc#%')";
+    else if(m->caps & CAP_PS)
+        query = "select a.id,ifnull(b.thread_id,''),ifnull(a.info,''),ifnull(a.user,''),ifnull(a.host,''),ifnull(a.db,''),a.time,'','','',a.command,ifnull(a.state,'') from information_schema.processlist a left join performance_schema.threads b on a.id=b.processlist_id where 1=1 and (a.info is null or a.info not like '%#exem_moc#%')";
+    else
+        query = "select a.id,'',ifnull(a.info,''),ifnull(a.user,''),ifnull(a.host,''),ifnull(a.db,''),a.time,'','','',a.command,ifnull(a.state,'') from information_schema.processlist a where 1=1 and (a.info is null or a.info not like '%#exem_moc#%')";
+    if(mysql_query(m->mysql, query))
+        return error;
+    if(!(res = mysql_use_result(m->mysql)))
+        return error;
+
+    mysql_thread_t *threads = NULL, **tail = &threads;
+    int k = 0, total = 0;
+    int room = (PKTSZ - pkt->size) / 2;
+
+    while((row = mysql_fetch_row(res))) {
+        unsigned long *len = mysql_fetch_lengths(res);
+        total++;
+
+        int size = 0;
+        for(int c=0; c<THREAD_COLS; c++)
+            size += (c==THREAD_INFO && len[c]>THREAD_INFO_MAX ? THREAD_INFO_MAX : len[c]) + 4;
+        if(room < size)
+            continue;
+
+        mysql_thread_t *t = arena_alloc(&m->arena, sizeof(mysql_thread_t));
+        if(!t) continue;
+        for(int c=0; c<THREAD_COLS; c++) {
+            if(c == THREAD_INFO) {
+                // Literals stay on the server
+                t->col[c] = arena_alloc(&m->arena, THREAD_INFO_MAX);
+                t->len[c] = t->col[c] ? digest_normalize(row[c], len[c], t->col[c], THREAD_INFO_MAX, &t->fingerprint) : 0;
+                continue;
+            }
+            t->len[c] = len[c];
+            t->col[c] = arena_strndup(&m->arena, row[c], t->len[c]);
+            if(!t->col[c]) t->len[c] = 0;
+        }
+        room -= size;
+
+        *tail = t;
+        tail = &t->next;
+        k++;
+    }
+    *tail = NULL;
+    mysql_free_result(res);
+
+    if(k == 0) return error;
+
+    packet_cols_t cols;
+    packet_cols_init(&cols, k);
+    for(int c=0; c<THREAD_COLS; c++)
+        packet_col(&cols, thread_cols[c], COL_STR, 0);
+    packet_col(&cols, "fingerprint", COL_HEX, 0);
+    for(mysql_thread_t *t=threads; t; t=t->next) {
+        packet_row(&cols);
+        for(int c=0; c<THREAD_COLS; c++)
+            packet_put_str(&cols, t->col[c], t->len[c]);
+        packet_put_hex(&cols, t->len[THREAD_INFO] ? t->fingerprint : 0);
+    }
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+    packet_append(pkt, ",\"total\":%d", total);
+
+    return ENONE;
+}
+
+/*
+ * Active session history
+ *
+ * Aggregated (state, wait event, digest) counts of the sessions sampled
+ * every second since the last tick.
+ */
+int _mysql_gather_ash(mysql_module_t *m, packet_t *pkt) {
+    mysql_ash_t *ash = m->ash;
+    unsigned int count[ASH_KEYS] = {0};
+
+    if(!ash)
+        return ENODATA;
+
+    pthread_mutex_lock(&ash->lock);
+
+    int seconds = ash->head - ash->tail;
+    if(seconds == 0) {
+        pthread_mutex_unlock(&ash->lock);
+        return ENODATA;
+    }
+
+    for(int i=ash->tail; i<ash->head; i++) {
+        mysql_ash_slot_t *slot = &ash->slots[i%ASH_SLOTS];
+        for(int j=0; j<slot->n; j++)
+            count[slot->key[j]] += slot->count[j];
+        count[0] += slot->other;
+    }
+
+    packet_cols_t cols;
+    packet_cols_init(&cols, ash->nkeys);
+    packet_col(&cols, "state", COL_STR, 0);
+    packet_col(&cols, "event", COL_STR, 0);
+    packet_col(&cols, "digest", COL_STR, 0);
+    packet_col(&cols, "count", COL_U64, 0);
+    for(int i=0; i<ash->nkeys; i++) {
+        if(!count[i]) continue;
+        packet_row(&cols);
+        packet_put_str(&cols, ash->keys[i].state, -1);
+        packet_put_str(&cols, ash->keys[i].event, -1);
+        packet_put_str(&cols, ash->keys[i].digest, -1);
+        packet_put_u64(&cols, count[i]);
+    }
+    packet_append(pkt, "\"samples\":%d,\"dropped\":%lu", seconds, ash->dropped);
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+
+    // Every slot is drained, so the keys can be forgotten
+    ash->tail = ash->head;
+    ash->dropped = 0;
+    _mysql_ash_clear(ash);
+
+    pthread_mutex_unlock(&ash->lock);
+
+    return ENONE;
+}
+
+int _mysql_ash_start(mysql_module_t *m) {
+    if(m->ash) return 0;
+
+    mysql_ash_t *ash = malloc(sizeof(mysql_ash_t));
+    if(!ash) return -1;
+    memset(ash, 0, sizeof(mysql_ash_t));
+    _mysql_ash_clear(ash);
+
+    if(pthread_mutex_init(&ash->lock, NULL) < 0) {
+        free(ash);
+        return -1;
+    }
+
+    ash->alive = 1;
+    m->ash = ash;
+    if(pthread_create(&ash->thread, NULL, _mysql_ash_main, m) != 0) {
+        pthread_mutex_destroy(&ash->lock);
+        free(ash);
+        m->ash = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void _mysql_ash_stop(mysql_module_t *m) {
+    if(!m->ash) return;
+
+    m->ash->alive = 0;
+    pthread_join(m->ash->thread, NULL);
+    pthread_mutex_destroy(&m->ash->lock);
+    free(m->ash);
+    m->ash = NULL;
+}
+
+/*
+ * The sampler owns a connection, so sampling never waits for a tick
+ */
+void *_mysql_ash_main(void *_m) {
+    mysql_module_t *m = _m;
+    mysql_ash_t *ash = m->ash;
+
+    mysql_thread_init();
+
+    while(ash->alive) {
+        epoch_t begin = epoch_time();
+
+        if(!ash->mysql) {
+            my_bool b = 1;
+            if((ash->mysql = mysql_init(NULL))
+                    && (mysql_options(ash->mysql, MYSQL_OPT_RECONNECT, &b) < 0
+                    || !mysql_real_connect(ash->mysql, m->host, m->user, m->pass, NULL, m->port, NULL, 0))) {
+                mysql_close(ash->mysql);
+                ash->mysql = NULL;
+            }
+        }
+        if(ash->mysql && ash->tid != mysql_thread_id(ash->mysql)) {
+            ash->tid = mysql_thread_id(ash->mysql);
+            _mysql_session(ash->mysql, m->opt.timeout);
+        }
+        if(ash->mysql)
+            _mysql_ash_sample(ash);
+
+        float elapsed = (float)(epoch_time()-begin) / MSPS;
+        if(elapsed < ASH_TICK)
+            snyo_sleep(ASH_TICK - elapsed);
+    }
+
+    if(ash->mysql)
+        mysql_close(ash->mysql);
+    mysql_thread_end();
+
+    return NULL;
+}
+
+int _mysql_ash_sample(mysql_ash_t *ash) {
+    MYSQL_RES *res;
+    MYSQL_ROW row;
+
+    if(mysql_query(ash->mysql, "select ifnull(t.processlist_state,''),if(w.event_name is not null and w.end_event_id is null,w.event_name,'CPU'),ifnull(s.digest,'') from performance_schema.threads t left join performance_schema.events_waits_current w on w.thread_id=t.thread_id left join performance_schema.events_statements_current s on s.thread_id=t.thread_id where t.type='FOREGROUND' and t.processlist_command not in ('Sleep','Daemon','Binlog Dump','Binlog Dump GTID') and t.processlist_id<>connection_id();"))
+        return -1;
+    if(!(res = mysql_use_result(ash->mysql)))
+        return -1;
+
+    // Rows are counted by their text while streamed, the lock is only held to push the second
+    mysql_ash_key_t *seen = ash->seen;
+    unsigned int count[ASH_SLOT_KEYS], other = 0;
+    int n = 0;
+    while((row = mysql_fetch_row(res))) {
+        unsigned long long hash = _mysql_ash_hash(row[0], row[1], row[2]);
+        int j;
+        for(j=0; j<n && seen[j].hash!=hash; j++);
+        if(j == n) {
+            if(n == ASH_SLOT_KEYS) {
+                other++;
+                continue;
+            }
+            seen[j].hash = hash;
+            snprintf(seen[j].state,  sizeof(seen[j].state),  "%s", row[0]);
+            snprintf(seen[j].event,  sizeof(seen[j].event),  "%s", row[1]);
+            snprintf(seen[j].digest, sizeof(seen[j].digest), "%s", row[2]);
+            count[j] = 0;
+            n++;
+        }
+        count[j]++;
+    }
+    mysql_free_result(res);
+    epoch_t now = epoch_time();
+
+    pthread_mutex_lock(&ash->lock);
+
+    if(ash->head - ash->tail == ASH_SLOTS) {
+        // Nobody drained the ring for a while, overwrite the oldest second
+        mysql_ash_slot_t *oldest = &ash->slots[ash->tail%ASH_SLOTS];
+        ash->dropped += oldest->other;
+        for(int j=0; j<oldest->n; j++)
+            ash->dropped += oldest->count[j];
+        ash->tail++;
+    }
+    mysql_ash_slot_t *slot = &ash->slots[ash->head%ASH_SLOTS];
+    slot->time  = now;
+    slot->n     = 0;
+    slot->other = other;
+
+    // Keys differ by hash, so each gets its own entry or 0
+    for(int j=0; j<n; j++) {
+        int key = _mysql_ash_key(ash, &seen[j]);
+        if(key == 0) {
+            slot->other += count[j];
+            continue;
+        }
+        slot->key[slot->n] = key;
+        slot->count[slot->n++] = count[j];
+    }
+    ash->head++;
+
+    pthread_mutex_unlock(&ash->lock);
+
+    return 0;
+}
+
+unsigned long long _mysql_ash_hash(const char *state, const char *event, const char *digest) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for(const char *s=state; *s; s++)  hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+    hash = (hash ^ 0xff) * 0x100000001b3ULL;
+    for(const char *s=event; *s; s++)  hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+    hash = (hash ^ 0xff) * 0x100000001b3ULL;
+    for(const char *s=digest; *s; s++) hash = (hash ^ (unsigned char)*s) * 0x100000001b3ULL;
+    return hash;
+}
+
+/*
+ * Find or add a key, 0 is the key for everything that does not fit
+ */
+int _mysql_ash_key(mysql_ash_t *ash, const mysql_ash_key_t *k) {
+    unsigned int i = k->hash % (ASH_KEYS*2);
+    for(; ash->index[i]; i=(i+1)%(ASH_KEYS*2))
+        if(ash->keys[ash->index[i]].hash == k->hash)
+            return ash->index[i];
+
+    if(ash->nkeys == ASH_KEYS)
+        return 0;
+
+    ash->keys[ash->nkeys] = *k;
+    ash->index[i] = ash->nkeys;
+
+    return ash->nkeys++;
+}
+
+void _mysql_ash_clear(mysql_ash_t *ash) {
+    memset(ash->index, 0, sizeof(ash->index));
+    memset(&ash->keys[0], 0, sizeof(mysql_ash_key_t));
+    snprintf(ash->keys[0].event, sizeof(ash->keys[0].event), "other");
+    ash->nkeys = 1;
+}
+
+/*
+ * Tables, indexes and data files with the most I/O wait in the interval
+ *
+ * Rows are streamed into hash tables of cumulative counters, so only objects
+ * seen for the first time cost an allocation, and only the top ones are sent.
+ */
+int _mysql_gather_hotspot(mysql_module_t *m, packet_t *pkt) {
+    if(!m->opt.hotspot_top)
+        return ENODATA;
+
+    int error = ENODATA;
+    int top = m->opt.hotspot_top < HOTSPOT_TOP_MAX ? m->opt.hotspot_top : HOTSPOT_TOP_MAX;
+    hotspot_entry_t *e[HOTSPOT_TOP_MAX];
+    int k;
+
+    // Both lists share half of what is left, a file name may take 512 bytes
+    int room = (PKTSZ - pkt->size) / 4;
+    if(top > room/640)
+        top = room/640;
+
+    if(_mysql_hotspot_scan(m, &m->hotspot.table, "select object_schema,object_name,index_name,sum_timer_wait,count_star,count_read,count_write from performance_schema.table_io_waits_summary_by_index_usage where count_star>0 and object_schema not in ('mysql','performance_schema','sys');") == 0
+            && (k = hotspot_top(&m->hotspot.table, e, top)) > 0) {
+        error = ENONE;
+        static const char *keys[] = {"schema", "name", "index", "wait", "ops", "read", "write"};
+        packet_append(pkt, "\"table\":{");
+        _mysql_hotspot_emit(pkt, e, k, 3, keys);
+        packet_append(pkt, "}");
+    }
+
+    if(_mysql_hotspot_scan(m, &m->hotspot.file, "select file_name,event_name,null,sum_timer_wait,count_star,sum_number_of_bytes_read,sum_number_of_bytes_write from performance_schema.file_summary_by_instance where count_star>0;") == 0
+            && (k = hotspot_top(&m->hotspot.file, e, top)) > 0) {
+        static const char *keys[] = {"name", "event", "wait", "ops", "read_bytes", "write_bytes"};
+        packet_append(pkt, "%s\"file\":{", error==ENONE?",":"");
+        error = ENONE;
+        _mysql_hotspot_emit(pkt, e, k, 2, keys);
+        packet_append(pkt, "}");
+    }
+
+    return error;
+}
+
+/*
+ * Transactions open longer than trx_age and the undo history length
+ *
+ * A transaction is followed by trx_id, so after the tick it first shows up
+ * only its age, rows modified and growth go out; its user, host and last
+ * statement are sent once. The statement comes from performance_schema, as
+ * an idle session that forgot to commit has no processlist info.
+ */
+int _mysql_gather_trx(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    int error = ENODATA;
+
+    if((res = query_result(m->mysql, "select count from information_schema.innodb_metrics where name='trx_rseg_history_len';"))) {
+        if((row = mysql_fetch_row(res)) && row[0]) {
+            long long history = strtoll(row[0], NULL, 10);
+            packet_append(pkt, "\"history\":{\"length\":%lld,\"growth\":%lld}", history, m->trx.history < 0 ? 0 : history-m->trx.history);
+            m->trx.history = history;
+            error = ENONE;
+        }
+        mysql_free_result(res);
+    }
+
+    if(!m->opt.trx_age)
+        return error;
+
+    char query[BFSZ*8];
+    // Without the consumer only a running statement is known
+    if(m->caps & CAP_STMTS_CURRENT)
+        snprintf(query, sizeof(query), "select t.trx_id,t.trx_mysql_thread_id,timestampdiff(second,t.trx_started,now()),t.trx_state,t.trx_rows_modified,t.trx_lock_structs,t.trx_rows_locked,ifnull(p.user,''),ifnull(p.host,''),ifnull(s.sql_text,ifnull(t.trx_query,'')) from information_schema.innodb_trx t left join information_schema.processlist p on p.id=t.trx_mysql_thread_id left join performance_schema.threads h on h.processlist_id=t.trx_mysql_thread_id left join performance_schema.events_statements_current s on s.thread_id=h.thread_id where t.trx_started<now()-interval %u second order by t.trx_started limit %d;", m->opt.trx_age, TRX_MAX);
+    else
+        snprintf(query, sizeof(query), "select t.trx_id,t.trx_mysql_thread_id,timestampdiff(second,t.trx_started,now()),t.trx_state,t.trx_rows_modified,t.trx_lock_structs,t.trx_rows_locked,ifnull(p.user,''),ifnull(p.host,''),ifnull(t.trx_query,'') from information_schema.innodb_trx t left join information_schema.processlist p on p.id=t.trx_mysql_thread_id where t.trx_started<now()-interval %u second order by t.trx_started limit %d;", m->opt.trx_age, TRX_MAX);
+    if(!(res = query_result(m->mysql, query)))
+        return error;
+
+    unsigned int tick = ++m->trx.tick;
+    int k = 0;
+    mysql_trx_t *trx[TRX_MAX];
+    unsigned long long growth[TRX_MAX];
+    int fresh[TRX_MAX];
+    char *sql[TRX_MAX];
+    int sql_len[TRX_MAX];
+    unsigned long long fingerprint[TRX_MAX];
+    MYSQL_ROW rows[TRX_MAX];
+
+    // Follow each by trx_id, a new one takes the place of one that ended
+    for(int i=0; i<TRX_MAX && (row = mysql_fetch_row(res)); i++, k++) {
+        unsigned long *len = mysql_fetch_lengths(res);
+        unsigned long long id = strtoull(row[0], NULL, 10);
+        unsigned long long rows_modified = strtoull(row[4], NULL, 10);
+
+        mysql_trx_t *t = NULL;
+        for(int j=0; j<m->trx.n && !t; j++)
+            if(m->trx.list[j].id == id)
+                t = &m->trx.list[j];
+        fresh[i] = !t;
+        if(!t) {
+            int j = 0;
+            while(j < m->trx.n && m->trx.list[j].seen)
+                j++;
+            if(j == m->trx.n)
+                m->trx.n++;
+            t = &m->trx.list[j];
+            t->id = id;
+            t->rows_modified = rows_modified;
+        }
+        growth[i] = rows_modified >= t->rows_modified ? rows_modified-t->rows_modified : 0;
+        t->rows_modified = rows_modified;
+        t->age = strtoul(row[2], NULL, 10);
+        t->seen = tick;
+        trx[i] = t;
+        rows[i] = row;
+
+        sql_len[i] = 0;
+        fingerprint[i] = 0;
+        if(fresh[i] && (sql[i] = arena_alloc(&m->arena, TRX_SQL_MAX)))
+            sql_len[i] = digest_normalize(row[9], len[9], sql[i], TRX_SQL_MAX, &fingerprint[i]);
+    }
+
+    // Ended, or younger than trx_age again after a rollback to savepoint
+    int ended = 0;
+    for(int j=0; j<m->trx.n; j++)
+        if(m->trx.list[j].seen == tick-1)
+            ended++;
+    if(ended) {
+        packet_cols_t cols;
+        packet_cols_init(&cols, ended);
+        packet_col(&cols, "id", COL_U64, 0);
+        packet_col(&cols, "age", COL_U64, 0);
+        for(int j=0; j<m->trx.n; j++) {
+            if(m->trx.list[j].seen != tick-1) continue;
+            packet_row(&cols);
+            packet_put_u64(&cols, m->trx.list[j].id);
+            packet_put_u64(&cols, m->trx.list[j].age);
+        }
+        packet_append(pkt, "%s\"ended\":{", error==ENONE?",":"");
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+        packet_append(pkt, "}");
+        error = ENONE;
+    }
+    // Slots of ended ones are free from here
+    for(int j=0; j<m->trx.n; j++)
+        if(m->trx.list[j].seen != tick)
+            m->trx.list[j].seen = 0;
+    while(m->trx.n > 0 && !m->trx.list[m->trx.n-1].seen)
+        m->trx.n--;
+
+    if(k > 0) {
+        static const struct {
+            const char *key;
+            packet_col_type type;
+        } trx_cols[] = {
+            {"id", COL_U64}, {"thread", COL_RAW}, {"age", COL_U64}, {"state", COL_STR},
+            {"rows_modified", COL_U64}, {"growth", COL_U64}, {"lock_structs", COL_RAW},
+            {"rows_locked", COL_RAW}, {"user", COL_STR}, {"host", COL_STR},
+            {"sql", COL_STR}, {"fingerprint", COL_HEX},
+        };
+        packet_cols_t cols;
+        packet_cols_init(&cols, k);
+        for(int c=0; c<sizeof(trx_cols)/sizeof(trx_cols[0]); c++)
+            packet_col(&cols, trx_cols[c].key, trx_cols[c].type, 0);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            packet_put_u64(&cols, trx[i]->id);
+            packet_put_raw(&cols, rows[i][1] ? rows[i][1] : "0");
+            packet_put_u64(&cols, trx[i]->age);
+            packet_put_str(&cols, rows[i][3], -1);
+            packet_put_u64(&cols, trx[i]->rows_modified);
+            packet_put_u64(&cols, growth[i]);
+            packet_put_raw(&cols, rows[i][5]);
+            packet_put_raw(&cols, rows[i][6]);
+            packet_put_str(&cols, fresh[i] ? rows[i][7] : "", -1);
+            packet_put_str(&cols, fresh[i] ? rows[i][8] : "", -1);
+            packet_put_str(&cols, sql_len[i] ? sql[i] : "", sql_len[i]);
+            packet_put_hex(&cols, sql_len[i] ? fingerprint[i] : 0);
+        }
+        packet_append(pkt, "%s\"long\":{", error==ENONE?",":"");
+        error = ENONE;
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+        packet_append(pkt, "}");
+    }
+    mysql_free_result(res);
+
+    return error;
+}
+
+/*
+ * Statement latency histogram and the busiest accounts of the interval
+ *
+ * Bucket deltas of events_statements_histogram_global are spread over the
+ * fixed layout of histogram.h, so percentiles of many servers merge by adding
+ * buckets. Only buckets that moved are sent, as (bucket, count) columns.
+ */
+int _mysql_gather_statement(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    if(!(res = query_result(m->mysql, "select bucket_timer_low,bucket_timer_high,count_bucket from performance_schema.events_statements_histogram_global order by bucket_number;")))
+        return ENODATA;
+
+    unsigned long long count[HISTOGRAM_BUCKETS] = {0};
+    int n = 0, moved = 0;
+    while((row = mysql_fetch_row(res)) && n < STMT_BUCKETS) {
+        unsigned long long c = strtoull(row[2], NULL, 10);
+        // Less than before means the table was truncated
+        unsigned long long delta = c >= m->stmt.count[n] ? c-m->stmt.count[n] : c;
+        if(m->stmt.n && delta) {
+            histogram_add(count, strtoull(row[0], NULL, 10)/1e6, strtoull(row[1], NULL, 10)/1e6, delta);
+            moved = 1;
+        }
+        m->stmt.count[n++] = c;
+    }
+    mysql_free_result(res);
+    int first = m->stmt.n == 0;
+    m->stmt.n = n;
+    if(first)
+        return ENODATA;
+
+    int error = ENODATA;
+    if(moved) {
+        error = ENONE;
+        packet_cols_t cols;
+        packet_cols_init(&cols, HISTOGRAM_BUCKETS);
+        packet_col(&cols, "bucket", COL_I64, 0);
+        packet_col(&cols, "count", COL_U64, 0);
+        for(int b=0; b<HISTOGRAM_BUCKETS; b++) {
+            if(!count[b]) continue;
+            packet_row(&cols);
+            packet_put_i64(&cols, b);
+            packet_put_u64(&cols, count[b]);
+        }
+        packet_append(pkt, "\"latency\":{");
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+        packet_append(pkt, "}");
+    }
+
+    // An account takes a user, a host of up to 255 characters and four numbers
+    hotspot_entry_t *e[STMT_ACCOUNT_TOP];
+    int top = (PKTSZ - pkt->size) / 2 / 384;
+    int k;
+    if(_mysql_hotspot_scan(m, &m->stmt.accounts, "select a.user,a.host,null,sum(s.sum_timer_wait),sum(s.count_star),sum(s.sum_errors),a.current_connections from performance_schema.accounts a join performance_schema.events_statements_summary_by_account_by_event_name s on s.user=a.user and s.host=a.host where a.user is not null group by a.user,a.host,a.current_connections;") == 0
+            && (k = hotspot_top(&m->stmt.accounts, e, top < STMT_ACCOUNT_TOP ? top : STMT_ACCOUNT_TOP)) > 0) {
+        packet_cols_t cols;
+        packet_cols_init(&cols, k);
+        packet_col(&cols, "user", COL_STR, 0);
+        packet_col(&cols, "host", COL_STR, 0);
+        packet_col(&cols, "latency", COL_U64, 0);
+        packet_col(&cols, "count", COL_U64, 0);
+        packet_col(&cols, "errors", COL_U64, 0);
+        packet_col(&cols, "connections", COL_U64, 0);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            packet_put_str(&cols, e[i]->part[0], -1);
+            packet_put_str(&cols, e[i]->part[1], -1);
+            packet_put_u64(&cols, e[i]->delta[0]/1000000);
+            packet_put_u64(&cols, e[i]->delta[1]);
+            packet_put_u64(&cols, e[i]->delta[2]);
+            // A gauge, so the value rather than its delta
+            packet_put_u64(&cols, e[i]->value[3]);
+        }
+        packet_append(pkt, "%s\"account\":{", error==ENONE?",":"");
+        error = ENONE;
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+        packet_append(pkt, "}");
+    }
+
+    return error;
+}
+
+/*
+ * Table sizes and free space, walked a few hundred tables per tick
+ *
+ * information_schema.tables is read one schema at a time after the last
+ * table name seen, so a server with a hundred thousand tables is never asked
+ * for all of them at once. Only tables that changed or went away are sent.
+ * A finished pass sends a checksum of every known table, so the receiver can
+ * tell its copy has drifted.
+ */
+int _mysql_gather_inventory(mysql_module_t *m, packet_t *pkt) {
+    inventory_t *v = &m->inventory.tables;
+    if(!m->opt.inventory_budget)
+        return ENODATA;
+
+    epoch_t begin = epoch_time();
+    int rows = _mysql_inventory_walk(m, m->opt.inventory_budget);
+    if(rows < 0)
+        return ENODATA;
+    epoch_t cost = epoch_time() - begin;
+    m->inventory.cost += cost;
+    m->inventory.rows += rows;
+
+    int done = v->schema >= v->nschema;
+    if(done)
+        inventory_end(v);
+
+    // A table takes two names of up to 64 characters and three sizes
+    int room = (PKTSZ - pkt->size) / 2 / 192;
+    inventory_entry_t *e[INVENTORY_SEND];
+    int k = inventory_changes(v, e, room < INVENTORY_SEND ? room : INVENTORY_SEND);
+
+    packet_append(pkt, "\"walk\":{\"rows\":%d,\"cost\":%llu,\"schema\":%d,\"schemas\":%d,\"pending\":%u}",
+            rows, cost, v->schema, v->nschema, v->ndirty);
+    if(k > 0) {
+        packet_cols_t cols;
+        packet_cols_init(&cols, k);
+        packet_col(&cols, "schema", COL_STR, 0);
+        packet_col(&cols, "name", COL_STR, 0);
+        packet_col(&cols, "data", COL_U64, 0);
+        packet_col(&cols, "index", COL_U64, 0);
+        packet_col(&cols, "free", COL_U64, 0);
+        packet_col(&cols, "dropped", COL_I64, 0);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            packet_put_str(&cols, e[i]->schema, -1);
+            packet_put_str(&cols, e[i]->name, -1);
+            for(int v=0; v<3; v++)
+                packet_put_u64(&cols, e[i]->value[v]);
+            packet_put_i64(&cols, e[i]->gone);
+        }
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+    }
+    // The checksum only matches once every change of the pass went out
+    if(done && v->ndirty == 0) {
+        packet_append(pkt, ",\"pass\":{\"tables\":%u,\"checksum\":\"%016llx\",\"time\":%llu,\"cost\":%llu,\"rows\":%lu}",
+                v->n, inventory_checksum(v), epoch_time()-m->inventory.started, m->inventory.cost, m->inventory.rows);
+    }
+    inventory_purge(v);
+
+    return ENONE;
+}
+
+/*
+ * Read up to 'budget' tables from the cursor on, starting a pass if the last one is over
+ */
+int _mysql_inventory_walk(mysql_module_t *m, int budget) {
+    inventory_t *v = &m->inventory.tables;
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+    int rows = 0;
+
+    if(v->schema >= v->nschema) {
+        // Gone tables of the last pass must go out before they are forgotten
+        if(v->pass && v->ndirty)
+            return 0;
+
+        res = query_result(m->mysql, "select schema_name from information_schema.schemata where schema_name not in ('mysql','information_schema','performance_schema','sys') order by schema_name;");
+        if(!res) return -1;
+
+        int n = mysql_num_rows(res), i = 0;
+        char **schema = malloc((n ? n : 1)*sizeof(char *));
+        unsigned long *len = malloc((n ? n : 1)*sizeof(unsigned long));
+        while(schema && len && i < n && (row = mysql_fetch_row(res))) {
+            schema[i] = row[0];
+            len[i++] = mysql_fetch_lengths(res)[0];
+        }
+        int error = schema && len ? inventory_begin(v, schema, len, i) : -1;
+        free(schema);
+        free(len);
+        mysql_free_result(res);
+        if(error < 0) return -1;
+
+        m->inventory.started = epoch_time();
+        m->inventory.cost = 0;
+        m->inventory.rows = 0;
+    }
+
+    while(budget > 0 && v->schema < v->nschema) {
+        const char *schema = v->schemas[v->schema];
+        char query[BFSZ*4], s[BFSZ*2+1], t[BFSZ*2+1] = "";
+        mysql_real_escape_string(m->mysql, s, schema, strnlen(schema, BFSZ-1));
+        if(v->after)
+            mysql_real_escape_string(m->mysql, t, v->after, strnlen(v->after, BFSZ-1));
+        snprintf(query, sizeof(query), "select table_name,ifnull(data_length,0),ifnull(index_length,0),ifnull(data_free,0) from information_schema.tables where table_schema='%s' and table_name>'%s' and table_type='BASE TABLE' order by table_name limit %d;", s, t, budget);
+
+        if(mysql_query(m->mysql, query) || !(res = mysql_use_result(m->mysql)))
+            return rows ? rows : -1;
+        int n = 0;
+        while((row = mysql_fetch_row(res))) {
+            unsigned long *len = mysql_fetch_lengths(res);
+            unsigned long long value[INVENTORY_VALUES];
+            for(int i=0; i<INVENTORY_VALUES; i++)
+                value[i] = strtoull(row[1+i], NULL, 10);
+            inventory_update(v, row[0], len[0], value);
+            n++;
+        }
+        mysql_free_result(res);
+
+        rows += n;
+        budget -= n;
+        if(budget > 0)
+            inventory_next(v);
+    }
+
+    return rows;
+}
+
+/*
+ * One snapshot of (name, name, name, value x4) rows
+ */
+int _mysql_hotspot_scan(mysql_module_t *m, hotspot_t *h, const char *query) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    if(mysql_query(m->mysql, query) || !(res = mysql_use_result(m->mysql)))
+        return -1;
+
+    hotspot_begin(h);
+    while((row = mysql_fetch_row(res))) {
+        unsigned long *len = mysql_fetch_lengths(res);
+        unsigned long long value[HOTSPOT_VALUES];
+        for(int v=0; v<HOTSPOT_VALUES; v++)
+            value[v] = row[HOTSPOT_PARTS+v] ? strtoull(row[HOTSPOT_PARTS+v], NULL, 10) : 0;
+        hotspot_update(h, row, len, value);
+    }
+    mysql_free_result(res);
+
+    return 0;
+}
+
+/*
+ * Columns of the top entries, 'parts' names then wait in ms and three deltas
+ */
+void _mysql_hotspot_emit(packet_t *pkt, hotspot_entry_t **e, int k, int parts, const char **keys) {
+    packet_cols_t cols;
+    packet_cols_init(&cols, k);
+    for(int c=0; c<parts+HOTSPOT_VALUES; c++)
+        packet_col(&cols, keys[c], c<parts ? COL_STR : COL_U64, 0);
+    for(int i=0; i<k; i++) {
+        packet_row(&cols);
+        for(int c=0; c<parts; c++)
+            packet_put_str(&cols, e[i]->part[c], -1);
+        packet_put_u64(&cols, e[i]->delta[0]/1000000);
+        for(int v=1; v<HOTSPOT_VALUES; v++)
+            packet_put_u64(&cols, e[i]->delta[v]);
+    }
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+}
+
+/*
+ * Who blocks whom, read only while sessions wait on row locks or run
+ *
+ * Row lock waits and metadata lock waits become one wait-for graph of
+ * performance_schema thread ids. Only its root blockers and cycles are sent,
+ * so a storm of thousands of waiters stays a few hundred bytes.
+ */
+int _mysql_gather_lock(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    unsigned long waits = 0;
+    if((res = query_result(m->mysql, "show global status like 'innodb_row_lock_current_waits';"))) {
+        if((row = mysql_fetch_row(res)) && row[1])
+            waits = strtoul(row[1], NULL, 10);
+        mysql_free_result(res);
+    }
+    // This session is always running
+    if(waits == 0 && m->threads_running <= 1)
+        return ENODATA;
+
+    lockgraph_t *g = &m->lock.graph;
+    lockgraph_reset(g);
+
+    if(m->caps & CAP_DATA_LOCKS)
+        _mysql_lock_scan(m, "select w.requesting_thread_id,w.blocking_thread_id,concat(ifnull(l.object_schema,''),'.',ifnull(l.object_name,'')) from performance_schema.data_lock_waits w left join performance_schema.data_locks l on l.engine_lock_id=w.requesting_engine_lock_id;");
+    else
+        _mysql_lock_scan(m, "select rt.thread_id,bt.thread_id,ifnull(l.lock_table,'') from information_schema.innodb_lock_waits w join information_schema.innodb_trx r on r.trx_id=w.requesting_trx_id join information_schema.innodb_trx b on b.trx_id=w.blocking_trx_id join performance_schema.threads rt on rt.processlist_id=r.trx_mysql_thread_id join performance_schema.threads bt on bt.processlist_id=b.trx_mysql_thread_id left join information_schema.innodb_locks l on l.lock_id=w.requested_lock_id;");
+    // Only granted locks that conflict with the pending one block it, by the matrix of mdl.cc
+    _mysql_lock_scan(m, "select p.owner_thread_id,g.owner_thread_id,concat(ifnull(p.object_schema,''),'.',ifnull(p.object_name,'')) from performance_schema.metadata_locks p join performance_schema.metadata_locks g on g.object_type=p.object_type and g.object_schema<=>p.object_schema and g.object_name<=>p.object_name and g.lock_status='GRANTED' and g.owner_thread_id<>p.owner_thread_id"
+            " and (p.lock_type='EXCLUSIVE' or g.lock_type='EXCLUSIVE' or find_in_set(g.lock_type,case p.lock_type"
+            " when 'INTENTION_EXCLUSIVE' then 'SHARED'"
+            " when 'SHARED' then 'INTENTION_EXCLUSIVE,SHARED_NO_READ_WRITE'"
+            " when 'SHARED_READ' then 'SHARED_NO_READ_WRITE'"
+            " when 'SHARED_WRITE' then 'SHARED_READ_ONLY,SHARED_NO_WRITE,SHARED_NO_READ_WRITE'"
+            " when 'SHARED_WRITE_LOW_PRIO' then 'SHARED_READ_ONLY,SHARED_NO_WRITE,SHARED_NO_READ_WRITE'"
+            " when 'SHARED_UPGRADABLE' then 'SHARED_UPGRADABLE,SHARED_NO_WRITE,SHARED_NO_READ_WRITE'"
+            " when 'SHARED_READ_ONLY' then 'SHARED_WRITE,SHARED_WRITE_LOW_PRIO,SHARED_NO_READ_WRITE'"
+            " when 'SHARED_NO_WRITE' then 'SHARED_WRITE,SHARED_WRITE_LOW_PRIO,SHARED_UPGRADABLE,SHARED_NO_WRITE,SHARED_NO_READ_WRITE'"
+            " when 'SHARED_NO_READ_WRITE' then 'SHARED_READ,SHARED_WRITE,SHARED_WRITE_LOW_PRIO,SHARED_UPGRADABLE,SHARED_READ_ONLY,SHARED_NO_WRITE,SHARED_NO_READ_WRITE'"
+            " else '' end)) where p.lock_status='PENDING';");
+
+    if(g->m == 0 || lockgraph_analyze(g, LOCK_ROOTS) < 0)
+        return ENODATA;
+
+    int k = g->nroots < LOCK_ROOTS ? g->nroots : LOCK_ROOTS;
+    packet_append(pkt, "\"waits\":%d,\"waiters\":%d,\"roots\":%d", g->waits, g->waiters, g->nroots);
+
+    if(k > 0) {
+        // Who the root blockers are
+        char query[BFSZ*2 + LOCK_ROOTS*24];
+        int len = sprintf(query, "select thread_id,ifnull(processlist_id,''),ifnull(processlist_user,''),ifnull(processlist_command,''),ifnull(processlist_time,''),ifnull(left(processlist_info,%d),'') from performance_schema.threads where thread_id in (", LOCK_INFO_MAX);
+        for(int r=0; r<k; r++)
+            len += sprintf(query+len, "%s%llu", r?",":"", g->id[g->root[r].node]);
+        sprintf(query+len, ");");
+
+        MYSQL_ROW detail[LOCK_ROOTS] = {0};
+        if((res = query_result(m->mysql, query))) {
+            while((row = mysql_fetch_row(res))) {
+                unsigned long long id = strtoull(row[0], NULL, 10);
+                for(int r=0; r<k; r++)
+                    if(g->id[g->root[r].node] == id)
+                        detail[r] = row;
+            }
+        }
+
+        packet_cols_t cols;
+        packet_cols_init(&cols, k);
+        packet_col(&cols, "thread_id", COL_U64, 0);
+        packet_col(&cols, "waiters", COL_I64, 0);
+        packet_col(&cols, "total", COL_I64, 0);
+        packet_col(&cols, "object", COL_STR, 0);
+        for(int c=1; c<6; c++)
+            packet_col(&cols, lock_cols[c], COL_STR, 0);
+        for(int r=0; r<k; r++) {
+            packet_row(&cols);
+            packet_put_u64(&cols, g->id[g->root[r].node]);
+            packet_put_i64(&cols, g->root[r].direct);
+            packet_put_i64(&cols, g->root[r].total);
+            packet_put_str(&cols, g->root[r].object, -1);
+            for(int c=1; c<6; c++)
+                packet_put_str(&cols, detail[r] ? detail[r][c] : "", -1);
+        }
+        packet_append(pkt, ",\"root\":{");
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+        packet_append(pkt, "}");
+
+        if(res)
+            mysql_free_result(res);
+    }
+
+    if(g->ncycles > 0) {
+        packet_append(pkt, ",\"cycle\":[");
+        for(int c=0; c<g->ncycles && c<LOCK_CYCLES; c++) {
+            packet_append(pkt, "%s[", c?",":"");
+            for(int i=g->cycle_start[c]; i<g->cycle_start[c+1] && i-g->cycle_start[c]<LOCK_CYCLE_MAX; i++)
+                packet_u64(pkt, i>g->cycle_start[c]?',':0, g->id[g->cycle[i]]);
+            packet_append(pkt, "]");
+        }
+        packet_append(pkt, "],\"cycles\":%d", g->ncycles);
+    }
+
+    return ENONE;
+}
+
+/*
+ * Adds (waiter, blocker, object) rows to the graph
+ */
+int _mysql_lock_scan(mysql_module_t *m, const char *query) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    if(mysql_query(m->mysql, query) || !(res = mysql_use_result(m->mysql)))
+        return -1;
+
+    while((row = mysql_fetch_row(res))) {
+        if(!row[0] || !row[1])
+            continue;
+        unsigned long *len = mysql_fetch_lengths(res);
+        const char *object = row[2] ? intern(&m->names, row[2], len[2]) : NULL;
+        lockgraph_add(&m->lock.graph, strtoull(row[0], NULL, 10), strtoull(row[1], NULL, 10), object);
+    }
+    mysql_free_result(res);
+
+    return 0;
+}
+
+/*
+ * Replication state of every channel
+ *
+ * Columns are looked up by name, since SHOW REPLICA STATUS (8.0.22+) renamed
+ * the Master/Slave ones and the column order differs between versions.
+ * Seconds_Behind_Source is null while the SQL thread is stopped.
+ */
 int _mysql_gather_replica(mysql_module_t *m, packet_t *pkt) {
-    return ENODATA;
+	MYSQL_RES *res = NULL;
+	MYSQL_ROW row;
+
+    if(!(res = query_result(m->mysql, m->caps & CAP_REPLICA_STATUS ? "show replica status;" : "show slave status;")))
+        return ENODATA;
+
+    int col[REPLICA_COLS];
+    int nf = mysql_num_fields(res);
+    MYSQL_FIELD *fields = mysql_fetch_fields(res);
+    for(int c=0; c<REPLICA_COLS; c++) {
+        col[c] = -1;
+        for(int f=0; f<nf; f++) {
+            if(!strcasecmp(fields[f].name, replica_cols[c].name[0])
+                    || !strcasecmp(fields[f].name, replica_cols[c].name[1])) {
+                col[c] = f;
+                break;
+            }
+        }
+    }
+
+    MYSQL_ROW rows[REPLICA_CHANNELS];
+    int k = 0;
+    int room = (PKTSZ - pkt->size) / 2;
+    while(room >= REPLICA_COLS*32 + 2*REPLICA_ERROR_MAX && k < REPLICA_CHANNELS && (row = mysql_fetch_row(res))) {
+        rows[k++] = row;
+        room -= REPLICA_COLS*32 + 2*REPLICA_ERROR_MAX;
+    }
+    if(k == 0) {
+        mysql_free_result(res);
+        return ENODATA;
+    }
+
+    packet_cols_t cols;
+    packet_cols_init(&cols, k);
+    for(int c=0; c<REPLICA_COLS; c++)
+        packet_col(&cols, replica_cols[c].key, replica_cols[c].number ? COL_RAW : COL_STR, 0);
+    for(int i=0; i<k; i++) {
+        packet_row(&cols);
+        for(int c=0; c<REPLICA_COLS; c++) {
+            const char *v = col[c] < 0 ? NULL : rows[i][col[c]];
+            if(replica_cols[c].number)
+                packet_put_raw(&cols, v);
+            else
+                packet_put_str(&cols, v, REPLICA_ERROR_MAX);
+        }
+    }
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+    mysql_free_result(res);
+
+    _mysql_replica_workers(m, pkt);
+    if(m->opt.heartbeat[0])
+        _mysql_replica_heartbeat(m, pkt);
+
+    return ENONE;
+}
+
+/*
+ * Multi-threaded applier workers, 5.7 and later
+ */
+void _mysql_replica_workers(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    res = query_result(m->mysql, "select channel_name,worker_id,ifnull(thread_id,''),service_state,last_error_number,ifnull(last_error_message,'') from performance_schema.replication_applier_status_by_worker order by channel_name,worker_id;");
+    if(!res) return;
+
+    static const char *worker_cols[6] = {"channel", "id", "thread_id", "state", "errno", "error"};
+    MYSQL_ROW rows[REPLICA_WORKERS];
+    int k = 0;
+    int room = (PKTSZ - pkt->size) / 2;
+    while(room >= 6*32 + REPLICA_ERROR_MAX && k < REPLICA_WORKERS && (row = mysql_fetch_row(res))) {
+        rows[k++] = row;
+        room -= 6*32 + REPLICA_ERROR_MAX;
+    }
+
+    if(k > 0) {
+        packet_cols_t cols;
+        packet_cols_init(&cols, k);
+        for(int c=0; c<6; c++)
+            packet_col(&cols, worker_cols[c], c == 1 || c == 4 ? COL_RAW : COL_STR, 0);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            for(int c=0; c<6; c++) {
+                if(c == 1 || c == 4)
+                    packet_put_raw(&cols, rows[i][c]);
+                else
+                    packet_put_str(&cols, rows[i][c], REPLICA_ERROR_MAX);
+            }
+        }
+        packet_append(pkt, ",\"worker\":{");
+        packet_cols(pkt, &cols);
+        packet_cols_fini(&cols);
+        packet_append(pkt, "}");
+    }
+    mysql_free_result(res);
+}
+
+/*
+ * Lag measured from a heartbeat table that the source updates, such as the
+ * one of pt-heartbeat --utc. Unlike Seconds_Behind_Source it covers the
+ * whole chain and does not reset to 0 while the IO thread is behind.
+ */
+void _mysql_replica_heartbeat(mysql_module_t *m, packet_t *pkt) {
+	MYSQL_RES *res;
+	MYSQL_ROW row;
+
+    char query[BFSZ*2];
+    snprintf(query, sizeof(query), "select timestampdiff(microsecond,max(ts),utc_timestamp(6)) from %s;", m->opt.heartbeat);
+    if(!(res = query_result(m->mysql, query)))
+        return;
+    if((row = mysql_fetch_row(res)) && row[0])
+        packet_append(pkt, ",\"heartbeat_lag\":%.3f", strtoll(row[0], NULL, 10)/1000000.0);
+    mysql_free_result(res);
 }
 
 MYSQL_RES *query_result(MYSQL *mysql, const char *query) {
@@ -0,0 +1,290 @@
+/**
+ * @file digest.c
+ * @author Snyo
+ */
+#include "plugins/mysql/digest.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Bytes the scalar path handles, everything else is copied lowercased
+ */
+enum digest_class {
+    PLAIN, SPACE, QUOTE, BACKTICK, DIGIT, DASH, HASH, SLASH,
+    OPEN, CLOSE, COMMA, BACKSLASH, PARAM
+};
+
+static unsigned char digest_class[256];
+
+static void __attribute__((constructor)) digest_init() {
+    for(int c=0; c<=' '; c++) digest_class[c] = SPACE;
+    for(int c='0'; c<='9'; c++) digest_class[c] = DIGIT;
+    digest_class['\''] = QUOTE;
+    digest_class['"']  = QUOTE;
+    digest_class['`']  = BACKTICK;
+    digest_class['-']  = DASH;
+    digest_class['#']  = HASH;
+    digest_class['/']  = SLASH;
+    digest_class['(']  = OPEN;
+    digest_class[')']  = CLOSE;
+    digest_class[',']  = COMMA;
+    digest_class['\\'] = BACKSLASH;
+    digest_class['?']  = PARAM;
+}
+
+static inline int digest_ident(unsigned char c) {
+    return (c|0x20) >= 'a' && (c|0x20) <= 'z' ? 1 : (c >= '0' && c <= '9') || c == '_' || c == '$' || c >= 0x80;
+}
+
+/*
+ * First byte at or after 'p' equal to 'a' or 'b'
+ */
+static const char *digest_find2(const char *p, const char *end, char a, char b) {
+#ifdef __SSE2__
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    for(; end-p >= 16; p += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if(mask)
+            return p + __builtin_ctz(mask);
+    }
+#endif
+    for(; p < end; p++)
+        if(*p == a || *p == b)
+            return p;
+    return end;
+}
+
+#ifdef __SSE2__
+/*
+ * Mask of the bytes of a block that are not PLAIN
+ */
+static inline int digest_special(__m128i v) {
+    __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, _mm_set1_epi8(' ')), _mm_set1_epi8(' '));
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('#')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('(')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(')')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('?')));
+    return _mm_movemask_epi8(m);
+}
+
+static inline __m128i digest_lower(__m128i v) {
+    __m128i u = _mm_sub_epi8(v, _mm_set1_epi8('A'));
+    __m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(u, _mm_set1_epi8(25)), u);
+    return _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+/*
+ * State of the list the last '(' opened
+ */
+typedef struct digest_paren_t {
+    long at;    // Offset of '(' in the output, -1 when none is open
+    int pure;   // Nothing but values and commas since
+    int values;
+} digest_paren_t;
+
+#define DIGEST_GLUE "(),=<>!+-/"
+
+#define EMIT(c) do { if(o < cap) out[o++] = (c); } while(0)
+
+size_t digest_normalize(const char *sql, size_t len, char *out, size_t cap, unsigned long long *fingerprint) {
+    const char *p = sql, *end = sql+len;
+    size_t o = 0;
+    int space = 0;
+    digest_paren_t paren = {-1, 0, 0};
+
+    while(p < end && o < cap) {
+        unsigned char c = *p;
+        int cls = digest_class[c];
+
+        // No separator next to punctuation, so "a = 1" and "a=1" are the same
+        if(space && cls != SPACE) {
+            if(o > 0 && out[o-1] != ' ' && !strchr(DIGEST_GLUE, out[o-1]) && !strchr(DIGEST_GLUE, c))
+                EMIT(' ');
+            space = 0;
+        }
+
+        switch(cls) {
+            case PLAIN: {
+#ifdef __SSE2__
+                // Whole blocks of words and operators are copied at once
+                while(end-p >= 16 && cap-o >= 16) {
+                    __m128i v = _mm_loadu_si128((const __m128i *)p);
+                    int mask = digest_special(v);
+                    int n = mask ? __builtin_ctz(mask) : 16;
+                    _mm_storeu_si128((__m128i *)(out+o), digest_lower(v));
+                    o += n;
+                    p += n;
+                    if(mask) break;
+                }
+#endif
+                while(p < end && digest_class[(unsigned char)*p] == PLAIN && o < cap) {
+                    c = *p++;
+                    EMIT(c >= 'A' && c <= 'Z' ? c+0x20 : c);
+                }
+                paren.pure = 0;
+                break;
+            }
+
+            case SPACE:
+            space = o > 0;
+            p++;
+            break;
+
+            case QUOTE: {
+                // '' and "" inside are the quote itself, a backslash escapes
+                char q = c;
+                for(p++; p < end; ) {
+                    p = digest_find2(p, end, q, '\\');
+                    if(p >= end) break;
+                    if(*p == '\\') {
+                        p += 2;
+                    } else if(p+1 < end && p[1] == q) {
+                        p += 2;
+                    } else {
+                        p++;
+                        break;
+                    }
+                }
+                if(p > end) p = end;
+                EMIT('?');
+                paren.values++;
+                break;
+            }
+
+            case BACKTICK: {
+                const char *close = digest_find2(p+1, end, '`', '`');
+                for(; p < end && p <= close && o < cap; p++)
+                    EMIT((unsigned char)*p < ' ' ? ' ' : *p);
+                paren.pure = 0;
+                break;
+            }
+
+            case DIGIT:
+            if(o > 0 && digest_ident(out[o-1])) {
+                // Part of a name such as t1
+                while(p < end && digest_ident(*p) && o < cap) {
+                    c = *p++;
+                    EMIT(c >= 'A' && c <= 'Z' ? c+0x20 : c);
+                }
+                paren.pure = 0;
+                break;
+            }
+            if(c == '0' && p+1 < end && (p[1]|0x20) == 'x') {
+                for(p += 2; p < end && digest_ident(*p); p++);
+            } else {
+                while(p < end && (digest_class[(unsigned char)*p] == DIGIT || *p == '.'))
+                    p++;
+                if(p < end && (*p|0x20) == 'e') {
+                    const char *e = p+1;
+                    if(e < end && (*e == '+' || *e == '-')) e++;
+                    if(e < end && digest_class[(unsigned char)*e] == DIGIT) {
+                        for(p = e; p < end && digest_class[(unsigned char)*p] == DIGIT; p++);
+                    }
+                }
+            }
+            EMIT('?');
+            paren.values++;
+            break;
+
+            case PARAM:
+            p++;
+            EMIT('?');
+            paren.values++;
+            break;
+
+            case DASH:
+            if(p+1 < end && p[1] == '-' && (p+2 >= end || digest_class[(unsigned char)p[2]] == SPACE)) {
+                p = digest_find2(p, end, '\n', '\n');
+                space = o > 0;
+                break;
+            }
+            p++;
+            EMIT('-');
+            paren.pure = 0;
+            break;
+
+            case HASH:
+            p = digest_find2(p, end, '\n', '\n');
+            space = o > 0;
+            break;
+
+            case SLASH:
+            if(p+1 < end && p[1] == '*') {
+                for(p += 2; p < end; p++) {
+                    p = digest_find2(p, end, '*', '*');
+                    if(p+1 < end && p[1] == '/') {
+                        p += 2;
+                        break;
+                    }
+                }
+                if(p > end) p = end;
+                space = o > 0;
+                break;
+            }
+            p++;
+            EMIT('/');
+            paren.pure = 0;
+            break;
+
+            case OPEN:
+            p++;
+            EMIT('(');
+            paren.at = o-1;
+            paren.pure = 1;
+            paren.values = 0;
+            break;
+
+            case CLOSE:
+            p++;
+            if(paren.at >= 0 && paren.pure && paren.values > 0 && paren.at+4 <= (long)cap) {
+                o = paren.at;
+                // (?+),(?+) of a multi-row insert is one (?+)
+                if(o >= 5 && !memcmp(out+o-5, "(?+),", 5))
+                    o -= 5;
+                memcpy(out+o, "(?+)", 4);
+                o += 4;
+            } else {
+                EMIT(')');
+            }
+            paren.at = -1;
+            break;
+
+            case COMMA:
+            p++;
+            EMIT(',');
+            break;
+
+            case BACKSLASH:
+            p++;
+            EMIT('\\');
+            paren.pure = 0;
+            break;
+        }
+    }
+
+    while(o > 0 && (out[o-1] == ';' || out[o-1] == ' '))
+        o--;
+
+    if(fingerprint) {
+        unsigned long long hash = 0xcbf29ce484222325ULL;
+        for(size_t i=0; i<o; i++)
+            hash = (hash ^ (unsigned char)out[i]) * 0x100000001b3ULL;
+        *fingerprint = hash;
+    }
+    return o;
+}
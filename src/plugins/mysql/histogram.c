@@ -0,0 +1,45 @@
+/**
+ * @file histogram.c
+ * @author Snyo
+ */
+#include "plugins/mysql/histogram.h"
+
+int histogram_bucket(unsigned long long us) {
+    if(us < HISTOGRAM_SUB)
+        return us;
+    int e = 63 - __builtin_clzll(us);
+    int b = (e-3)*HISTOGRAM_SUB + (int)(us >> (e-4)) - HISTOGRAM_SUB;
+    return b < HISTOGRAM_BUCKETS ? b : HISTOGRAM_BUCKETS-1;
+}
+
+unsigned long long histogram_low(int b) {
+    if(b < HISTOGRAM_SUB)
+        return b;
+    int e = b/HISTOGRAM_SUB + 3;
+    return (unsigned long long)(b%HISTOGRAM_SUB + HISTOGRAM_SUB) << (e-4);
+}
+
+void histogram_add(unsigned long long *count, double low, double high, unsigned long long n) {
+    if(n == 0)
+        return;
+    if(low < 0) low = 0;
+    if(high > (double)histogram_low(HISTOGRAM_BUCKETS-1))
+        high = histogram_low(HISTOGRAM_BUCKETS-1);
+    if(high <= low) {
+        count[histogram_bucket(low)] += n;
+        return;
+    }
+
+    // Whole counts by overlap, what rounding leaves goes to the last one
+    int first = histogram_bucket(low), last = histogram_bucket(high);
+    unsigned long long left = n;
+    for(int b=first; b<last && left; b++) {
+        double from = histogram_low(b) > low ? histogram_low(b) : low;
+        double to = histogram_low(b+1) < high ? histogram_low(b+1) : high;
+        unsigned long long c = n * ((to-from)/(high-low)) + 0.5;
+        if(c > left) c = left;
+        count[b] += c;
+        left -= c;
+    }
+    count[last] += left;
+}
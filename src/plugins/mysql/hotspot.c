@@ -0,0 +1,177 @@
+/**
+ * @file hotspot.c
+ * @author Snyo
+ */
+#include "plugins/mysql/hotspot.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define HOTSPOT_MIN 1024
+
+static unsigned long long hotspot_hash(char **part, const unsigned long *len) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for(int p=0; p<HOTSPOT_PARTS; p++) {
+        for(unsigned long i=0; part[p] && i<len[p]; i++)
+            hash = (hash ^ (unsigned char)part[p][i]) * 0x100000001b3ULL;
+        hash = (hash ^ 0xff) * 0x100000001b3ULL;
+    }
+    return hash ? hash : 1;
+}
+
+static int hotspot_match(hotspot_entry_t *e, char **part, const unsigned long *len) {
+    for(int p=0; p<HOTSPOT_PARTS; p++) {
+        unsigned long l = part[p] ? len[p] : 0;
+        if(strncmp(e->part[p], part[p] ? part[p] : "", l) || e->part[p][l] != '\0')
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Compacts the live entries and rebuilds the index for them
+ */
+static int hotspot_rebuild(hotspot_t *h) {
+    unsigned int n = 0;
+    for(unsigned int i=0; i<h->n; i++)
+        if(h->entry[i].seen+1 >= h->gen)
+            h->entry[n++] = h->entry[i];
+    h->n = n;
+
+    unsigned int cap = HOTSPOT_MIN;
+    while(cap < n*2) cap *= 2;
+    if(cap != h->cap) {
+        unsigned int *slot = malloc(cap*sizeof(unsigned int));
+        if(!slot) return -1;
+        free(h->slot);
+        h->slot = slot;
+        h->cap  = cap;
+    }
+    memset(h->slot, 0, h->cap*sizeof(unsigned int));
+
+    for(unsigned int i=0; i<h->n; i++) {
+        unsigned int j = h->entry[i].hash & (h->cap-1);
+        while(h->slot[j]) j = (j+1) & (h->cap-1);
+        h->slot[j] = i+1;
+    }
+
+    if(h->size < h->cap) {
+        hotspot_entry_t *entry = realloc(h->entry, h->cap*sizeof(hotspot_entry_t));
+        if(!entry) return -1;
+        h->entry = entry;
+        h->size  = h->cap;
+    }
+    return 0;
+}
+
+void hotspot_init(hotspot_t *h, intern_t *names) {
+    memset(h, 0, sizeof(hotspot_t));
+    h->names = names;
+}
+
+void hotspot_fini(hotspot_t *h) {
+    free(h->slot);
+    free(h->entry);
+    hotspot_init(h, h->names);
+}
+
+void hotspot_begin(hotspot_t *h) {
+    h->gen++;
+}
+
+int hotspot_update(hotspot_t *h, char **part, const unsigned long *len, const unsigned long long *value) {
+    if((h->n+1)*4 >= h->cap*3 && hotspot_rebuild(h) < 0)
+        return -1;
+
+    unsigned long long hash = hotspot_hash(part, len);
+    unsigned int i = hash & (h->cap-1);
+    hotspot_entry_t *e = NULL;
+    for(; h->slot[i]; i=(i+1)&(h->cap-1)) {
+        hotspot_entry_t *c = &h->entry[h->slot[i]-1];
+        if(c->hash == hash && hotspot_match(c, part, len)) {
+            e = c;
+            break;
+        }
+    }
+
+    if(e) {
+        // A counter that went back was reset, by a restart or a truncate
+        for(int v=0; v<HOTSPOT_VALUES; v++)
+            e->delta[v] = value[v] >= e->value[v] ? value[v]-e->value[v] : value[v];
+    } else {
+        e = &h->entry[h->n];
+        e->hash = hash;
+        for(int p=0; p<HOTSPOT_PARTS; p++)
+            if(!(e->part[p] = intern(h->names, part[p] ? part[p] : "", part[p] ? len[p] : 0)))
+                return -1;
+        // Everything is new in the first snapshot, later it all happened this interval
+        for(int v=0; v<HOTSPOT_VALUES; v++)
+            e->delta[v] = h->gen > 1 ? value[v] : 0;
+        h->slot[i] = ++h->n;
+    }
+
+    memcpy(e->value, value, sizeof(e->value));
+    e->seen = h->gen;
+    return 0;
+}
+
+static int hotspot_less(const hotspot_entry_t *a, const hotspot_entry_t *b) {
+    return a->delta[0] != b->delta[0] ? a->delta[0] < b->delta[0] : a->delta[1] < b->delta[1];
+}
+
+static void hotspot_sift(hotspot_entry_t **heap, int k, int i) {
+    for(;;) {
+        int min = i, l = 2*i+1, r = 2*i+2;
+        if(l < k && hotspot_less(heap[l], heap[min])) min = l;
+        if(r < k && hotspot_less(heap[r], heap[min])) min = r;
+        if(min == i) return;
+        hotspot_entry_t *t = heap[i]; heap[i] = heap[min]; heap[min] = t;
+        i = min;
+    }
+}
+
+int hotspot_top(hotspot_t *h, hotspot_entry_t **top, int n) {
+    int k = 0;
+
+    // Min-heap of the n largest, its root is the one to beat
+    for(unsigned int i=0; i<h->n && n>0; i++) {
+        hotspot_entry_t *e = &h->entry[i];
+        if(e->seen != h->gen || !(e->delta[0] || e->delta[1]))
+            continue;
+
+        if(k < n) {
+            top[k++] = e;
+            if(k == n)
+                for(int j=k/2-1; j>=0; j--)
+                    hotspot_sift(top, k, j);
+        } else if(hotspot_less(top[0], e)) {
+            top[0] = e;
+            hotspot_sift(top, k, 0);
+        }
+    }
+    if(k < n)
+        for(int j=k/2-1; j>=0; j--)
+            hotspot_sift(top, k, j);
+
+    // Pop the smallest to the back
+    for(int j=k-1; j>0; j--) {
+        hotspot_entry_t *t = top[0]; top[0] = top[j]; top[j] = t;
+        hotspot_sift(top, j, 0);
+    }
+    return k;
+}
+
+int hotspot_renew(hotspot_t *h) {
+    if(hotspot_rebuild(h) < 0)
+        return -1;
+
+    for(unsigned int i=0; i<h->n; i++) {
+        hotspot_entry_t *e = &h->entry[i];
+        for(int p=0; p<HOTSPOT_PARTS; p++) {
+            const char *s = intern(h->names, e->part[p], strlen(e->part[p]));
+            if(!s) return -1;
+            e->part[p] = s;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,263 @@
+/**
+ * @file innodb.c
+ * @author Snyo
+ *
+ * The monitor output is walked line by line with memchr, which scans
+ * a word at a time, and each line is handled by the section it is in.
+ * No line is visited twice, so the cost is linear in the output size.
+ */
+#define _GNU_SOURCE
+#include "plugins/mysql/innodb.h"
+
+#include <string.h>
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+#define PREFIX(line, n, s) ((n) >= sizeof(s)-1 && !memcmp((line), (s), sizeof(s)-1))
+
+static const struct {
+    const char *title;
+    enum innodb_section section;
+} titles[] = {
+    {"BACKGROUND THREAD",                     INNODB_BACKGROUND},
+    {"SEMAPHORES",                            INNODB_SEMAPHORES},
+    {"LATEST FOREIGN KEY ERROR",              INNODB_FOREIGN_KEY},
+    {"LATEST DETECTED DEADLOCK",              INNODB_DEADLOCK},
+    {"TRANSACTIONS",                          INNODB_TRANSACTIONS},
+    {"FILE I/O",                              INNODB_FILE_IO},
+    {"INSERT BUFFER AND ADAPTIVE HASH INDEX", INNODB_INSERT_BUFFER},
+    {"LOG",                                   INNODB_LOG},
+    {"BUFFER POOL AND MEMORY",                INNODB_BUFFER_POOL},
+    {"INDIVIDUAL BUFFER POOL INFO",           INNODB_BUFFER_POOL},
+    {"ROW OPERATIONS",                        INNODB_ROW_OPERATIONS},
+};
+
+static const char *_eol(const char *line, const char *end) {
+    const char *eol = memchr(line, '\n', end-line);
+    return eol ? eol : end;
+}
+
+/*
+ * A line made of one repeated '-' or '=', surrounding a section title
+ */
+static int _is_rule(const char *line, const char *eol) {
+    if(eol-line < 3 || (line[0] != '-' && line[0] != '='))
+        return 0;
+    for(const char *c=line+1; c<eol; c++)
+        if(*c != line[0]) return 0;
+    return 1;
+}
+
+static enum innodb_section _section(const char *title, size_t n) {
+    for(int i=0; i<sizeof(titles)/sizeof(titles[0]); i++)
+        if(strlen(titles[i].title) == n && !memcmp(titles[i].title, title, n))
+            return titles[i].section;
+    return INNODB_NONE;
+}
+
+static const char *_after(const char *line, const char *eol, const char *needle) {
+    size_t n = strlen(needle);
+    const char *found = memmem(line, eol-line, needle, n);
+    return found ? found+n : NULL;
+}
+
+static unsigned long long _num(const char **p, const char *eol) {
+    const char *c = *p;
+    unsigned long long v = 0;
+    while(c < eol && (*c < '0' || *c > '9')) c++;
+    while(c < eol && *c >= '0' && *c <= '9') v = v*10 + (*c++ - '0');
+    *p = c;
+    return v;
+}
+
+static double _real(const char **p, const char *eol) {
+    double v = _num(p, eol);
+    const char *c = *p;
+    if(c < eol && *c == '.') {
+        double scale = 0.1;
+        for(c++; c < eol && *c >= '0' && *c <= '9'; c++, scale /= 10)
+            v += (*c - '0') * scale;
+    }
+    *p = c;
+    return v;
+}
+
+/*
+ * "0 [0, 0]" or "[0, 0]", the sum of the bracket if any
+ */
+static unsigned long _pending(const char *p, const char *eol) {
+    const char *open = memchr(p, '[', eol-p);
+    if(!open) return _num(&p, eol);
+
+    const char *close = memchr(open, ']', eol-open);
+    unsigned long sum = 0;
+    for(p=open; p<(close?close:eol); )
+        sum += _num(&p, close?close:eol);
+    return sum;
+}
+
+/*
+ * A value that may be empty, like "ibuf aio reads:,"
+ */
+static unsigned long _optional(const char *line, const char *eol, const char *label) {
+    const char *p = _after(line, eol, label);
+    if(!p) return 0;
+    while(p < eol && *p == ' ') p++;
+    if(p == eol || *p < '0' || *p > '9') return 0;
+    return _num(&p, eol);
+}
+
+static void _event_time(innodb_event_t *ev, const char *line, const char *eol) {
+    int spaces = 0, n = 0;
+    for(const char *c=line; c<eol && n<sizeof(ev->time)-1; c++) {
+        if(*c == ' ' && ++spaces == 2) break;
+        if((*c < '0' || *c > '9') && *c != '-' && *c != ':' && *c != ' ') break;
+        ev->time[n++] = *c;
+    }
+    ev->time[n] = '\0';
+}
+
+int innodb_status_parse(const char *text, size_t len, innodb_status_t *st) {
+    memset(st, 0, sizeof(innodb_status_t));
+
+    const char *end = text + len;
+    enum innodb_section section = INNODB_NONE;
+    innodb_event_t *event = NULL;
+    unsigned long long hash = FNV_OFFSET;
+    int first = 0, rates = 0;
+
+    for(const char *line=text, *eol; line<end; line=eol+1) {
+        eol = _eol(line, end);
+        size_t n = eol - line;
+
+        // Section header, a title between two rules
+        if(n >= 3 && line[0] == '-' && line[1] == '-' && line[2] == '-' && _is_rule(line, eol) && eol < end) {
+            const char *title = eol + 1;
+            const char *title_eol = _eol(title, end);
+            const char *rule_eol = title_eol < end ? _eol(title_eol+1, end) : end;
+            if(title_eol < end && _is_rule(title_eol+1, rule_eol)) {
+                if(event) event->hash = hash;
+
+                section = _section(title, title_eol-title);
+                st->found |= 1u << section;
+
+                event = section==INNODB_DEADLOCK ? &st->deadlock : section==INNODB_FOREIGN_KEY ? &st->fk_error : NULL;
+                hash = FNV_OFFSET;
+                first = 1;
+
+                eol = rule_eol;
+                if(eol == end) break;
+                continue;
+            }
+        }
+
+        const char *p;
+        switch(section) {
+        case INNODB_SEMAPHORES:
+            if(PREFIX(line, n, "--Thread ")) {
+                st->semaphore_waits++;
+            } else if(PREFIX(line, n, "OS WAIT ARRAY INFO:")) {
+                if((p = _after(line, eol, "reservation count ")))
+                    st->reservation_count = _num(&p, eol);
+                if((p = _after(line, eol, "signal count ")))
+                    st->signal_count = _num(&p, eol);
+            } else if(PREFIX(line, n, "Mutex spin waits ") || PREFIX(line, n, "RW-")) {
+                p = line;
+                st->spin_waits  += _num(&p, eol);
+                st->spin_rounds += _num(&p, eol);
+                st->os_waits    += _num(&p, eol);
+            }
+            break;
+
+        case INNODB_FOREIGN_KEY:
+        case INNODB_DEADLOCK:
+            for(const char *c=line; c<=eol && c<end; c++)
+                hash = (hash ^ (unsigned char)*c) * FNV_PRIME;
+            if(first) {
+                _event_time(event, line, eol);
+                first = 0;
+            }
+            break;
+
+        case INNODB_TRANSACTIONS:
+            if(PREFIX(line, n, "---TRANSACTION ")) {
+                st->trx_count++;
+                if(_after(line, eol, ", ACTIVE "))
+                    st->trx_active++;
+            } else if(PREFIX(line, n, "Trx id counter ")) {
+                p = line + 15;
+                st->trx_id_counter = _num(&p, eol);
+            } else if(PREFIX(line, n, "History list length ")) {
+                p = line + 20;
+                st->history_list_length = _num(&p, eol);
+            }
+            break;
+
+        case INNODB_FILE_IO:
+            if(PREFIX(line, n, "Pending normal aio reads:")) {
+                const char *writes = _after(line, eol, "aio writes:");
+                st->pending_reads = _pending(line+25, writes?writes:eol);
+                if(writes)
+                    st->pending_writes = _pending(writes, eol);
+            } else if(PREFIX(line, n, " ibuf aio reads:")) {
+                st->pending_ibuf_reads = _optional(line, eol, "ibuf aio reads:");
+                st->pending_log_io     = _optional(line, eol, "log i/o's:");
+                st->pending_sync_io    = _optional(line, eol, "sync i/o's:");
+            } else if(PREFIX(line, n, "Pending flushes (fsync) log:")) {
+                p = line + 28;
+                st->pending_fsync_log = _num(&p, eol);
+                st->pending_fsync_bp  = _num(&p, eol);
+            }
+            break;
+
+        case INNODB_INSERT_BUFFER:
+            if(PREFIX(line, n, "Ibuf: size ")) {
+                p = line;
+                st->ibuf_size = _num(&p, eol);
+                st->ibuf_free = _num(&p, eol);
+                st->ibuf_seg  = _num(&p, eol);
+            }
+            break;
+
+        case INNODB_LOG:
+            p = line;
+            if(PREFIX(line, n, "Log sequence number"))
+                st->lsn = _num(&p, eol);
+            else if(PREFIX(line, n, "Log flushed up to"))
+                st->lsn_flushed = _num(&p, eol);
+            else if(PREFIX(line, n, "Pages flushed up to"))
+                st->pages_flushed = _num(&p, eol);
+            else if(PREFIX(line, n, "Last checkpoint at"))
+                st->checkpoint = _num(&p, eol);
+            else if(_after(line, eol, " pending log flushes, ")) {
+                st->pending_log_flushes = _num(&p, eol);
+                st->pending_chkp_writes = _num(&p, eol);
+            }
+            break;
+
+        case INNODB_ROW_OPERATIONS:
+            p = line;
+            if(_after(line, eol, " queries inside InnoDB, ")) {
+                st->queries_inside = _num(&p, eol);
+                st->queries_queued = _num(&p, eol);
+            } else if(!rates && _after(line, eol, " inserts/s, ")) {
+                // The first one is for user rows, 8.0 adds system rows
+                st->inserts = _real(&p, eol);
+                st->updates = _real(&p, eol);
+                st->deletes = _real(&p, eol);
+                st->reads   = _real(&p, eol);
+                rates = 1;
+            }
+            break;
+
+        default:
+            break;
+        }
+
+        if(eol == end) break;
+    }
+    if(event) event->hash = hash;
+
+    return (st->found & ~1u) ? 0 : -1;
+}
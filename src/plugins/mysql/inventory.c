@@ -0,0 +1,210 @@
+/**
+ * @file inventory.c
+ * @author Snyo
+ */
+#include "plugins/mysql/inventory.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define INVENTORY_MIN 1024
+
+static unsigned long long inventory_hash(unsigned long long hash, const char *s, size_t len) {
+    for(size_t i=0; i<len; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return (hash ^ 0xff) * 0x100000001b3ULL;
+}
+
+static unsigned long long inventory_mix(unsigned long long x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/*
+ * Compacts the entries still wanted and rebuilds the index for them
+ */
+static int inventory_rebuild(inventory_t *v) {
+    unsigned int n = 0;
+    for(unsigned int i=0; i<v->n; i++)
+        if(!v->entry[i].gone || v->entry[i].dirty)
+            v->entry[n++] = v->entry[i];
+    v->n = n;
+
+    unsigned int cap = INVENTORY_MIN;
+    while(cap < n*2) cap *= 2;
+    if(cap != v->cap) {
+        unsigned int *slot = malloc(cap*sizeof(unsigned int));
+        if(!slot) return -1;
+        free(v->slot);
+        v->slot = slot;
+        v->cap  = cap;
+    }
+    memset(v->slot, 0, v->cap*sizeof(unsigned int));
+
+    for(unsigned int i=0; i<v->n; i++) {
+        unsigned int j = v->entry[i].hash & (v->cap-1);
+        while(v->slot[j]) j = (j+1) & (v->cap-1);
+        v->slot[j] = i+1;
+    }
+
+    if(v->size < v->cap) {
+        inventory_entry_t *entry = realloc(v->entry, v->cap*sizeof(inventory_entry_t));
+        if(!entry) return -1;
+        v->entry = entry;
+        v->size  = v->cap;
+    }
+    return 0;
+}
+
+void inventory_init(inventory_t *v, intern_t *names) {
+    memset(v, 0, sizeof(inventory_t));
+    v->names = names;
+}
+
+void inventory_fini(inventory_t *v) {
+    free(v->slot);
+    free(v->entry);
+    free(v->schemas);
+    inventory_init(v, v->names);
+}
+
+int inventory_begin(inventory_t *v, char **schema, const unsigned long *len, int n) {
+    const char **schemas = realloc(v->schemas, (n ? n : 1)*sizeof(const char *));
+    if(!schemas) return -1;
+    v->schemas = schemas;
+
+    for(int i=0; i<n; i++)
+        if(!(v->schemas[i] = intern(v->names, schema[i], len[i])))
+            return -1;
+    v->nschema = n;
+    v->schema = 0;
+    v->after = NULL;
+    v->seed = n ? inventory_hash(0xcbf29ce484222325ULL, v->schemas[0], strlen(v->schemas[0])) : 0;
+    v->pass++;
+    return 0;
+}
+
+int inventory_update(inventory_t *v, const char *name, size_t len, const unsigned long long *value) {
+    if(v->schema >= v->nschema)
+        return -1;
+    if((v->n+1)*4 >= v->cap*3 && inventory_rebuild(v) < 0)
+        return -1;
+
+    const char *schema = v->schemas[v->schema];
+    unsigned long long hash = inventory_hash(v->seed, name, len);
+    unsigned int i = hash & (v->cap-1);
+    inventory_entry_t *e = NULL;
+    for(; v->slot[i]; i=(i+1)&(v->cap-1)) {
+        inventory_entry_t *c = &v->entry[v->slot[i]-1];
+        if(c->hash == hash && c->schema == schema && !strncmp(c->name, name, len) && c->name[len] == '\0') {
+            e = c;
+            break;
+        }
+    }
+
+    if(!e) {
+        e = &v->entry[v->n];
+        memset(e, 0, sizeof(inventory_entry_t));
+        e->hash = hash;
+        e->schema = schema;
+        if(!(e->name = intern(v->names, name, len)))
+            return -1;
+        v->slot[i] = ++v->n;
+        e->dirty = 1;
+        v->ndirty++;
+    } else if(e->gone || memcmp(e->value, value, sizeof(e->value))) {
+        // Back before its drop went out, or resized
+        if(!e->dirty) v->ndirty++;
+        e->dirty = 1;
+    }
+
+    memcpy(e->value, value, sizeof(e->value));
+    e->gone = 0;
+    e->seen = v->pass;
+    v->after = e->name;
+    return 0;
+}
+
+int inventory_next(inventory_t *v) {
+    v->after = NULL;
+    if(++v->schema >= v->nschema)
+        return 1;
+    v->seed = inventory_hash(0xcbf29ce484222325ULL, v->schemas[v->schema], strlen(v->schemas[v->schema]));
+    return 0;
+}
+
+int inventory_end(inventory_t *v) {
+    int gone = 0;
+    for(unsigned int i=0; i<v->n; i++) {
+        inventory_entry_t *e = &v->entry[i];
+        if(e->seen == v->pass || e->gone)
+            continue;
+        e->gone = 1;
+        if(!e->dirty) v->ndirty++;
+        e->dirty = 1;
+        gone++;
+    }
+    return gone;
+}
+
+int inventory_changes(inventory_t *v, inventory_entry_t **out, int n) {
+    int k = 0;
+    for(unsigned int i=0; i<v->n && k<n && v->ndirty; i++) {
+        inventory_entry_t *e = &v->entry[i];
+        if(!e->dirty)
+            continue;
+        e->dirty = 0;
+        v->ndirty--;
+        out[k++] = e;
+    }
+    return k;
+}
+
+int inventory_purge(inventory_t *v) {
+    for(unsigned int i=0; i<v->n; i++)
+        if(v->entry[i].gone && !v->entry[i].dirty)
+            return inventory_rebuild(v);
+    return 0;
+}
+
+unsigned long long inventory_checksum(inventory_t *v) {
+    unsigned long long sum = 0;
+    for(unsigned int i=0; i<v->n; i++) {
+        inventory_entry_t *e = &v->entry[i];
+        if(e->gone)
+            continue;
+        unsigned long long h = e->hash;
+        for(int j=0; j<INVENTORY_VALUES; j++)
+            h = inventory_mix(h ^ e->value[j]);
+        sum += h;
+    }
+    return sum;
+}
+
+int inventory_renew(inventory_t *v) {
+    const char *s;
+    for(int i=0; i<v->nschema; i++) {
+        if(!(s = intern(v->names, v->schemas[i], strlen(v->schemas[i]))))
+            return -1;
+        v->schemas[i] = s;
+    }
+    for(unsigned int i=0; i<v->n; i++) {
+        inventory_entry_t *e = &v->entry[i];
+        if(!(s = intern(v->names, e->schema, strlen(e->schema))))
+            return -1;
+        e->schema = s;
+        if(!(s = intern(v->names, e->name, strlen(e->name))))
+            return -1;
+        e->name = s;
+    }
+    if(v->after) {
+        if(!(s = intern(v->names, v->after, strlen(v->after))))
+            return -1;
+        v->after = s;
+    }
+    return 0;
+}
@@ -0,0 +1,302 @@
+/**
+ * @file lockgraph.c
+ * @author Snyo
+ */
+#include "plugins/mysql/lockgraph.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define LOCKGRAPH_MIN 256
+
+typedef struct lockgraph_edge_t {
+    int from, to;
+    const char *object;
+} lockgraph_edge_t;
+
+static unsigned int lockgraph_hash(unsigned long long id) {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return id;
+}
+
+static int lockgraph_grow(lockgraph_t *g) {
+    unsigned int scap = g->scap ? g->scap*2 : LOCKGRAPH_MIN;
+    unsigned int *slot = calloc(scap, sizeof(unsigned int));
+    unsigned long long *id = realloc(g->id, scap*sizeof(unsigned long long));
+    if(!slot || !id) {
+        free(slot);
+        if(id) g->id = id;
+        return -1;
+    }
+    g->id = id;
+    g->ncap = scap;
+
+    for(int i=0; i<g->n; i++) {
+        unsigned int j = lockgraph_hash(g->id[i]) & (scap-1);
+        while(slot[j]) j = (j+1) & (scap-1);
+        slot[j] = i+1;
+    }
+    free(g->slot);
+    g->slot = slot;
+    g->scap = scap;
+    return 0;
+}
+
+static int lockgraph_node(lockgraph_t *g, unsigned long long id) {
+    if((unsigned int)(g->n+1)*4 >= g->scap*3 && lockgraph_grow(g) < 0)
+        return -1;
+
+    unsigned int i = lockgraph_hash(id) & (g->scap-1);
+    for(; g->slot[i]; i=(i+1)&(g->scap-1))
+        if(g->id[g->slot[i]-1] == id)
+            return g->slot[i]-1;
+
+    g->id[g->n] = id;
+    g->slot[i] = ++g->n;
+    return g->n-1;
+}
+
+static void lockgraph_clear(lockgraph_t *g) {
+    free(g->root);
+    free(g->cycle_start);
+    free(g->cycle);
+    g->root = NULL;
+    g->cycle_start = NULL;
+    g->cycle = NULL;
+    g->waits = g->waiters = g->nroots = g->ncycles = 0;
+}
+
+void lockgraph_init(lockgraph_t *g) {
+    memset(g, 0, sizeof(lockgraph_t));
+}
+
+void lockgraph_fini(lockgraph_t *g) {
+    lockgraph_clear(g);
+    free(g->id);
+    free(g->slot);
+    free(g->from);
+    free(g->to);
+    free(g->object);
+    memset(g, 0, sizeof(lockgraph_t));
+}
+
+void lockgraph_reset(lockgraph_t *g) {
+    lockgraph_clear(g);
+    if(g->slot)
+        memset(g->slot, 0, g->scap*sizeof(unsigned int));
+    g->n = 0;
+    g->m = 0;
+}
+
+int lockgraph_add(lockgraph_t *g, unsigned long long waiter, unsigned long long blocker, const char *object) {
+    if(waiter == blocker)
+        return 0;
+
+    if(g->m == g->mcap) {
+        int mcap = g->mcap ? g->mcap*2 : LOCKGRAPH_MIN;
+        int *from = realloc(g->from, mcap*sizeof(int));
+        if(from) g->from = from;
+        int *to = realloc(g->to, mcap*sizeof(int));
+        if(to) g->to = to;
+        const char **obj = realloc(g->object, mcap*sizeof(const char *));
+        if(obj) g->object = obj;
+        if(!from || !to || !obj)
+            return -1;
+        g->mcap = mcap;
+    }
+
+    int w = lockgraph_node(g, waiter);
+    int b = lockgraph_node(g, blocker);
+    if(w < 0 || b < 0)
+        return -1;
+
+    g->from[g->m]   = w;
+    g->to[g->m]     = b;
+    g->object[g->m] = object;
+    g->m++;
+    return 0;
+}
+
+static int lockgraph_edge_cmp(const void *_a, const void *_b) {
+    const lockgraph_edge_t *a = _a, *b = _b;
+    return a->from != b->from ? (a->from > b->from) - (a->from < b->from) : (a->to > b->to) - (a->to < b->to);
+}
+
+static int lockgraph_root_cmp(const void *_a, const void *_b) {
+    const lockgraph_root_t *a = _a, *b = _b;
+    return (a->direct < b->direct) - (a->direct > b->direct);
+}
+
+/*
+ * Sessions reachable from a root backwards, each counted once
+ */
+static int lockgraph_reach(int root, const int *in_start, const int *in, int *mark, int stamp, int *queue) {
+    int head = 0, tail = 0, total = 0;
+    mark[root] = stamp;
+    queue[tail++] = root;
+    while(head < tail) {
+        int v = queue[head++];
+        for(int e=in_start[v]; e<in_start[v+1]; e++) {
+            int w = in[e];
+            if(mark[w] == stamp) continue;
+            mark[w] = stamp;
+            queue[tail++] = w;
+            total++;
+        }
+    }
+    return total;
+}
+
+/*
+ * Tarjan's strongly connected components without recursion, since a chain
+ * of waiters can be thousands long. Components of two or more are cycles.
+ */
+static int lockgraph_cycles(lockgraph_t *g, const int *out_start, const int *out) {
+    int n = g->n;
+    int *index = malloc(n*sizeof(int));
+    int *low   = malloc(n*sizeof(int));
+    int *stack = malloc(n*sizeof(int));
+    int *call  = malloc(n*sizeof(int));
+    int *edge  = malloc(n*sizeof(int));
+    char *on   = calloc(n, 1);
+    g->cycle_start = malloc((n+1)*sizeof(int));
+    g->cycle       = malloc(n*sizeof(int));
+    if(!index || !low || !stack || !call || !edge || !on || !g->cycle_start || !g->cycle) {
+        free(index); free(low); free(stack); free(call); free(edge); free(on);
+        return -1;
+    }
+
+    for(int i=0; i<n; i++) index[i] = -1;
+    int counter = 0, sp = 0, ncycle = 0;
+    g->cycle_start[0] = 0;
+
+    for(int s=0; s<n; s++) {
+        if(index[s] >= 0 || out_start[s] == out_start[s+1])
+            continue;
+
+        int depth = 0;
+        call[depth] = s;
+        edge[depth] = out_start[s];
+        index[s] = low[s] = counter++;
+        stack[sp++] = s;
+        on[s] = 1;
+
+        while(depth >= 0) {
+            int v = call[depth];
+            if(edge[depth] < out_start[v+1]) {
+                int w = out[edge[depth]++];
+                if(index[w] < 0) {
+                    index[w] = low[w] = counter++;
+                    stack[sp++] = w;
+                    on[w] = 1;
+                    depth++;
+                    call[depth] = w;
+                    edge[depth] = out_start[w];
+                } else if(on[w] && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            if(low[v] == index[v]) {
+                int size = 0;
+                while(stack[sp-1-size] != v) size++;
+                size++;
+                for(int k=0; k<size; k++) {
+                    int w = stack[--sp];
+                    on[w] = 0;
+                    if(size > 1)
+                        g->cycle[ncycle++] = w;
+                }
+                if(size > 1)
+                    g->cycle_start[++g->ncycles] = ncycle;
+            }
+            depth--;
+            if(depth >= 0 && low[v] < low[call[depth]])
+                low[call[depth]] = low[v];
+        }
+    }
+
+    free(index); free(low); free(stack); free(call); free(edge); free(on);
+    return 0;
+}
+
+int lockgraph_analyze(lockgraph_t *g, int roots) {
+    lockgraph_clear(g);
+    if(g->m == 0)
+        return 0;
+
+    int n = g->n, m = g->m;
+    lockgraph_edge_t *e = malloc(m*sizeof(lockgraph_edge_t));
+    int *out_start = calloc(n+1, sizeof(int));
+    int *in_start  = calloc(n+2, sizeof(int));
+    int *out = malloc(m*sizeof(int));
+    int *in  = malloc(m*sizeof(int));
+    int *mark  = calloc(n, sizeof(int));
+    int *queue = malloc(n*sizeof(int));
+    const char **object = calloc(n, sizeof(const char *));
+    int error = -1;
+    if(!e || !out_start || !in_start || !out || !in || !mark || !queue || !object)
+        goto done;
+
+    // Merge the same waiter and blocker seen through several locks
+    for(int i=0; i<m; i++) {
+        e[i].from = g->from[i];
+        e[i].to = g->to[i];
+        e[i].object = g->object[i];
+    }
+    qsort(e, m, sizeof(lockgraph_edge_t), lockgraph_edge_cmp);
+    int k = 0;
+    for(int i=0; i<m; i++)
+        if(k == 0 || e[i].from != e[k-1].from || e[i].to != e[k-1].to)
+            e[k++] = e[i];
+    g->waits = k;
+
+    for(int i=0; i<k; i++) {
+        out_start[e[i].from+1]++;
+        in_start[e[i].to+2]++;
+    }
+    for(int v=0; v<n; v++) {
+        out_start[v+1] += out_start[v];
+        in_start[v+2] += in_start[v+1];
+    }
+    for(int i=0; i<k; i++) {
+        out[i] = e[i].to;
+        in[in_start[e[i].to+1]++] = e[i].from;
+        if(!object[e[i].to])
+            object[e[i].to] = e[i].object;
+    }
+
+    if(!(g->root = malloc(n*sizeof(lockgraph_root_t))))
+        goto done;
+    for(int v=0; v<n; v++) {
+        int direct = in_start[v+1] - in_start[v];
+        if(out_start[v+1] > out_start[v]) {
+            g->waiters++;
+        } else if(direct > 0) {
+            lockgraph_root_t *r = &g->root[g->nroots++];
+            r->node = v;
+            r->direct = direct;
+            r->total = 0;
+            r->object = object[v];
+        }
+    }
+    qsort(g->root, g->nroots, sizeof(lockgraph_root_t), lockgraph_root_cmp);
+    for(int r=0; r<g->nroots && r<roots; r++)
+        g->root[r].total = lockgraph_reach(g->root[r].node, in_start, in, mark, r+1, queue);
+
+    error = lockgraph_cycles(g, out_start, out);
+
+done:
+    free(e);
+    free(out_start);
+    free(in_start);
+    free(out);
+    free(in);
+    free(mark);
+    free(queue);
+    free(object);
+    return error;
+}
@@ -90,6 +90,7 @@ int _os_gather_disk(void *_m, packet_t *pkt) {
 
     struct {
         char name[BFSZ], mount[BFSZ];
+        char label[BFSZ*2+8];
         unsigned short num;
         unsigned long long tot, free, avail;
         unsigned long sec_size;
@@ -136,40 +137,29 @@ int _os_gather_disk(void *_m, packet_t *pkt) {
 
     if(k == 0) return error;
 
-    packet_append(pkt, "\"name\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s%hu(%s)\"", i?",":"", dev[i].name, dev[i].num, dev[i].mount);
-    packet_append(pkt, "],\"tot\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].tot);
-    packet_append(pkt, "],\"free\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].free);
-    packet_append(pkt, "],\"avail\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].avail);
-    packet_append(pkt, "],\"r\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].r);
-    packet_append(pkt, "],\"rsec\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].rkb);
-    packet_append(pkt, "],\"rt\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].rt);
-    packet_append(pkt, "],\"w\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].w);
-    packet_append(pkt, "],\"wsec\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].wkb);
-    packet_append(pkt, "],\"wt\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].wt);
-    packet_append(pkt, "],\"weight\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", dev[i].weight);
-    packet_append(pkt, "],\"io_tot\":%llu", io_tot);
+    packet_cols_t cols;
+    packet_cols_init(&cols, k);
+    packet_col(&cols, "name", COL_STR, 0);
+    static const char *keys[] = {"tot", "free", "avail", "r", "rsec", "rt", "w", "wsec", "wt", "weight"};
+    for(int c=0; c<sizeof(keys)/sizeof(keys[0]); c++)
+        packet_col(&cols, keys[c], COL_U64, 0);
+    for(int i=0; i<k; i++) {
+        packet_row(&cols);
+        packet_put_str(&cols, dev[i].label, snprintf(dev[i].label, sizeof(dev[i].label), "%s%hu(%s)", dev[i].name, dev[i].num, dev[i].mount));
+        packet_put_u64(&cols, dev[i].tot);
+        packet_put_u64(&cols, dev[i].free);
+        packet_put_u64(&cols, dev[i].avail);
+        packet_put_u64(&cols, dev[i].r);
+        packet_put_u64(&cols, dev[i].rkb);
+        packet_put_u64(&cols, dev[i].rt);
+        packet_put_u64(&cols, dev[i].w);
+        packet_put_u64(&cols, dev[i].wkb);
+        packet_put_u64(&cols, dev[i].wt);
+        packet_put_u64(&cols, dev[i].weight);
+    }
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+    packet_append(pkt, ",\"io_tot\":%llu", io_tot);
 
     return ENONE;
 }
@@ -198,6 +188,7 @@ int _os_gather_proc(void *_m, packet_t *pkt) {
         float cpu;
         float mem;
     } proc[10];
+    packet_cols_t cols;
 
     // CPU
 	FILE *pipe = popen("ps -eo comm,pcpu --no-headers | awk '{c[$1]+=1;cpu[$1]+=$2} END{for(i in c)if(cpu[i]>0)print i,cpu[i]}' | sort -grk2,2 | head -n 10", "r");
@@ -209,13 +200,18 @@ int _os_gather_proc(void *_m, packet_t *pkt) {
 
     if(k > 0) {
         error = ENONE;
-        packet_append(pkt, "\"cpu_top10\":{\"name\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s\"%s\"", i?",":"", proc[i].name);
-        packet_append(pkt, "],\"cpu\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s%.1f", i?",":"", proc[i].cpu);
-        packet_append(pkt, "]}");
+        packet_cols_init(&cols, k);
+        packet_col(&cols, "name", COL_STR, 0);
+        packet_col(&cols, "cpu", COL_F64, 1);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            packet_put_str(&cols, proc[i].name, -1);
+            packet_put_f64(&cols, proc[i].cpu);
+        }
+        packet_append(pkt, "\"cpu_top10\":{");
+        packet_cols(pkt, &cols);
+        packet_append(pkt, "}");
+        packet_cols_fini(&cols);
     }
     // !CPU
 
@@ -229,13 +225,18 @@ int _os_gather_proc(void *_m, packet_t *pkt) {
 
     if(k > 0) {
         error = ENONE;
-        packet_append(pkt, "%s\"mem_top10\":{\"name\":[", pkt->payload[pkt->size-1]=='{'?"":",");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s\"%s\"", i?",":"", proc[i].name);
-        packet_append(pkt, "],\"mem\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s%.1f", i?",":"", proc[i].mem);
-        packet_append(pkt, "]}");
+        packet_cols_init(&cols, k);
+        packet_col(&cols, "name", COL_STR, 0);
+        packet_col(&cols, "mem", COL_F64, 1);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            packet_put_str(&cols, proc[i].name, -1);
+            packet_put_f64(&cols, proc[i].mem);
+        }
+        packet_append(pkt, "%s\"mem_top10\":{", packet_last(pkt)=='{'?"":",");
+        packet_cols(pkt, &cols);
+        packet_append(pkt, "}");
+        packet_cols_fini(&cols);
     }
     // !MEMORY
 
@@ -249,22 +250,24 @@ int _os_gather_proc(void *_m, packet_t *pkt) {
 
     if(k > 0) {
         error = ENONE;
-        packet_append(pkt, "%s\"list\":{\"name\":[", pkt->payload[pkt->size-1]=='{'?"":",");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s\"%s\"", i?",":"", proc[i].name);
-        packet_append(pkt, "],\"user\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s\"%s\"", i?",":"", proc[i].user);
-        packet_append(pkt, "],\"count\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s%lu", i?",":"", proc[i].count);
-        packet_append(pkt, "],\"cpu\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s%.1f", i?",":"", proc[i].cpu);
-        packet_append(pkt, "],\"mem\":[");
-        for(int i=0; i<k; i++)
-            packet_append(pkt, "%s%.1f", i?",":"", proc[i].mem);
-        packet_append(pkt, "]}");
+        packet_cols_init(&cols, k);
+        packet_col(&cols, "name", COL_STR, 0);
+        packet_col(&cols, "user", COL_STR, 0);
+        packet_col(&cols, "count", COL_U64, 0);
+        packet_col(&cols, "cpu", COL_F64, 1);
+        packet_col(&cols, "mem", COL_F64, 1);
+        for(int i=0; i<k; i++) {
+            packet_row(&cols);
+            packet_put_str(&cols, proc[i].name, -1);
+            packet_put_str(&cols, proc[i].user, -1);
+            packet_put_u64(&cols, proc[i].count);
+            packet_put_f64(&cols, proc[i].cpu);
+            packet_put_f64(&cols, proc[i].mem);
+        }
+        packet_append(pkt, "%s\"list\":{", packet_last(pkt)=='{'?"":",");
+        packet_cols(pkt, &cols);
+        packet_append(pkt, "}");
+        packet_cols_fini(&cols);
     }
     // !PROCESSES
     return error;
@@ -337,28 +340,25 @@ int _os_gather_network(void *_m, packet_t *pkt) {
 
     if(k == 0) return error;
 
-    packet_append(pkt, "\"name\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s\"%s\"", i?",":"", net_if[i].name);
-    packet_append(pkt, "],\"i_byte\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", net_if[i].i_byte);
-    packet_append(pkt, "],\"o_byte\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", net_if[i].o_byte);
-    packet_append(pkt, "],\"i_pckt\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", net_if[i].i_pckt);
-    packet_append(pkt, "],\"o_pckt\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", net_if[i].o_pckt);
-    packet_append(pkt, "],\"i_err\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", net_if[i].i_err);
-    packet_append(pkt, "],\"o_err\":[");
-    for(int i=0; i<k; i++)
-        packet_append(pkt, "%s%llu", i?",":"", net_if[i].o_err);
-    packet_append(pkt, "],\"i_tot\":%llu,\"o_tot\":%llu", i_tot, o_tot);
+    packet_cols_t cols;
+    packet_cols_init(&cols, k);
+    packet_col(&cols, "name", COL_STR, 0);
+    static const char *keys[] = {"i_byte", "o_byte", "i_pckt", "o_pckt", "i_err", "o_err"};
+    for(int c=0; c<sizeof(keys)/sizeof(keys[0]); c++)
+        packet_col(&cols, keys[c], COL_U64, 0);
+    for(int i=0; i<k; i++) {
+        packet_row(&cols);
+        packet_put_str(&cols, net_if[i].name, -1);
+        packet_put_u64(&cols, net_if[i].i_byte);
+        packet_put_u64(&cols, net_if[i].o_byte);
+        packet_put_u64(&cols, net_if[i].i_pckt);
+        packet_put_u64(&cols, net_if[i].o_pckt);
+        packet_put_u64(&cols, net_if[i].i_err);
+        packet_put_u64(&cols, net_if[i].o_err);
+    }
+    packet_cols(pkt, &cols);
+    packet_cols_fini(&cols);
+    packet_append(pkt, ",\"i_tot\":%llu,\"o_tot\":%llu", i_tot, o_tot);
 
     return ENONE;
 }
@@ -0,0 +1,334 @@
+/**
+ * @file schema.c
+ * @author Snyo
+ */
+#include "schema.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define SCHEMA_MEMBERS 256
+
+struct schema_node_t {
+    schema_node_t *next;    // Next key of the same object
+    schema_node_t *child;   // First key of its value, if an object
+    int object;
+    int len;
+    char key[];             // Quoted as in the sample
+};
+
+/*
+ * A key and its value, as positions in the sample
+ */
+struct schema_member_t {
+    packet_reader_t key, val;
+    int klen, vlen;
+    int first;              // First character of the value
+};
+
+void schema_init(schema_t *s) {
+    memset(s, 0, sizeof(schema_t));
+}
+
+static void schema_free(schema_node_t *node) {
+    while(node) {
+        schema_node_t *next = node->next;
+        schema_free(node->child);
+        free(node);
+        node = next;
+    }
+}
+
+void schema_fini(schema_t *s) {
+    schema_free(s->keys);
+    free(s->member);
+    memset(s, 0, sizeof(schema_t));
+}
+
+/*
+ * Input
+ */
+
+/*
+ * Character at 'r', or -1 at the end of the sample. 'r' is moved off the
+ * end of a segment, so a position kept after it is on a character
+ */
+static inline int schema_peek(packet_reader_t *r) {
+    while(r->seg && r->offset == r->seg->size) {
+        r->seg = r->seg->next;
+        r->offset = 0;
+    }
+    return r->seg ? (unsigned char)r->seg->data[r->offset] : -1;
+}
+
+static inline void schema_ws(packet_reader_t *r) {
+    for(int c; (c = schema_peek(r)) == ' ' || c == '\n' || c == '\r' || c == '\t'; )
+        r->offset++;
+}
+
+/*
+ * Length of the value at 'r', which is moved to its end, or -1
+ */
+static int schema_value(packet_reader_t *r) {
+    int n = 0, depth = 0, quoted = 0, escaped = 0;
+    for(int c; (c = schema_peek(r)) >= 0; r->offset++, n++) {
+        if(quoted) {
+            if(escaped) {
+                escaped = 0;
+            } else if(c == '\\') {
+                escaped = 1;
+            } else if(c == '"') {
+                quoted = 0;
+                if(depth == 0) {
+                    r->offset++;
+                    return n+1;
+                }
+            }
+            continue;
+        }
+        switch(c) {
+            case '"': quoted = 1; break;
+            case '{': case '[': depth++; break;
+            case '}': case ']':
+            if(depth == 0) return n;
+            if(--depth == 0) {
+                r->offset++;
+                return n+1;
+            }
+            break;
+            case ',': case ' ': case '\n': case '\r': case '\t':
+            if(depth == 0) return n;
+            break;
+        }
+    }
+    return depth || quoted ? -1 : n;
+}
+
+/*
+ * Members of the object at 'r' appended to s->member, 'r' is moved past it
+ */
+static int schema_members(schema_t *s, packet_reader_t *r) {
+    if(schema_peek(r) != '{')
+        return -1;
+    r->offset++;
+    schema_ws(r);
+    if(schema_peek(r) == '}') {
+        r->offset++;
+        return 0;
+    }
+
+    while(schema_peek(r) >= 0) {
+        if(s->nmembers == s->mcap) {
+            unsigned int cap = s->mcap ? s->mcap*2 : SCHEMA_MEMBERS;
+            schema_member_t *member = realloc(s->member, cap*sizeof(schema_member_t));
+            if(!member) return -1;
+            s->member = member;
+            s->mcap = cap;
+        }
+        schema_member_t *m = &s->member[s->nmembers];
+
+        if(schema_peek(r) != '"')
+            return -1;
+        m->key = *r;
+        if((m->klen = schema_value(r)) < 0)
+            return -1;
+
+        schema_ws(r);
+        if(schema_peek(r) != ':')
+            return -1;
+        r->offset++;
+        schema_ws(r);
+        m->first = schema_peek(r);
+        m->val = *r;
+        if((m->vlen = schema_value(r)) <= 0)
+            return -1;
+        s->nmembers++;
+
+        schema_ws(r);
+        int c = schema_peek(r);
+        r->offset++;
+        if(c == '}')
+            return 0;
+        if(c != ',')
+            return -1;
+        schema_ws(r);
+    }
+    return -1;
+}
+
+/*
+ * Whether the 'len' bytes at 'r' are 'key'
+ */
+static int schema_match(packet_reader_t r, int len, const char *key, int klen) {
+    if(len != klen)
+        return 0;
+    while(len > 0) {
+        schema_peek(&r);
+        int c = r.seg->size-r.offset < len ? r.seg->size-r.offset : len;
+        if(memcmp(r.seg->data+r.offset, key, c))
+            return 0;
+        r.offset += c;
+        key += c;
+        len -= c;
+    }
+    return 1;
+}
+
+/*
+ * Append the 'len' bytes at 'r'
+ */
+static void schema_copy(packet_reader_t r, int len, packet_t *pkt) {
+    while(len > 0) {
+        schema_peek(&r);
+        int c = r.seg->size-r.offset < len ? r.seg->size-r.offset : len;
+        packet_write(pkt, r.seg->data+r.offset, c);
+        r.offset += c;
+        len -= c;
+    }
+}
+
+/*
+ * Learning
+ */
+static schema_node_t *schema_node(packet_reader_t r, int len) {
+    schema_node_t *node = malloc(sizeof(schema_node_t) + len);
+    if(!node) return NULL;
+    node->next = node->child = NULL;
+    node->object = 0;
+    node->len = len;
+    packet_read(&r, node->key, len);
+    return node;
+}
+
+static int schema_learn_object(schema_t *s, schema_node_t **keys, packet_reader_t *r, int *changed) {
+    unsigned int base = s->nmembers;
+    if(schema_members(s, r) < 0)
+        return -1;
+
+    unsigned int n = s->nmembers;
+    for(unsigned int i=base; i<n; i++) {
+        schema_member_t m = s->member[i];
+
+        schema_node_t **at = keys;
+        while(*at && !schema_match(m.key, m.klen, (*at)->key, (*at)->len))
+            at = &(*at)->next;
+        if(!*at) {
+            if(!(*at = schema_node(m.key, m.klen)))
+                return -1;
+            *changed = 1;
+        }
+
+        schema_node_t *node = *at;
+        // A null keeps the keys of an object, as a sub-gather may have none
+        int object = m.first == '{';
+        if(node->object != object && !(node->object && m.first == 'n')) {
+            schema_free(node->child);
+            node->child = NULL;
+            node->object = object;
+            *changed = 1;
+        }
+        if(object && schema_learn_object(s, &node->child, &m.val, changed) < 0)
+            return -1;
+    }
+    s->nmembers = base;
+
+    return 0;
+}
+
+int schema_learn(schema_t *s, packet_t *sample) {
+    if(sample->broken)
+        return -1;
+
+    // Keys added before an error are kept, so they still make a version
+    int changed = 0;
+    packet_reader_t r = {sample->head, 0};
+    s->nmembers = 0;
+    schema_ws(&r);
+    int error = schema_learn_object(s, &s->keys, &r, &changed);
+    if(changed)
+        s->version++;
+
+    return changed ? 1 : error;
+}
+
+/*
+ * Writing
+ */
+static int schema_write_object(schema_t *s, schema_node_t *keys, packet_reader_t *r, packet_t *pkt) {
+    unsigned int base = s->nmembers;
+    if(schema_members(s, r) < 0)
+        return -1;
+
+    // Members mostly come in the order of the keys, so each search starts after the last found
+    unsigned int n = s->nmembers, next = base;
+    int written = 0, nulls = 0;
+    packet_write(pkt, "[", 1);
+    for(schema_node_t *k=keys; k; k=k->next) {
+        unsigned int i = n;
+        for(unsigned int j=0; j<n-base; j++) {
+            unsigned int c = base + (next-base+j) % (n-base);
+            if(schema_match(s->member[c].key, s->member[c].klen, k->key, k->len)) {
+                i = c;
+                break;
+            }
+        }
+        if(i == n) {
+            nulls++;
+            continue;
+        }
+
+        for(; nulls; nulls--, written++)
+            packet_write(pkt, written ? ",null" : "null", written ? 5 : 4);
+        if(written++)
+            packet_write(pkt, ",", 1);
+
+        schema_member_t m = s->member[i];
+        if(k->object && m.first == '{') {
+            if(schema_write_object(s, k->child, &m.val, pkt) < 0)
+                return -1;
+        } else {
+            schema_copy(m.val, m.vlen, pkt);
+        }
+        next = i+1;
+    }
+    packet_write(pkt, "]", 1);
+    s->nmembers = base;
+
+    return pkt->broken ? -1 : 0;
+}
+
+int schema_write(schema_t *s, packet_t *sample, packet_t *pkt) {
+    if(sample->broken)
+        return -1;
+
+    packet_reader_t r = {sample->head, 0};
+    s->nmembers = 0;
+    schema_ws(&r);
+    return schema_write_object(s, s->keys, &r, pkt);
+}
+
+static void schema_print_keys(schema_node_t *keys, packet_t *pkt) {
+    packet_write(pkt, "[", 1);
+    for(schema_node_t *k=keys; k; k=k->next) {
+        if(k != keys)
+            packet_write(pkt, ",", 1);
+        if(k->object) {
+            packet_write(pkt, "{", 1);
+            packet_write(pkt, k->key, k->len);
+            packet_write(pkt, ":", 1);
+            schema_print_keys(k->child, pkt);
+            packet_write(pkt, "}", 1);
+        } else {
+            packet_write(pkt, k->key, k->len);
+        }
+    }
+    packet_write(pkt, "]", 1);
+}
+
+int schema_print(schema_t *s, packet_t *pkt) {
+    packet_append(pkt, "{\"version\":%u,\"keys\":", s->version);
+    schema_print_keys(s->keys, pkt);
+    packet_write(pkt, "}", 1);
+
+    return pkt->broken ? -1 : 0;
+}
@@ -4,9 +4,15 @@
  */
 #include "sender.h"
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <curl/curl.h>
 
+#include "encoding.h"
 #include "packet.h"
+#include "wire.h"
 
 //#define METRIC_URL   "http://52.79.45.223:8080/v1/metrics"
 //#define REGISTER_URL "http://52.79.45.223:8080/v1/agents"
@@ -15,19 +21,108 @@
 #define REGISTER_URL "https://gate.maxgauge.com/v1/agents"
 #define ALERT_URL    "https://gate.maxgauge.com/v1/alert"
 
-#define CONTENT_TYPE "Content-Type: application/vnd.exem.v1+json"
+#define CONTENT_TYPE   "Content-Type: application/vnd.exem.v1+json"
+#define CONTENT_BINARY "Content-Type: application/vnd.exem.v1+binary"
+
+#define SENDER_CONF "/etc/maxgaugeair/sender.conf"
+#define SENDER_DICT "/etc/maxgaugeair/metric.dict"
+#define SENDER_CPU  1.0     // % of a core compression may take
+#define SENDER_IOV  64      // Pieces of a body at first
 
 static sender_t sender[3];
-static struct curl_slist *header;
+static struct curl_slist *header[2][2];     // [format][compressed]
 
+static int encoding = IDENTITY;
+static char dictionary_path[BFSZ] = SENDER_DICT;
+static void *dictionary;
+static size_t dictionary_size;
+static double cpu_budget = SENDER_CPU;
+static int batch = 1;
+static int schema = 0;
+
+static size_t stream(char *ptr, size_t size, size_t nmemb, void *_body);
+static int rewind_body(void *_body, curl_off_t offset, int origin);
 static size_t callback(char *ptr, size_t size, size_t nmemb, void *tag);
 static int sender_add_opt(sender_t *sender, const char *url);
 
+/*
+ * Lines of "endpoint=format", endpoints are metric, register and alert,
+ * of "encoding=", "dictionary=" and "cpu_budget=" for all of them, and of
+ * "batch=" and "schema=" for metrics.
+ * Without the file every endpoint gets uncompressed JSON.
+ */
+static void sender_conf(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) return;
+
+    char line[BFSZ], key[BFSZ], value[BFSZ];
+    while(fgets(line, BFSZ, fp)) {
+        if(line[0] == '#' || sscanf(line, " %127[^= ] = %127s", key, value) != 2)
+            continue;
+        int type = !strcmp(key, "metric") ? METRIC : !strcmp(key, "register") ? REGISTER : !strcmp(key, "alert") ? ALERT : -1;
+        if(type >= 0)
+            sender[type].format = !strcmp(value, "binary") ? BINARY : JSON;
+        else if(!strcmp(key, "encoding") && encoding_type_of(value) >= 0)
+            encoding = encoding_type_of(value);
+        else if(!strcmp(key, "dictionary"))
+            snprintf(dictionary_path, BFSZ, "%s", value);
+        else if(!strcmp(key, "cpu_budget") && atof(value) > 0)
+            cpu_budget = atof(value);
+        else if(!strcmp(key, "batch") && atoi(value) > 0)
+            batch = atoi(value) < SENDER_BATCH ? atoi(value) : SENDER_BATCH;
+        else if(!strcmp(key, "schema"))
+            schema = !strcmp(value, "on");
+    }
+    fclose(fp);
+}
+
+/*
+ * A zstd dictionary shared by the senders, none if it cannot be read
+ */
+static void sender_dictionary(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if(!fp) return;
+
+    long size = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    if(size > 0 && fseek(fp, 0, SEEK_SET) == 0 && (dictionary = malloc(size))) {
+        if(fread(dictionary, 1, size, fp) == (size_t)size) {
+            dictionary_size = size;
+        } else {
+            free(dictionary);
+            dictionary = NULL;
+        }
+    }
+    fclose(fp);
+}
+
 int sender_init() {
     curl_global_init(CURL_GLOBAL_SSL);
 
-    if(0x00 || !(header = curl_slist_append(header, CONTENT_TYPE))
-            || sender_add_opt(&sender[METRIC],   METRIC_URL)   < 0
+    for(int i=0; i<3; i++)
+        wire_init(&sender[i].wire);
+    sender_conf(SENDER_CONF);
+    if(encoding == ZSTD)
+        sender_dictionary(dictionary_path);
+
+    // Falls back to identity if the contexts cannot be had
+    for(int i=0; i<3; i++)
+        if(encoding_init(&sender[i].encoding, encoding, dictionary, dictionary_size, cpu_budget/100) < 0) {
+            encoding_fini(&sender[i].encoding);
+            encoding_init(&sender[i].encoding, IDENTITY, NULL, 0, 0);
+        }
+
+    const char *content_encoding = encoding_header(&sender[METRIC].encoding);
+    for(int c=0; c<2; c++) {
+        if(!(header[JSON][c] = curl_slist_append(header[JSON][c], CONTENT_TYPE))
+                || !(header[BINARY][c] = curl_slist_append(header[BINARY][c], CONTENT_BINARY))
+                || (c && content_encoding && (!(header[JSON][c] = curl_slist_append(header[JSON][c], content_encoding))
+                                           || !(header[BINARY][c] = curl_slist_append(header[BINARY][c], content_encoding))))) {
+            sender_fini(sender);
+            return -1;
+        }
+    }
+
+    if(0x00 || sender_add_opt(&sender[METRIC],   METRIC_URL)   < 0
             || sender_add_opt(&sender[REGISTER], REGISTER_URL) < 0
             || sender_add_opt(&sender[ALERT],    ALERT_URL)    < 0) {
         sender_fini(sender);
@@ -43,7 +138,8 @@ int sender_add_opt(sender_t *sender, const char *url) {
             && curl_easy_setopt(sender->curl, CURLOPT_POST, 1L)           == CURLE_OK
             && curl_easy_setopt(sender->curl, CURLOPT_TIMEOUT, 30)        == CURLE_OK
             && curl_easy_setopt(sender->curl, CURLOPT_NOSIGNAL, 1)        == CURLE_OK
-            && curl_easy_setopt(sender->curl, CURLOPT_HTTPHEADER, header) == CURLE_OK
+            && curl_easy_setopt(sender->curl, CURLOPT_READFUNCTION, stream) == CURLE_OK
+            && curl_easy_setopt(sender->curl, CURLOPT_SEEKFUNCTION, rewind_body) == CURLE_OK
             && curl_easy_setopt(sender->curl, CURLOPT_WRITEFUNCTION, callback) == CURLE_OK) - 1;
 }
 
@@ -51,25 +147,152 @@ int sender_fini() {
     curl_easy_cleanup(sender[METRIC].curl);
     curl_easy_cleanup(sender[REGISTER].curl);
     curl_easy_cleanup(sender[ALERT].curl);
-	curl_slist_free_all(header);
+    for(int f=0; f<2; f++)
+        for(int c=0; c<2; c++)
+            curl_slist_free_all(header[f][c]);
+    for(int i=0; i<3; i++) {
+        wire_fini(&sender[i].wire);
+        encoding_fini(&sender[i].encoding);
+        free(sender[i].body.iov);
+        memset(&sender[i].body, 0, sizeof(sender_body_t));
+    }
+    free(dictionary);
+    return 0;
+}
+
+sender_format sender_format_of(int type) {
+    return sender[type].format;
+}
+
+int sender_batch_of(int type) {
+    return type == METRIC && sender[type].format == JSON ? batch : 1;
+}
+
+int sender_schema_of(int type) {
+    return type == METRIC && sender[type].format == JSON && schema;
+}
+
+/*
+ * Pieces of a body point into their packets, which stay put while posted
+ */
+static int body_add(sender_body_t *b, const void *buf, size_t len) {
+    if(!len) return 0;
+    if(b->n == b->cap) {
+        int cap = b->cap ? b->cap*2 : SENDER_IOV;
+        struct iovec *iov = realloc(b->iov, cap*sizeof(struct iovec));
+        if(!iov) return -1;
+        b->iov = iov;
+        b->cap = cap;
+    }
+    b->iov[b->n].iov_base = (void *)buf;
+    b->iov[b->n].iov_len = len;
+    b->n++;
+    b->size += len;
+    return 0;
+}
+
+static int body_packet(sender_body_t *b, packet_t *pkt) {
+    for(packet_seg_t *seg=pkt->head; seg; seg=seg->next)
+        if(body_add(b, seg->data, seg->size) < 0)
+            return -1;
     return 0;
 }
 
 int post(packet_t *pkt) {
-    pkt->attempt++;
-    char *payload = packet_fetch(pkt);
-    if(!payload) return -1;
-    printf("%s\n", payload);
-
-    while(!__sync_bool_compare_and_swap(&sender[pkt->type].spin, 0, 1));
-	curl_easy_setopt(sender[pkt->type].curl, CURLOPT_POSTFIELDS, payload);
-    curl_easy_setopt(sender[pkt->type].curl, CURLOPT_WRITEDATA, pkt);
-	CURLcode curl_code = curl_easy_perform(sender[pkt->type].curl);
+    return post_batch(&pkt, 1);
+}
+
+int post_batch(packet_t **pkts, int n) {
+    if(n < 1 || n > SENDER_BATCH)
+        return -1;
+
+    int type = pkts[0]->type;
+    packet_reader_t reader;
+    for(int i=0; i<n; i++) {
+        pkts[i]->attempt++;
+        if(pkts[i]->type != type || packet_fetch(pkts[i], &reader) < 0)
+            return -1;
+        DEBUG(packet_print(pkts[i], stdout); printf("\n"));
+    }
+
+    while(!__sync_bool_compare_and_swap(&sender[type].spin, 0, 1));
+    sender_t *s = &sender[type];
+    sender_body_t *b = &s->body;
+    int binary = n == 1 && s->format == BINARY && wire_encode(&s->wire, pkts[0]) == 0;
+
+    // JSON goes as the segments of its packets, batches between [ , ]
+    b->n = b->i = 0;
+    b->size = b->offset = 0;
+    int error = 0;
+    if(!binary) {
+        error = n > 1 && body_add(b, "[", 1) < 0;
+        for(int i=0; i<n && !error; i++)
+            error = (i && body_add(b, ",", 1) < 0) || body_packet(b, pkts[i]) < 0;
+        if(n > 1 && !error)
+            error = body_add(b, "]", 1) < 0;
+    }
+    if(error) {
+        s->spin = 0;
+        return -1;
+    }
+
+    int compressed = s->encoding.type != IDENTITY
+        && (binary ? encoding_buffer(&s->encoding, s->wire.data, s->wire.size) : encoding_iov(&s->encoding, b->iov, b->n)) == 0;
+    curl_easy_setopt(s->curl, CURLOPT_HTTPHEADER, header[binary][compressed]);
+    if(compressed) {
+        curl_easy_setopt(s->curl, CURLOPT_POSTFIELDS, s->encoding.data);
+        curl_easy_setopt(s->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)s->encoding.size);
+    } else if(binary) {
+        curl_easy_setopt(s->curl, CURLOPT_POSTFIELDS, s->wire.data);
+        curl_easy_setopt(s->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)s->wire.size);
+    } else {
+        curl_easy_setopt(s->curl, CURLOPT_POSTFIELDS, NULL);
+        curl_easy_setopt(s->curl, CURLOPT_READDATA, b);
+        curl_easy_setopt(s->curl, CURLOPT_SEEKDATA, b);
+        curl_easy_setopt(s->curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)b->size);
+    }
+    curl_easy_setopt(s->curl, CURLOPT_WRITEDATA, pkts[0]);
+	CURLcode curl_code = curl_easy_perform(s->curl);
     long status_code;
-	curl_easy_getinfo(sender[pkt->type].curl, CURLINFO_RESPONSE_CODE, &status_code);
-    sender[pkt->type].spin = 0;
+	curl_easy_getinfo(s->curl, CURLINFO_RESPONSE_CODE, &status_code);
+    s->spin = 0;
+
+    for(int i=1; i<n; i++)
+        pkts[i]->response = pkts[0]->response;
 
-	return (curl_code==CURLE_OK && (status_code==202 || status_code==200)) - 1;
+    return (curl_code==CURLE_OK && (status_code==202 || status_code==200)) - 1;
+}
+
+/*
+ * Copies the pieces into curl's upload buffer, the only copy of a body
+ */
+size_t stream(char *ptr, size_t size, size_t nmemb, void *_body) {
+    sender_body_t *b = _body;
+    size_t len = size*nmemb, n = 0;
+    while(b->i < b->n && n < len) {
+        const struct iovec *v = &b->iov[b->i];
+        size_t c = v->iov_len-b->offset < len-n ? v->iov_len-b->offset : len-n;
+        memcpy(ptr+n, (char *)v->iov_base+b->offset, c);
+        b->offset += c;
+        n += c;
+        if(b->offset == v->iov_len) {
+            b->i++;
+            b->offset = 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * Back to the start, when curl sends the body again on a new connection
+ */
+int rewind_body(void *_body, curl_off_t offset, int origin) {
+    sender_body_t *b = _body;
+    if(origin != SEEK_SET || offset != 0)
+        return CURL_SEEKFUNC_CANTSEEK;
+    b->i = 0;
+    b->offset = 0;
+    return CURL_SEEKFUNC_OK;
 }
 
 size_t callback(char *ptr, size_t size, size_t nmemb, void *_pkt) {
@@ -10,6 +10,8 @@
 #include "plugin.h"
 #include "util.h"
 
+#define SPARSE_ARGS 32  // Target and option lines of a plugin
+
 int skip_until(FILE *conf, const char c) {
     void *err = NULL;
     char line[BFSZ];
@@ -43,7 +45,7 @@ int sparse(const char *filename, plugin_t **plugins) {
     char type[BFSZ];
     char dlname[BFSZ], smname[BFSZ], cmpname[BFSZ];
     int argc = 0;
-    char argv[10][BFSZ];
+    char argv[SPARSE_ARGS][BFSZ];
     void *dl;
     int (*load)(plugin_t *, int, char**) = 0;
     int (*cmp)(void *, void *) = 0;
@@ -101,6 +103,8 @@ int sparse(const char *filename, plugin_t **plugins) {
                     fclose(conf);
                     return -1;
                 }
+            } else if((status == NAME || status == VAL) && argc == SPARSE_ARGS) {
+                zlog_error(tag, "Too many lines for %s, %s is ignored", type, remain);
             } else if(status == NAME) {
                 snprintf(argv[argc++], BFSZ, "%s", remain);
                 status = VAL;
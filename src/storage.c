@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include <zlog.h>
 
@@ -16,10 +17,47 @@
 #include "unsent.h"
 
 #define STORAGE_TICK 21
+#define STORAGE_CONF "/etc/maxgaugeair/storage.conf"
+#define STORAGE_MEMORY 64     // MB of queued metric payload
+#define STORAGE_SPARE  64     // Spare packets kept per type
+
+enum storage_overflow {DROP, SUMMARY};
 
 int storage_main(void *_st);
 
-static packet_t *packets;
+/* Send queue, oldest first. Plugins append, only storage_main unlinks. */
+static packet_t *packets, *last;
+static int spin;
+
+/* Emptied packets per type, kept for reuse */
+static packet_t *spare[3];
+static int nspare[3];
+
+static size_t memory = (size_t)STORAGE_MEMORY*1024*1024;
+static enum storage_overflow overflow = DROP;
+
+/* Text of a packet being thinned */
+static char *text;
+static size_t tcap;
+
+/*
+ * Lines of "memory=" in MB and "overflow=" drop or summary
+ */
+static void storage_conf(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if(!fp) return;
+
+    char line[BFSZ], key[BFSZ], value[BFSZ];
+    while(fgets(line, BFSZ, fp)) {
+        if(line[0] == '#' || sscanf(line, " %127[^= ] = %127s", key, value) != 2)
+            continue;
+        if(!strcmp(key, "memory") && atol(value) > 0)
+            memory = (size_t)atol(value)*1024*1024;
+        else if(!strcmp(key, "overflow"))
+            overflow = !strcmp(value, "summary") ? SUMMARY : DROP;
+    }
+    fclose(fp);
+}
 
 int storage_init(routine_t *st) {
 	if(routine_init(st) < 0) return -1;
@@ -28,9 +66,10 @@ int storage_init(routine_t *st) {
     if(sender_init() < 0)
         zlog_error(st->tag, "Fail to init sender");
     unsent_init();
+    storage_conf(STORAGE_CONF);
+
+    packets = last = NULL;
 
-    packets = NULL;
-    
 	st->delay = 1;
 
 	st->tick = STORAGE_TICK;
@@ -45,70 +84,243 @@ int storage_fini(routine_t *st) {
         packets = packets->next;
         packet_free(pkt);
     }
+    last = NULL;
+    for(int t=0; t<3; t++) {
+        while(spare[t]) {
+            packet_t *pkt = spare[t];
+            spare[t] = pkt->next;
+            packet_free(pkt);
+        }
+        nspare[t] = 0;
+    }
+    free(text);
+    text = NULL;
+    tcap = 0;
     sender_fini();
 	routine_fini(st);
     return 0;
 }
 
 packet_t *get_packet(enum packet_type type) {
-    for(packet_t *pkt=packets; pkt; pkt=pkt->next) {
-        if(packet_change_state(pkt, DONE, EMPTY) == 0) {
-            pkt->type = type;
-            pkt->response = 0;
-            pkt->size = 0;
-            pkt->attempt = 0;
-            pkt->spin = 0;
-            return pkt;
-        }
-    }
+    if(type < 0 || type >= 3)
+        return NULL;
 
-    packet_t *pkt = packet_alloc(type);
-    
-    while(!packets) {
-        if(__sync_bool_compare_and_swap(&packets, 0, pkt))
-            return pkt;
+    while(!__sync_bool_compare_and_swap(&spin, 0, 1));
+    packet_t *pkt = spare[type];
+    if(pkt) {
+        spare[type] = pkt->next;
+        nspare[type]--;
     }
+    spin = 0;
+
+    if(!pkt && !(pkt = packet_alloc(type)))
+        return NULL;
+    pkt->state = EMPTY;
+    pkt->response = 0;
+    pkt->attempt = 0;
+    pkt->spin = 0;
+    pkt->next = NULL;
 
-    int *head_lock = &packets->spin;
-    while(!__sync_bool_compare_and_swap(head_lock, 0, 1));
-    pkt->next = packets;
-    packets = pkt;
-    *head_lock = 0;
+    if(type == METRIC) {
+        while(!__sync_bool_compare_and_swap(&spin, 0, 1));
+        if(last)
+            last->next = pkt;
+        else
+            packets = pkt;
+        last = pkt;
+        spin = 0;
+    }
 
     return pkt;
 }
 
-int storage_main(void *_st) {
-	routine_t *st = _st;
+void put_packet(packet_t *pkt) {
+    if(!pkt) return;
 
-    for(packet_t *pkt=packets; pkt; pkt=pkt->next) {
-        DEBUG(zlog_debug(st->tag, "-> %llx(%d)", (unsigned long long)pkt%0x10000, pkt->state));
-        if(pkt->state == READY) {
-            DEBUG(zlog_debug(st->tag, "%04llx: POST %.1fkB", (unsigned long long)pkt%0x10000, (float)pkt->size/BPKB));
-            if(post(pkt) < 0) {
-                DEBUG(zlog_debug(st->tag, "Fails (%d)", pkt->response));
-                st->delay = (st->delay << 1) | !(st->delay << 1);
-                if(pkt->type == METRIC && pkt->attempt >= 3) {
-                    // TODO unsent_store(pkt);
+    packet_reset(pkt);
+    pkt->state = FREE;
+
+    while(!__sync_bool_compare_and_swap(&spin, 0, 1));
+    if(nspare[pkt->type] < STORAGE_SPARE) {
+        pkt->next = spare[pkt->type];
+        spare[pkt->type] = pkt;
+        nspare[pkt->type]++;
+        pkt = NULL;
+    }
+    spin = 0;
+
+    packet_free(pkt);
+}
+
+/*
+ * Take 'pkt' that follows 'prev' out of the queue
+ */
+static void storage_unlink(packet_t *prev, packet_t *pkt) {
+    while(!__sync_bool_compare_and_swap(&spin, 0, 1));
+    if(prev)
+        prev->next = pkt->next;
+    else
+        packets = pkt->next;
+    if(last == pkt)
+        last = prev;
+    spin = 0;
+}
+
+/*
+ * Keep every other sample of a ready metric packet, counted back from the
+ * latest. Returns the samples kept, 0 if it holds one or none, -1 on error.
+ */
+static int storage_thin(packet_t *pkt) {
+    if(tcap < (size_t)pkt->size+1) {
+        char *t = realloc(text, pkt->size+1);
+        if(!t) return -1;
+        text = t;
+        tcap = pkt->size+1;
+    }
+    packet_reader_t r = {pkt->head, 0};
+    int size = packet_read(&r, text, pkt->size);
+    text[size] = 0;
+
+    char *p = strstr(text, "\"metrics\":[");
+    if(!p) return -1;
+    p += strlen("\"metrics\":[");
+    int head = p - text;
+
+    // First pass counts the samples, the second writes those kept
+    int n = 0, kept = 0;
+    for(int pass=0; pass<2; pass++) {
+        int depth = 0, quoted = 0, i = 0;
+        char *start = text+head;
+        for(p=start; p<text+size; p++) {
+            if(quoted) {
+                if(*p == '\\') p++;
+                else if(*p == '"') quoted = 0;
+                continue;
+            }
+            if(*p == '"') {
+                quoted = 1;
+            } else if(*p == '{' || *p == '[') {
+                depth++;
+            } else if((*p == '}' || *p == ']') && depth > 0) {
+                depth--;
+            } else if((*p == ',' || *p == ']') && depth == 0) {
+                if(p > start && pass == 1 && (n-1-i)%2 == 0) {
+                    if(kept++) packet_write(pkt, ",", 1);
+                    packet_write(pkt, start, p-start);
                 }
-                return -1;
-            } else {
-                DEBUG(zlog_debug(st->tag, "Success"));
-                st->delay = 1;
-                // TODO unsent_send();
+                if(p > start) i++;
+                if(*p == ']') break;
+                start = p+1;
             }
-            pkt->state = DONE;
-            st->tick = STORAGE_TICK * st->delay;
         }
+        if(p >= text+size || depth || quoted)
+            return -1;
 
-        //packet_change_state(pkt, DONE, FREE);
+        if(pass == 0) {
+            n = i;
+            if(n < 2) return 0;
+            packet_reset(pkt);
+            packet_write(pkt, text, head);
+        } else {
+            packet_write(pkt, p, text+size-p);
+        }
     }
 
-    /*for(packet_t *prev=0, *pkt=packets; pkt; ) {
-        if(pkt->state == FREE) {
-        } else {
+    return pkt->broken ? -1 : kept;
+}
+
+/*
+ * Ready metric packets make room, oldest first, until 'held' bytes fit
+ */
+static void storage_overflow(routine_t *st, size_t held) {
+    size_t before = held;
+    int dropped = 0, thinned = 0;
+
+    // A summary pass halves each packet once, so the oldest do not go first
+    for(int progress=1; held > memory && progress; ) {
+        progress = 0;
+        for(packet_t *prev=NULL, *pkt=packets, *next; pkt && held > memory; pkt=next) {
+            next = pkt->next;
+            if(pkt->type != METRIC || pkt->state != READY) {
+                prev = pkt;
+                continue;
+            }
+
+            size_t size = pkt->size;
+            if(overflow == SUMMARY && storage_thin(pkt) > 0) {
+                held -= size - pkt->size;
+                thinned++;
+                prev = pkt;
+            } else {
+                storage_unlink(prev, pkt);
+                put_packet(pkt);
+                held -= sizeof(packet_t) + size;
+                dropped++;
+            }
+            progress = 1;
+        }
+    }
+
+    zlog_warn(st->tag, "Queue over %zukB: %zukB -> %zukB, %d dropped, %d thinned",
+            memory/BPKB, before/BPKB, held/BPKB, dropped, thinned);
+}
+
+/*
+ * One request of ready packets, done if it succeeds
+ */
+static int storage_post(routine_t *st, packet_t **pkts, int n) {
+    DEBUG(zlog_debug(st->tag, "%04llx: POST %d packets", (unsigned long long)pkts[0]%0x10000, n));
+    if(post_batch(pkts, n) < 0) {
+        DEBUG(zlog_debug(st->tag, "Fails (%d)", pkts[0]->response));
+        st->delay = (st->delay << 1) | !(st->delay << 1);
+        for(int i=0; i<n; i++) {
+            if(pkts[i]->type == METRIC && pkts[i]->attempt >= 3) {
+                // TODO unsent_store(pkt);
+            }
         }
-    }*/
+        return -1;
+    }
 
+    DEBUG(zlog_debug(st->tag, "Success"));
+    st->delay = 1;
+    // TODO unsent_send();
+    for(int i=0; i<n; i++)
+        pkts[i]->state = DONE;
+    st->tick = STORAGE_TICK * st->delay;
     return 0;
 }
+
+int storage_main(void *_st) {
+	routine_t *st = _st;
+    int error = 0;
+    size_t held = 0;
+
+    // Ready packets go in order, a batch per request. After a failure the rest wait for the next tick.
+    packet_t *pkts[SENDER_BATCH];
+    int batch = sender_batch_of(METRIC), n = 0;
+    for(packet_t *pkt=packets; pkt && !error; pkt=pkt->next) {
+        DEBUG(zlog_debug(st->tag, "-> %llx(%d)", (unsigned long long)pkt%0x10000, pkt->state));
+        if(pkt->state == READY)
+            pkts[n++] = pkt;
+        if(n && (n == batch || !pkt->next)) {
+            error = storage_post(st, pkts, n);
+            n = 0;
+        }
+    }
+
+    for(packet_t *prev=NULL, *pkt=packets, *next; pkt; pkt=next) {
+        next = pkt->next;
+        if(pkt->state == DONE) {
+            storage_unlink(prev, pkt);
+            put_packet(pkt);
+            continue;
+        }
+        held += sizeof(packet_t) + pkt->size;
+        prev = pkt;
+    }
+
+    if(held > memory)
+        storage_overflow(st, held);
+
+    return error;
+}
@@ -0,0 +1,794 @@
+/**
+ * @file wire.c
+ * @author Snyo
+ */
+#include "wire.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#define WIRE_MIN    1024
+#define WIRE_DIGITS 18      // Digits of a number that always fit in 63 bits
+
+struct wire_string_t {
+    unsigned long long hash;
+    unsigned int offset;    // Into the text, where it was unescaped
+    unsigned int len;
+    unsigned int index;
+};
+
+/*
+ * A value of the packet, its children follow it up to 'end'
+ */
+struct wire_node_t {
+    unsigned char type;     // WIRE_NULL to WIRE_NUMBER, WIRE_ARRAY or WIRE_OBJECT
+    unsigned char scale;
+    unsigned char numbers;  // An array of integers and decimals only
+    unsigned int end;
+    unsigned int count;
+    unsigned int key, klen; // Offset into the text of its key in an object
+    unsigned int offset, len;
+    unsigned long long hash;
+    long long mant;
+};
+
+static const long long wire_pow10[WIRE_DIGITS+1] = {
+    1LL, 10LL, 100LL, 1000LL, 10000LL, 100000LL, 1000000LL, 10000000LL, 100000000LL,
+    1000000000LL, 10000000000LL, 100000000000LL, 1000000000000LL, 10000000000000LL,
+    100000000000000LL, 1000000000000000LL, 10000000000000000LL, 100000000000000000LL,
+    1000000000000000000LL
+};
+
+static unsigned long long wire_hash(const char *s, size_t len, unsigned long long hash) {
+    for(size_t i=0; i<len; i++)
+        hash = (hash ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    return hash;
+}
+
+void wire_init(wire_t *w) {
+    memset(w, 0, sizeof(wire_t));
+    w->series = 1;
+}
+
+void wire_fini(wire_t *w) {
+    free(w->data);
+    free(w->text);
+    free(w->slot);
+    free(w->schema);
+    free(w->node);
+    free(w->col);
+    free(w->mant);
+    memset(w, 0, sizeof(wire_t));
+}
+
+/*
+ * Output
+ */
+static int wire_room(wire_t *w, size_t n) {
+    if(w->size+n <= w->cap)
+        return 0;
+    size_t cap = w->cap ? w->cap : WIRE_MIN;
+    while(cap < w->size+n) cap *= 2;
+    unsigned char *data = realloc(w->data, cap);
+    if(!data) return -1;
+    w->data = data;
+    w->cap = cap;
+    return 0;
+}
+
+static inline int wire_varint_to(unsigned char *out, unsigned long long v) {
+    int n = 0;
+    while(v >= 0x80) {
+        out[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    out[n++] = v;
+    return n;
+}
+
+static inline unsigned long long wire_zigzag(long long v) {
+    return ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static int wire_byte(wire_t *w, unsigned char b) {
+    if(wire_room(w, 1) < 0) return -1;
+    w->data[w->size++] = b;
+    return 0;
+}
+
+static int wire_varint(wire_t *w, unsigned long long v) {
+    if(wire_room(w, 10) < 0) return -1;
+    w->size += wire_varint_to(w->data+w->size, v);
+    return 0;
+}
+
+static int wire_bytes(wire_t *w, const void *buf, size_t len) {
+    if(wire_varint(w, len) < 0 || wire_room(w, len) < 0) return -1;
+    memcpy(w->data+w->size, buf, len);
+    w->size += len;
+    return 0;
+}
+
+/*
+ * Strings, each sent once per packet
+ */
+static int wire_grow_strings(wire_t *w) {
+    unsigned int cap = w->scap ? w->scap*2 : WIRE_MIN;
+    wire_string_t *slot = calloc(cap, sizeof(wire_string_t));
+    if(!slot) return -1;
+    for(unsigned int i=0; i<w->scap; i++) {
+        if(!w->slot[i].hash) continue;
+        unsigned int j = w->slot[i].hash & (cap-1);
+        while(slot[j].hash) j = (j+1) & (cap-1);
+        slot[j] = w->slot[i];
+    }
+    free(w->slot);
+    w->slot = slot;
+    w->scap = cap;
+    return 0;
+}
+
+static int wire_string(wire_t *w, const char *s, size_t len) {
+    if((w->nstrings+1)*4 >= w->scap*3 && wire_grow_strings(w) < 0)
+        return -1;
+
+    unsigned long long hash = wire_hash(s, len, 0xcbf29ce484222325ULL) | 1;
+    unsigned int i = hash & (w->scap-1);
+    for(; w->slot[i].hash; i=(i+1)&(w->scap-1)) {
+        wire_string_t *e = &w->slot[i];
+        if(e->hash == hash && e->len == len && !memcmp(w->text+e->offset, s, len))
+            return wire_byte(w, WIRE_STRREF) < 0 || wire_varint(w, e->index) < 0 ? -1 : 0;
+    }
+    w->slot[i].hash = hash;
+    w->slot[i].offset = s - w->text;
+    w->slot[i].len = len;
+    w->slot[i].index = w->nstrings++;
+    return wire_byte(w, WIRE_STR) < 0 || wire_bytes(w, s, len) < 0 ? -1 : 0;
+}
+
+/*
+ * Schemas, each defined once per packet. Two key lists may share an id,
+ * the later is then defined again and replaces the earlier.
+ */
+static int wire_schema_seen(wire_t *w, unsigned long long hash) {
+    if((w->nschemas+1)*2 >= w->ncap) {
+        unsigned int cap = w->ncap ? w->ncap*2 : 64;
+        unsigned int *schema = calloc(cap, sizeof(unsigned int)*2);
+        if(!schema) return -1;
+        for(unsigned int i=0; i<w->ncap; i++) {
+            if(!w->schema[i*2]) continue;
+            unsigned int j = w->schema[i*2] & (cap-1);
+            while(schema[j*2]) j = (j+1) & (cap-1);
+            schema[j*2] = w->schema[i*2];
+            schema[j*2+1] = w->schema[i*2+1];
+        }
+        free(w->schema);
+        w->schema = schema;
+        w->ncap = cap;
+    }
+
+    unsigned int id = hash, check = hash >> 32;
+    unsigned int i = id & (w->ncap-1);
+    for(; w->schema[i*2]; i=(i+1)&(w->ncap-1)) {
+        if(w->schema[i*2] != id)
+            continue;
+        int seen = w->schema[i*2+1] == check;
+        w->schema[i*2+1] = check;
+        return seen;
+    }
+    w->schema[i*2] = id;
+    w->schema[i*2+1] = check;
+    w->nschemas++;
+    return 0;
+}
+
+/*
+ * Input
+ */
+static inline const char *wire_ws(const char *p, const char *end) {
+    while(p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        p++;
+    return p;
+}
+
+/*
+ * A JSON string unescaped where it is, returns its end
+ */
+static const char *wire_unescape(const char *p, const char *end, char **out, size_t *len) {
+    char *dst = (char *)++p, *start = dst;
+    while(p < end && *p != '"') {
+        if(*p != '\\') {
+            *dst++ = *p++;
+            continue;
+        }
+        if(++p >= end) return NULL;
+        switch(*p++) {
+            case 'n': *dst++ = '\n'; break;
+            case 'r': *dst++ = '\r'; break;
+            case 't': *dst++ = '\t'; break;
+            case 'b': *dst++ = '\b'; break;
+            case 'f': *dst++ = '\f'; break;
+            case 'u': {
+                if(end-p < 4) return NULL;
+                unsigned int c = strtoul((char[5]){p[0], p[1], p[2], p[3], 0}, NULL, 16);
+                p += 4;
+                if(c < 0x80) {
+                    *dst++ = c;
+                } else if(c < 0x800) {
+                    *dst++ = 0xc0 | c >> 6;
+                    *dst++ = 0x80 | (c & 0x3f);
+                } else {
+                    *dst++ = 0xe0 | c >> 12;
+                    *dst++ = 0x80 | ((c >> 6) & 0x3f);
+                    *dst++ = 0x80 | (c & 0x3f);
+                }
+                break;
+            }
+            default: *dst++ = p[-1]; break;
+        }
+    }
+    if(p >= end) return NULL;
+    *out = start;
+    *len = dst - start;
+    return p+1;
+}
+
+/*
+ * A number as a mantissa and a scale, returns its end. 'raw' is set when
+ * it has an exponent or too many digits.
+ */
+static const char *wire_number(const char *p, const char *end, long long *mant, int *scale, int *raw) {
+    int neg = p < end && *p == '-';
+    if(neg) p++;
+    unsigned long long m = 0;
+    int digits = 0, frac = -1;
+    for(; p < end; p++) {
+        if(*p >= '0' && *p <= '9') {
+            m = m*10 + (*p - '0');
+            digits++;
+            if(frac >= 0) frac++;
+        } else if(*p == '.' && frac < 0) {
+            frac = 0;
+        } else {
+            break;
+        }
+    }
+    *raw = digits == 0 || digits > WIRE_DIGITS || frac == 0;
+    if(p < end && (*p == 'e' || *p == 'E')) {
+        *raw = 1;
+        for(p++; p < end && ((*p >= '0' && *p <= '9') || *p == '+' || *p == '-'); p++);
+    }
+    *mant = neg ? -(long long)m : (long long)m;
+    *scale = frac < 0 ? 0 : frac;
+    return p;
+}
+
+/*
+ * Parse a value and its children into w->node, returns its end
+ */
+static const char *wire_parse(wire_t *w, const char *p, const char *end, const char *key, int klen) {
+    p = wire_ws(p, end);
+    if(p >= end) return NULL;
+
+    if(w->nnodes == w->nodecap) {
+        unsigned int cap = w->nodecap ? w->nodecap*2 : WIRE_MIN;
+        wire_node_t *node = realloc(w->node, cap*sizeof(wire_node_t));
+        if(!node) return NULL;
+        w->node = node;
+        w->nodecap = cap;
+    }
+    unsigned int i = w->nnodes++;
+    wire_node_t *n = &w->node[i];
+    memset(n, 0, sizeof(wire_node_t));
+    if(key) {
+        n->key = key - w->text;
+        n->klen = klen;
+    }
+
+    switch(*p) {
+        case '{': {
+            unsigned long long hash = 0xcbf29ce484222325ULL;
+            unsigned int count = 0;
+            p = wire_ws(p+1, end);
+            if(p < end && *p == '}')
+                p++;
+            else while(p) {
+                if(p >= end || *p != '"') return NULL;
+                const char *k = ++p;
+                while(p < end && *p != '"') p += *p == '\\' ? 2 : 1;
+                if(p >= end) return NULL;
+                hash = wire_hash(k, p-k+1, hash);
+                int len = p - k;
+
+                p = wire_ws(p+1, end);
+                if(p >= end || *p != ':') return NULL;
+                if(!(p = wire_parse(w, p+1, end, k, len))) return NULL;
+                count++;
+                p = wire_ws(p, end);
+                if(p < end && *p == ',') {
+                    p = wire_ws(p+1, end);
+                } else if(p < end && *p == '}') {
+                    p++;
+                    break;
+                } else {
+                    return NULL;
+                }
+            }
+            if(!p) return NULL;
+            n = &w->node[i];
+            n->type = WIRE_OBJECT;
+            n->hash = hash;
+            n->count = count;
+            break;
+        }
+
+        case '[': {
+            unsigned int count = 0;
+            int numbers = 1;
+            p = wire_ws(p+1, end);
+            while(p < end && *p != ']') {
+                unsigned int c = w->nnodes;
+                if(!(p = wire_parse(w, p, end, NULL, 0))) return NULL;
+                numbers &= w->node[c].type == WIRE_INT || w->node[c].type == WIRE_FIXED;
+                count++;
+                p = wire_ws(p, end);
+                if(p < end && *p == ',')
+                    p = wire_ws(p+1, end);
+                else if(p >= end || *p != ']')
+                    return NULL;
+            }
+            if(p >= end) return NULL;
+            p++;
+            n = &w->node[i];
+            n->type = WIRE_ARRAY;
+            n->count = count;
+            n->numbers = numbers && count;
+            break;
+        }
+
+        case '"': {
+            char *s;
+            size_t len;
+            if(!(p = wire_unescape(p, end, &s, &len)))
+                return NULL;
+            n->type = WIRE_STR;
+            n->offset = s - w->text;
+            n->len = len;
+            break;
+        }
+
+        case 't':
+        if(end-p < 4 || memcmp(p, "true", 4)) return NULL;
+        n->type = WIRE_TRUE;
+        p += 4;
+        break;
+
+        case 'f':
+        if(end-p < 5 || memcmp(p, "false", 5)) return NULL;
+        n->type = WIRE_FALSE;
+        p += 5;
+        break;
+
+        case 'n':
+        if(end-p < 4 || memcmp(p, "null", 4)) return NULL;
+        n->type = WIRE_NULL;
+        p += 4;
+        break;
+
+        default: {
+            int scale, raw;
+            const char *start = p;
+            p = wire_number(p, end, &n->mant, &scale, &raw);
+            if(p == start) return NULL;
+            n->type = raw ? WIRE_NUMBER : scale ? WIRE_FIXED : WIRE_INT;
+            n->scale = scale;
+            n->offset = start - w->text;
+            n->len = p - start;
+            break;
+        }
+    }
+
+    w->node[i].end = w->nnodes;
+    return p;
+}
+
+#define WIRE_EACH(w, c, i) for(unsigned int c=(i)+1; c<(w)->node[i].end; c=(w)->node[c].end)
+
+/*
+ * Header of an object, with its keys the first time
+ */
+static int wire_header(wire_t *w, unsigned int i) {
+    wire_node_t *n = &w->node[i];
+    int seen = wire_schema_seen(w, n->hash);
+    if(seen < 0
+            || wire_byte(w, seen ? WIRE_OBJECT : WIRE_SCHEMA) < 0
+            || wire_varint(w, (unsigned int)n->hash) < 0)
+        return -1;
+    if(seen)
+        return 0;
+
+    if(wire_varint(w, n->count) < 0)
+        return -1;
+    WIRE_EACH(w, c, i)
+        if(wire_bytes(w, w->text+w->node[c].key, w->node[c].klen) < 0)
+            return -1;
+    return 0;
+}
+
+/*
+ * Room for n more values of columns
+ */
+static int wire_cols(wire_t *w, unsigned int n) {
+    if(w->ncols+n <= w->colcap)
+        return 0;
+    unsigned int cap = w->colcap ? w->colcap : WIRE_MIN;
+    while(cap < w->ncols+n) cap *= 2;
+    unsigned int *col = realloc(w->col, cap*sizeof(unsigned int));
+    if(!col) return -1;
+    w->col = col;
+    w->colcap = cap;
+    return 0;
+}
+
+/*
+ * Mantissas of the numbers 'idx' brought to the largest scale into
+ * w->mant, returns the scale or -1 when one would overflow
+ */
+static int wire_scale(wire_t *w, const unsigned int *idx, unsigned int n) {
+    if(n > w->mcap) {
+        long long *mant = realloc(w->mant, n*sizeof(long long));
+        if(!mant) return -1;
+        w->mant = mant;
+        w->mcap = n;
+    }
+
+    int max = 0;
+    for(unsigned int j=0; j<n; j++)
+        if(w->node[idx[j]].scale > max) max = w->node[idx[j]].scale;
+
+    for(unsigned int j=0; j<n; j++) {
+        wire_node_t *v = &w->node[idx[j]];
+        long long m = v->mant;
+        int up = max - v->scale;
+        if(up) {
+            if(m > 0 ? m > (long long)(0x7fffffffffffffffLL / wire_pow10[up]) : m < -(long long)(0x7fffffffffffffffLL / wire_pow10[up]))
+                return -1;
+            m *= wire_pow10[up];
+        }
+        w->mant[j] = m;
+    }
+    return max;
+}
+
+/*
+ * Arrays of numbers only are sent as a column of deltas
+ */
+static int wire_numbers(wire_t *w, unsigned int i) {
+    wire_node_t *a = &w->node[i];
+    unsigned int n = a->count, base = w->ncols;
+    if(wire_cols(w, n) < 0)
+        return -1;
+    WIRE_EACH(w, c, i)
+        w->col[w->ncols++] = c;
+    int scale = wire_scale(w, w->col+base, n);
+    w->ncols = base;
+    if(scale < 0 || wire_room(w, 2 + 10 + n*10) < 0)
+        return 1;
+
+    unsigned char *out = w->data + w->size;
+    if(scale) {
+        *out++ = WIRE_FIXEDS;
+        *out++ = scale;
+    } else {
+        *out++ = WIRE_INTS;
+    }
+    out += wire_varint_to(out, n);
+    unsigned long long prev = 0;
+    for(unsigned int j=0; j<n; j++) {
+        out += wire_varint_to(out, wire_zigzag((long long)((unsigned long long)w->mant[j] - prev)));
+        prev = w->mant[j];
+    }
+    w->size = out - w->data;
+    return 0;
+}
+
+/*
+ * Bits from the most significant, up to 32 at a time
+ */
+typedef struct wire_bits_t {
+    unsigned char *out;
+    unsigned long long acc;
+    int n;
+} wire_bits_t;
+
+static inline void wire_put(wire_bits_t *b, unsigned long long v, int bits) {
+    b->acc = (b->acc << bits) | (v & ((1ULL << bits) - 1));
+    b->n += bits;
+    while(b->n >= 8) {
+        b->n -= 8;
+        *b->out++ = b->acc >> b->n;
+    }
+}
+
+static inline void wire_put64(wire_bits_t *b, unsigned long long v) {
+    wire_put(b, v >> 32, 32);
+    wire_put(b, v, 32);
+}
+
+static inline void wire_flush(wire_bits_t *b) {
+    if(b->n)
+        *b->out++ = b->acc << (8 - b->n);
+    b->n = 0;
+}
+
+/*
+ * Delta of delta, cheap for timestamps and counters growing steadily
+ */
+static void wire_delta(wire_t *w, int scale, unsigned int n) {
+    unsigned char *out = w->data + w->size;
+    *out++ = WIRE_DELTA;
+    *out++ = scale;
+    out += wire_varint_to(out, wire_zigzag(w->mant[0]));
+
+    wire_bits_t b = {out, 0, 0};
+    unsigned long long delta = 0;
+    for(unsigned int j=1; j<n; j++) {
+        unsigned long long d = (unsigned long long)w->mant[j] - (unsigned long long)w->mant[j-1];
+        unsigned long long z = wire_zigzag((long long)(d - delta));
+        delta = d;
+        if(z == 0)                wire_put(&b, 0, 1);
+        else if(z < 1ULL << 7)  { wire_put(&b, 0x2, 2);  wire_put(&b, z, 7); }
+        else if(z < 1ULL << 9)  { wire_put(&b, 0x6, 3);  wire_put(&b, z, 9); }
+        else if(z < 1ULL << 12) { wire_put(&b, 0xe, 4);  wire_put(&b, z, 12); }
+        else if(z < 1ULL << 32) { wire_put(&b, 0x1e, 5); wire_put(&b, z, 32); }
+        else                    { wire_put(&b, 0x1f, 5); wire_put64(&b, z); }
+    }
+    wire_flush(&b);
+    w->size = b.out - w->data;
+}
+
+/*
+ * XOR of doubles, cheap for gauges that stay the same or move a little.
+ * Returns -1 when a mantissa is not exact as a double.
+ */
+static int wire_xor(wire_t *w, int scale, unsigned int n) {
+    for(unsigned int j=0; j<n; j++)
+        if(w->mant[j] > 1LL << 53 || w->mant[j] < -(1LL << 53))
+            return -1;
+
+    unsigned char *out = w->data + w->size;
+    *out++ = WIRE_XOR;
+    *out++ = scale;
+
+    wire_bits_t b = {out, 0, 0};
+    union { double d; unsigned long long u; } v = {.d = (double)w->mant[0]};
+    unsigned long long prev = v.u;
+    int lead = -1, trail = 0;
+    wire_put64(&b, prev);
+    for(unsigned int j=1; j<n; j++) {
+        v.d = (double)w->mant[j];
+        unsigned long long x = v.u ^ prev;
+        prev = v.u;
+        if(!x) {
+            wire_put(&b, 0, 1);
+            continue;
+        }
+        int l = __builtin_clzll(x), t = __builtin_ctzll(x);
+        if(l > 31) l = 31;
+        if(lead >= 0 && l >= lead && t >= trail) {
+            int bits = 64 - lead - trail;
+            wire_put(&b, 0x2, 2);
+            if(bits > 32) wire_put(&b, x >> (trail+32), bits-32);
+            wire_put(&b, x >> trail, bits > 32 ? 32 : bits);
+        } else {
+            int bits = 64 - l - t;
+            wire_put(&b, 0x3, 2);
+            wire_put(&b, l, 5);
+            wire_put(&b, bits & 63, 6);
+            if(bits > 32) wire_put(&b, x >> (t+32), bits-32);
+            wire_put(&b, x >> t, bits > 32 ? 32 : bits);
+            lead = l;
+            trail = t;
+        }
+    }
+    wire_flush(&b);
+    w->size = b.out - w->data;
+    return 0;
+}
+
+static int wire_value(wire_t *w, unsigned int i);
+
+static int wire_values(wire_t *w, unsigned int base, unsigned int n) {
+    if(wire_byte(w, WIRE_VALUES) < 0)
+        return -1;
+    for(unsigned int j=0; j<n; j++)
+        if(wire_value(w, w->col[base+j]) < 0)
+            return -1;
+    return 0;
+}
+
+/*
+ * A column of the values w->col[base..base+n], one per object of a series
+ */
+static int wire_column(wire_t *w, unsigned int base, unsigned int n) {
+    wire_node_t *first = &w->node[w->col[base]];
+    int numbers = 1, objects = first->type == WIRE_OBJECT, arrays = first->type == WIRE_ARRAY && first->count;
+    for(unsigned int j=0; j<n; j++) {
+        wire_node_t *v = &w->node[w->col[base+j]];
+        numbers &= v->type == WIRE_INT || v->type == WIRE_FIXED;
+        objects &= v->type == WIRE_OBJECT && v->hash == first->hash && v->count == first->count;
+        arrays &= v->type == WIRE_ARRAY && v->numbers && v->count == first->count;
+    }
+
+    int scale;
+    if(numbers && (scale = wire_scale(w, w->col+base, n)) >= 0) {
+        if(wire_room(w, 2*(2 + 10 + 8 + n*10)) < 0)
+            return -1;
+        size_t start = w->size;
+        wire_delta(w, scale, n);
+        size_t delta = w->size - start;
+        if(wire_xor(w, scale, n) == 0 && w->size - start - delta < delta) {
+            memmove(w->data+start, w->data+start+delta, w->size-start-delta);
+            w->size -= delta;
+            w->xor_values += n;
+            w->xor_bytes += w->size - start;
+        } else {
+            w->size = start + delta;
+            w->delta_values += n;
+            w->delta_bytes += delta;
+        }
+        return 0;
+    }
+
+    if(objects || arrays) {
+        unsigned int count = first->count, cur = w->ncols;
+        size_t start = w->size, values = w->delta_values, bytes = w->delta_bytes;
+        size_t xor_values = w->xor_values, xor_bytes = w->xor_bytes;
+        if(objects ? wire_byte(w, WIRE_FIELDS) < 0 || wire_header(w, w->col[base]) < 0
+                   : wire_byte(w, WIRE_ELEMENTS) < 0 || wire_varint(w, count) < 0)
+            return -1;
+
+        // A cursor on each object, stepping over their keys together
+        if(wire_cols(w, n) < 0)
+            return -1;
+        for(unsigned int j=0; j<n; j++)
+            w->col[cur+j] = w->col[base+j]+1;
+        w->ncols += n;
+        for(unsigned int k=0; k<count; k++) {
+            if(wire_column(w, cur, n) < 0)
+                return -1;
+            for(unsigned int j=0; j<n; j++)
+                w->col[cur+j] = w->node[w->col[cur+j]].end;
+        }
+        w->ncols = cur;
+        if(objects)
+            return 0;
+
+        // Positions pay off when arrays change little from row to row,
+        // else each row as a column of its own is shorter
+        size_t elements = w->size - start;
+        if(wire_values(w, base, n) < 0)
+            return -1;
+        if(w->size - start - elements < elements) {
+            memmove(w->data+start, w->data+start+elements, w->size-start-elements);
+            w->size -= elements;
+            w->delta_values = values;
+            w->delta_bytes = bytes;
+            w->xor_values = xor_values;
+            w->xor_bytes = xor_bytes;
+        } else {
+            w->size = start + elements;
+        }
+        return 0;
+    }
+
+    return wire_values(w, base, n);
+}
+
+/*
+ * Arrays of two or more objects sharing keys are sent as a series
+ */
+static int wire_series(wire_t *w, unsigned int i) {
+    wire_node_t *a = &w->node[i];
+    unsigned int n = a->count, first = i+1;
+    if(n < 2 || w->node[first].type != WIRE_OBJECT)
+        return 1;
+    WIRE_EACH(w, c, i)
+        if(w->node[c].type != WIRE_OBJECT || w->node[c].hash != w->node[first].hash || w->node[c].count != w->node[first].count)
+            return 1;
+
+    if(wire_byte(w, WIRE_SERIES) < 0 || wire_header(w, first) < 0 || wire_varint(w, n) < 0)
+        return -1;
+
+    unsigned int base = w->ncols;
+    if(wire_cols(w, n) < 0)
+        return -1;
+    WIRE_EACH(w, c, i)
+        w->col[w->ncols++] = c;
+    for(unsigned int k=0; k<w->node[first].count; k++) {
+        for(unsigned int j=0; j<n; j++)
+            w->col[base+j] = k ? w->node[w->col[base+j]].end : w->col[base+j]+1;
+        if(wire_column(w, base, n) < 0)
+            return -1;
+    }
+    w->ncols = base;
+    return 0;
+}
+
+static int wire_value(wire_t *w, unsigned int i) {
+    wire_node_t *n = &w->node[i];
+
+    switch(n->type) {
+        case WIRE_OBJECT:
+        if(wire_header(w, i) < 0)
+            return -1;
+        WIRE_EACH(w, c, i)
+            if(wire_value(w, c) < 0)
+                return -1;
+        return 0;
+
+        case WIRE_ARRAY: {
+            int done = n->numbers ? wire_numbers(w, i) : 1;
+            if(done > 0 && w->series)
+                done = wire_series(w, i);
+            if(done <= 0)
+                return done;
+
+            if(wire_byte(w, WIRE_ARRAY) < 0 || wire_varint(w, w->node[i].count) < 0)
+                return -1;
+            WIRE_EACH(w, c, i)
+                if(wire_value(w, c) < 0)
+                    return -1;
+            return 0;
+        }
+
+        case WIRE_STR:
+        return wire_string(w, w->text+n->offset, n->len);
+
+        case WIRE_NUMBER:
+        return wire_byte(w, WIRE_NUMBER) < 0 || wire_bytes(w, w->text+n->offset, n->len) < 0 ? -1 : 0;
+
+        case WIRE_FIXED:
+        return wire_byte(w, WIRE_FIXED) < 0 || wire_byte(w, n->scale) < 0 || wire_varint(w, wire_zigzag(n->mant)) < 0 ? -1 : 0;
+
+        case WIRE_INT:
+        return wire_byte(w, WIRE_INT) < 0 || wire_varint(w, wire_zigzag(n->mant)) < 0 ? -1 : 0;
+    }
+    return wire_byte(w, n->type);
+}
+
+int wire_encode(wire_t *w, packet_t *pkt) {
+    packet_reader_t r;
+    if(packet_fetch(pkt, &r) < 0)
+        return -1;
+
+    if(w->tcap < (size_t)pkt->size) {
+        char *text = realloc(w->text, pkt->size);
+        if(!text) return -1;
+        w->text = text;
+        w->tcap = pkt->size;
+    }
+    w->tsize = packet_read(&r, w->text, pkt->size);
+
+    w->size = 0;
+    w->nnodes = 0;
+    w->ncols = 0;
+    w->nstrings = 0;
+    if(w->slot) memset(w->slot, 0, w->scap*sizeof(wire_string_t));
+    w->nschemas = 0;
+    if(w->schema) memset(w->schema, 0, w->ncap*sizeof(unsigned int)*2);
+    w->delta_values = w->delta_bytes = w->xor_values = w->xor_bytes = 0;
+
+    const char *end = w->text + w->tsize;
+    const char *p = wire_parse(w, w->text, end, NULL, 0);
+    if(!p || wire_ws(p, end) != end)
+        return -1;
+
+    if(wire_room(w, 4) < 0)
+        return -1;
+    memcpy(w->data, WIRE_MAGIC, 3);
+    w->data[3] = WIRE_VERSION;
+    w->size = 4;
+
+    return wire_value(w, 0);
+}
@@ -0,0 +1,857 @@
+/**
+ * @file mysql_standin.c
+ * @author Snyo
+ * @brief Stand-in MySQL server replaying canned results for the mysql plugin
+ *
+ * Speaks enough of the client/server protocol for libmysqlclient: the v10
+ * handshake with any password, COM_QUERY with text result sets (several
+ * per query when statements are separated by ';'), COM_PING, COM_INIT_DB
+ * and COM_QUIT. Every statement the plugin issues has a canned result,
+ * sized by the row count. Anything else gets an error.
+ *
+ * usage: mysql_standin [-p port] [-r rows] [-l latency_ms] [-i innodb_status.txt] [-v]
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define STANDIN_PORT    3307
+#define STANDIN_ROWS    100
+#define STANDIN_VERSION "8.0.36-standin"
+#define STANDIN_STATUS  "bench/data/innodb_status.txt"
+#define STANDIN_METRICS 64
+#define STANDIN_STATEMENTS 16
+#define STANDIN_SCHEMAS 4
+
+#define CLIENT_LONG_PASSWORD     0x00000001
+#define CLIENT_FOUND_ROWS        0x00000002
+#define CLIENT_LONG_FLAG         0x00000004
+#define CLIENT_CONNECT_WITH_DB   0x00000008
+#define CLIENT_PROTOCOL_41       0x00000200
+#define CLIENT_TRANSACTIONS      0x00002000
+#define CLIENT_SECURE_CONNECTION 0x00008000
+#define CLIENT_MULTI_STATEMENTS  0x00010000
+#define CLIENT_MULTI_RESULTS     0x00020000
+#define CLIENT_PLUGIN_AUTH       0x00080000
+
+#define SERVER_STATUS_AUTOCOMMIT 0x0002
+#define SERVER_MORE_RESULTS      0x0008
+
+#define COM_QUIT    0x01
+#define COM_INIT_DB 0x02
+#define COM_QUERY   0x03
+#define COM_PING    0x0e
+
+#define TYPE_VAR_STRING 0xfd
+
+typedef struct conn_t {
+    int fd;
+    unsigned int id;
+    unsigned char seq;
+    unsigned char *out;
+    size_t len, cap;
+    size_t begin;
+} conn_t;
+
+static struct {
+    int rows;
+    int latency;
+    int verbose;
+    char *status;
+    size_t status_len;
+    volatile unsigned long long queries;
+    volatile unsigned int connections;
+} standin;
+
+/*
+ * Output buffer
+ */
+static void put(conn_t *c, const void *p, size_t n) {
+    if(c->len+n > c->cap) {
+        while(c->len+n > c->cap)
+            c->cap = c->cap ? c->cap*2 : 65536;
+        c->out = realloc(c->out, c->cap);
+        if(!c->out) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(c->out+c->len, p, n);
+    c->len += n;
+}
+
+static void put_u8(conn_t *c, unsigned int v) {
+    unsigned char b = v;
+    put(c, &b, 1);
+}
+
+static void put_u16(conn_t *c, unsigned int v) {
+    unsigned char b[2] = {v, v>>8};
+    put(c, b, 2);
+}
+
+static void put_u32(conn_t *c, unsigned int v) {
+    unsigned char b[4] = {v, v>>8, v>>16, v>>24};
+    put(c, b, 4);
+}
+
+static void put_lenenc(conn_t *c, unsigned long long v) {
+    if(v < 251) {
+        put_u8(c, v);
+    } else if(v < 65536) {
+        put_u8(c, 0xfc);
+        put_u16(c, v);
+    } else if(v < 16777216) {
+        unsigned char b[4] = {0xfd, v, v>>8, v>>16};
+        put(c, b, 4);
+    } else {
+        put_u8(c, 0xfe);
+        put_u32(c, v);
+        put_u32(c, v>>32);
+    }
+}
+
+static void put_str(conn_t *c, const char *s, size_t n) {
+    put_lenenc(c, n);
+    put(c, s, n);
+}
+
+/*
+ * Packets are framed in place, the header is filled when the payload ends.
+ * Payloads over 16MB are not needed here.
+ */
+static void begin(conn_t *c) {
+    unsigned char header[4] = {0};
+    c->begin = c->len;
+    put(c, header, 4);
+}
+
+static void end(conn_t *c) {
+    size_t n = c->len - c->begin - 4;
+    c->out[c->begin]   = n;
+    c->out[c->begin+1] = n>>8;
+    c->out[c->begin+2] = n>>16;
+    c->out[c->begin+3] = c->seq++;
+}
+
+static int flush(conn_t *c) {
+    size_t off = 0;
+    while(off < c->len) {
+        ssize_t n = write(c->fd, c->out+off, c->len-off);
+        if(n <= 0) return -1;
+        off += n;
+    }
+    c->len = 0;
+    return 0;
+}
+
+static int readn(int fd, void *buf, size_t n) {
+    size_t off = 0;
+    while(off < n) {
+        ssize_t r = read(fd, (char *)buf+off, n-off);
+        if(r <= 0) return -1;
+        off += r;
+    }
+    return 0;
+}
+
+/*
+ * Reads a whole packet, the caller frees it
+ */
+static unsigned char *receive(conn_t *c, size_t *len) {
+    unsigned char header[4];
+    if(readn(c->fd, header, 4) < 0)
+        return NULL;
+    *len = header[0] | header[1]<<8 | header[2]<<16;
+    c->seq = header[3]+1;
+
+    unsigned char *payload = malloc(*len+1);
+    if(!payload || readn(c->fd, payload, *len) < 0) {
+        free(payload);
+        return NULL;
+    }
+    payload[*len] = '\0';
+    return payload;
+}
+
+/*
+ * Generic packets
+ */
+static void ok(conn_t *c, unsigned int status) {
+    begin(c);
+    put_u8(c, 0x00);
+    put_lenenc(c, 0);
+    put_lenenc(c, 0);
+    put_u16(c, status);
+    put_u16(c, 0);
+    end(c);
+}
+
+static void eof(conn_t *c, unsigned int status) {
+    begin(c);
+    put_u8(c, 0xfe);
+    put_u16(c, 0);
+    put_u16(c, status);
+    end(c);
+}
+
+static void err(conn_t *c, unsigned int code, const char *state, const char *msg) {
+    begin(c);
+    put_u8(c, 0xff);
+    put_u16(c, code);
+    put_u8(c, '#');
+    put(c, state, 5);
+    put(c, msg, strlen(msg));
+    end(c);
+}
+
+/*
+ * Text result sets
+ */
+static void result_begin(conn_t *c, int n, const char **names) {
+    begin(c);
+    put_lenenc(c, n);
+    end(c);
+
+    for(int i=0; i<n; i++) {
+        begin(c);
+        put_str(c, "def", 3);
+        put_str(c, "", 0);
+        put_str(c, "", 0);
+        put_str(c, "", 0);
+        put_str(c, names[i], strlen(names[i]));
+        put_str(c, names[i], strlen(names[i]));
+        put_u8(c, 0x0c);
+        put_u16(c, 33);
+        put_u32(c, 1024);
+        put_u8(c, TYPE_VAR_STRING);
+        put_u16(c, 0);
+        put_u8(c, 0);
+        put_u16(c, 0);
+        end(c);
+    }
+    eof(c, SERVER_STATUS_AUTOCOMMIT);
+}
+
+static void result_row(conn_t *c, int n, const char **values) {
+    begin(c);
+    for(int i=0; i<n; i++) {
+        if(values[i]) put_str(c, values[i], strlen(values[i]));
+        else          put_u8(c, 0xfb);
+    }
+    end(c);
+}
+
+static void result_end(conn_t *c, unsigned int status) {
+    eof(c, status);
+}
+
+/*
+ * Counters grow with every query, so deltas are never 0
+ */
+static unsigned long long counter(const char *name, size_t len) {
+    unsigned long long hash = 0xcbf29ce484222325ULL;
+    for(size_t i=0; i<len; i++)
+        hash = (hash ^ (unsigned char)name[i]) * 0x100000001b3ULL;
+    return standin.queries * (hash%97+1) + hash%100000;
+}
+
+static const char *variable(const char *name, size_t len, char *buf) {
+    static const char *strings[][2] = {
+        {"log_output", "TABLE"},
+        {"slow_query_log_file", "/nonexistent/slow.log"},
+        {"version", STANDIN_VERSION},
+        {"version_comment", "MySQL stand-in"},
+        {"server_uuid", "3e11fa47-71ca-11e1-9e33-c80aa9429562"},
+        {"read_only", "OFF"},
+        {"performance_schema", "ON"},
+        {"threads_running", "4"},
+        {"threads_connected", "20"},
+    };
+    for(int i=0; i<(int)(sizeof(strings)/sizeof(strings[0])); i++)
+        if(strlen(strings[i][0]) == len && !strncasecmp(strings[i][0], name, len))
+            return strings[i][1];
+    sprintf(buf, "%llu", counter(name, len));
+    return buf;
+}
+
+/*
+ * SHOW GLOBAL STATUS/VARIABLES LIKE 'x' or WHERE variable_name IN ('x',...)
+ */
+static void h_show_vars(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[2] = {"Variable_name", "Value"};
+    result_begin(c, 2, cols);
+
+    const char *p = q, *e = q+len;
+    while((p = memchr(p, '\'', e-p))) {
+        const char *name = ++p;
+        if(!(p = memchr(p, '\'', e-p))) break;
+
+        char n[256], v[32];
+        size_t l = p-name < 255 ? p-name : 255;
+        memcpy(n, name, l);
+        n[l] = '\0';
+        const char *values[2] = {n, variable(name, l, v)};
+        result_row(c, 2, values);
+        p++;
+    }
+    result_end(c, status);
+}
+
+static void h_ddl(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[2] = {"name", "value"};
+    static const char *names[3] = {"alter", "create", "drop"};
+    result_begin(c, 2, cols);
+    for(int i=0; i<3; i++) {
+        char v[32];
+        const char *values[2] = {names[i], variable(names[i], strlen(names[i]), v)};
+        result_row(c, 2, values);
+    }
+    result_end(c, status);
+}
+
+static void h_innodb_status(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[3] = {"Type", "Name", "Status"};
+    result_begin(c, 3, cols);
+
+    // Not terminated by the row writer, so written by hand
+    begin(c);
+    put_str(c, "InnoDB", 6);
+    put_str(c, "", 0);
+    put_str(c, standin.status ? standin.status : "", standin.status_len);
+    end(c);
+    result_end(c, status);
+}
+
+static void h_processlist(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[12] = {"id", "thread_id", "info", "user", "host", "db", "time", "timer_wait", "event_id", "event_name", "command", "state"};
+    result_begin(c, 12, cols);
+    for(int i=0; i<standin.rows; i++) {
+        char id[16], tid[16], info[128], host[32], time[16], event[16];
+        sprintf(id, "%d", i+10);
+        sprintf(tid, "%d", i+50);
+        sprintf(info, "select c,pad from sbtest%d where id between %d and %d order by c", i%16, i*100, i*100+99);
+        sprintf(host, "10.0.%d.%d:%d", i/250, i%250, 40000+i);
+        sprintf(time, "%d", i%30);
+        sprintf(event, "%d", i*7);
+        const char *values[12] = {id, tid, i%3 ? info : "", "app", host, "sbtest", time, i%3 ? "0.002" : "", event,
+            i%3 ? "wait/io/table/sql/handler" : "idle", i%3 ? "Query" : "Sleep", i%3 ? "Sending data" : ""};
+        result_row(c, 12, values);
+    }
+    result_end(c, status);
+}
+
+static void h_slow_log(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[8] = {"user_host", "sql_text", "query_time", "start_ms", "rows_sent", "rows_examined", "start_us", "thread_id"};
+    result_begin(c, 8, cols);
+
+    // Always newer than any cursor
+    unsigned long long now = (unsigned long long)time(NULL)*1000000;
+    for(int i=0; i<standin.rows/10; i++) {
+        char sql[128], ms[32], us[32], tid[16], sent[16], examined[16];
+        sprintf(sql, "select * from sbtest%d where k=%d", i%16, i);
+        sprintf(ms, "%llu", now/1000);
+        sprintf(us, "%llu", now);
+        sprintf(tid, "%d", i+50);
+        sprintf(sent, "%d", i);
+        sprintf(examined, "%d", i*1000);
+        const char *values[8] = {"app[app] @ [10.0.0.1]", sql, "2", ms, sent, examined, us, tid};
+        result_row(c, 8, values);
+    }
+    result_end(c, status);
+}
+
+static void h_now(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[1] = {"now"};
+    char v[32];
+    sprintf(v, "%llu", ((unsigned long long)time(NULL)-1800)*1000000);
+    const char *values[1] = {v};
+    result_begin(c, 1, cols);
+    result_row(c, 1, values);
+    result_end(c, status);
+}
+
+static void h_metrics(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[2] = {"name", "value"};
+    int names = strstr(q, "name,type") != NULL;
+    result_begin(c, 2, cols);
+    for(int i=0; i<STANDIN_METRICS; i++) {
+        char name[32], v[32];
+        sprintf(name, "metric_%03d", i);
+        const char *values[2] = {name, names ? (i%4 ? "counter" : "value") : variable(name, strlen(name), v)};
+        result_row(c, 2, values);
+    }
+    result_end(c, status);
+}
+
+static void h_engines(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[2] = {"engine", "support"};
+    static const char *rows[][2] = {{"InnoDB", "DEFAULT"}, {"MyISAM", "YES"}, {"MEMORY", "YES"}, {"CSV", "YES"}, {"PERFORMANCE_SCHEMA", "YES"}};
+    result_begin(c, 2, cols);
+    for(int i=0; i<5; i++)
+        result_row(c, 2, rows[i]);
+    result_end(c, status);
+}
+
+static void h_consumers(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[2] = {"name", "enabled"};
+    static const char *rows[][2] = {{"events_statements_current", "YES"}, {"events_statements_history", "YES"}, {"events_waits_current", "NO"}, {"global_instrumentation", "YES"}, {"thread_instrumentation", "YES"}, {"statements_digest", "YES"}};
+    int enabled = strstr(q, "enabled='YES'") != NULL;
+    result_begin(c, 2, cols);
+    for(int i=0; i<6; i++)
+        if(!enabled || !strcmp(rows[i][1], "YES"))
+            result_row(c, 2, rows[i]);
+    result_end(c, status);
+}
+
+static void h_table_io(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[7] = {"object_schema", "object_name", "index_name", "sum_timer_wait", "count_star", "count_read", "count_write"};
+    result_begin(c, 7, cols);
+    for(int i=0; i<standin.rows; i++) {
+        char table[32], wait[32], star[32], rd[32], wr[32];
+        sprintf(table, "sbtest%d", i/2);
+        unsigned long long n = counter(table, strlen(table)) + i;
+        sprintf(wait, "%llu", n*1000000);
+        sprintf(star, "%llu", n);
+        sprintf(rd, "%llu", n*3/4);
+        sprintf(wr, "%llu", n/4);
+        const char *values[7] = {"sbtest", table, i%2 ? "k_1" : "PRIMARY", wait, star, rd, wr};
+        result_row(c, 7, values);
+    }
+    result_end(c, status);
+}
+
+static void h_file_io(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[7] = {"file_name", "event_name", "null", "sum_timer_wait", "count_star", "read", "write"};
+    result_begin(c, 7, cols);
+    for(int i=0; i<standin.rows/4; i++) {
+        char file[64], wait[32], star[32], rd[32], wr[32];
+        sprintf(file, "/var/lib/mysql/sbtest/sbtest%d.ibd", i);
+        unsigned long long n = counter(file, strlen(file));
+        sprintf(wait, "%llu", n*1000000);
+        sprintf(star, "%llu", n);
+        sprintf(rd, "%llu", n*16384);
+        sprintf(wr, "%llu", n*4096);
+        const char *values[7] = {file, "wait/io/file/innodb/innodb_data_file", NULL, wait, star, rd, wr};
+        result_row(c, 7, values);
+    }
+    result_end(c, status);
+}
+
+static void h_replica(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[6] = {"Channel_Name", "Source_Host", "Replica_IO_Running", "Replica_SQL_Running", "Seconds_Behind_Source", "Relay_Log_Space"};
+    result_begin(c, 6, cols);
+    result_end(c, status);
+}
+
+static void h_workers(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[6] = {"channel_name", "worker_id", "thread_id", "service_state", "last_error_number", "last_error_message"};
+    result_begin(c, 6, cols);
+    result_end(c, status);
+}
+
+static void h_ash(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[3] = {"state", "event", "digest"};
+    static const char *events[4] = {"CPU", "wait/io/table/sql/handler", "wait/synch/mutex/innodb/trx_mutex", "wait/lock/table/sql/handler"};
+    result_begin(c, 3, cols);
+    for(int i=0; i<standin.rows/4; i++) {
+        char digest[65];
+        sprintf(digest, "%064x", i%8);
+        const char *values[3] = {i%2 ? "Sending data" : "executing", events[i%4], digest};
+        result_row(c, 3, values);
+    }
+    result_end(c, status);
+}
+
+static void h_lock_waits(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[3] = {"waiter", "blocker", "object"};
+    result_begin(c, 3, cols);
+
+    // Most wait on two sessions, a few in a chain and a pair in a cycle
+    for(int i=0; i<standin.rows/10; i++) {
+        char waiter[16], blocker[16];
+        sprintf(waiter, "%d", 1000+i);
+        sprintf(blocker, "%d", i<4 ? 1000+i+1 : 50+i%2);
+        const char *values[3] = {waiter, blocker, i%2 ? "sbtest.sbtest1" : "sbtest.sbtest2"};
+        result_row(c, 3, values);
+    }
+    if(standin.rows >= 10) {
+        const char *a[3] = {"2000", "2001", "sbtest.sbtest3"}, *b[3] = {"2001", "2000", "sbtest.sbtest3"};
+        result_row(c, 3, a);
+        result_row(c, 3, b);
+    }
+    result_end(c, status);
+}
+
+static void h_metadata_locks(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[3] = {"waiter", "blocker", "object"};
+    result_begin(c, 3, cols);
+    result_end(c, status);
+}
+
+static void h_thread_detail(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[6] = {"thread_id", "processlist_id", "processlist_user", "processlist_command", "processlist_time", "info"};
+    result_begin(c, 6, cols);
+
+    // One row per id of the in-list
+    const char *p = strstr(q, " in (");
+    while(p && *p && *p != ')') {
+        p += strspn(p, " in(,");
+        char tid[24], id[24];
+        int n = strspn(p, "0123456789");
+        if(n == 0 || n >= 20) break;
+        memcpy(tid, p, n);
+        tid[n] = '\0';
+        sprintf(id, "%llu", strtoull(tid, NULL, 10)+100);
+        const char *values[6] = {tid, id, "app", "Query", "12", "update sbtest1 set k=k+1 where id=42"};
+        result_row(c, 6, values);
+        p += n;
+    }
+    result_end(c, status);
+}
+
+static void h_schemata(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[1] = {"schema_name"};
+    result_begin(c, 1, cols);
+    for(int i=0; i<STANDIN_SCHEMAS; i++) {
+        char schema[16];
+        sprintf(schema, "sbtest%d", i);
+        const char *values[1] = {schema};
+        result_row(c, 1, values);
+    }
+    result_end(c, status);
+}
+
+/*
+ * Ten tables per row of -r in each schema, paged by table_name
+ */
+static void h_tables(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[4] = {"table_name", "data_length", "index_length", "data_free"};
+    const char *after = strstr(q, "table_name>'");
+    const char *limit = strstr(q, " limit ");
+    int from = after && !strncmp(after+12, "t", 1) ? atoi(after+13)+1 : 0;
+    int n = limit ? atoi(limit+7) : standin.rows*10;
+
+    result_begin(c, 4, cols);
+    for(int i=from; i<standin.rows*10 && i<from+n; i++) {
+        char table[16], data[32], index[32], data_free[32];
+        sprintf(table, "t%06d", i);
+        // A few tables grow between reads
+        unsigned long long rows = i%50 ? 1000 : counter(table, strlen(table));
+        sprintf(data, "%llu", rows*16384);
+        sprintf(index, "%llu", rows*4096);
+        sprintf(data_free, "%d", i%7 ? 0 : 4194304);
+        const char *values[4] = {table, data, index, data_free};
+        result_row(c, 4, values);
+    }
+    result_end(c, status);
+}
+
+/*
+ * 450 buckets growing by 1.047 from 10us like the server's, busy around 1ms
+ */
+static void h_statement_histogram(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[3] = {"bucket_timer_low", "bucket_timer_high", "count_bucket"};
+    result_begin(c, 3, cols);
+    double low = 0, high = 10e6;
+    for(int i=0; i<450; i++) {
+        char lo[32], hi[32], count[32];
+        sprintf(lo, "%.0f", low);
+        sprintf(hi, "%.0f", high);
+        sprintf(count, "%llu", i>=100 && i<200 && i%3==0 ? counter(hi, strlen(hi)) : 0);
+        const char *values[3] = {lo, hi, count};
+        result_row(c, 3, values);
+        low = high;
+        high *= 1.047;
+    }
+    result_end(c, status);
+}
+
+static void h_accounts(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[7] = {"user", "host", "null", "wait", "count", "errors", "current_connections"};
+    result_begin(c, 7, cols);
+    for(int i=0; i<standin.rows/10; i++) {
+        char user[16], host[32], wait[32], count[32], errors[32], current[16];
+        sprintf(user, "app%d", i%4);
+        sprintf(host, "10.0.0.%d", i);
+        unsigned long long n = counter(host, strlen(host));
+        sprintf(wait, "%llu", n*1000000);
+        sprintf(count, "%llu", n);
+        sprintf(errors, "%llu", n/100);
+        sprintf(current, "%d", i%5);
+        const char *values[7] = {user, host, NULL, wait, count, errors, current};
+        result_row(c, 7, values);
+    }
+    result_end(c, status);
+}
+
+/*
+ * A few old transactions, one of them replaced every 8 queries
+ */
+static void h_innodb_trx(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[10] = {"trx_id", "thread", "age", "state", "rows_modified", "lock_structs", "rows_locked", "user", "host", "sql"};
+    result_begin(c, 10, cols);
+    for(int i=0; i<standin.rows/25; i++) {
+        char id[32], thread[16], age[16], modified[32], structs[16], locked[32], sql[128];
+        unsigned long long generation = i ? 0 : standin.queries/8;
+        sprintf(id, "%llu", 421000000ULL + i*1000 + generation);
+        sprintf(thread, "%d", i+10);
+        sprintf(age, "%d", 3600 - i*600);
+        sprintf(modified, "%llu", i%2 ? 0 : standin.queries*10);
+        sprintf(structs, "%d", i+2);
+        sprintf(locked, "%d", i*100);
+        sprintf(sql, "update sbtest%d set k=k+1 where id=%d", i, i*7);
+        const char *values[10] = {id, thread, age, "RUNNING", modified, structs, locked, "app", "10.0.0.1:40000", sql};
+        result_row(c, 10, values);
+    }
+    result_end(c, status);
+}
+
+static void h_history_len(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[1] = {"count"};
+    char v[32];
+    sprintf(v, "%llu", 1000 + standin.queries*3);
+    const char *values[1] = {v};
+    result_begin(c, 1, cols);
+    result_row(c, 1, values);
+    result_end(c, status);
+}
+
+/*
+ * Capability probes, every table exists on the stand-in
+ */
+static void h_probe(conn_t *c, const char *q, size_t len, unsigned int status) {
+    static const char *cols[1] = {"1"};
+    result_begin(c, 1, cols);
+    result_end(c, status);
+}
+
+/*
+ * First match wins, so more specific needles come first
+ */
+static const struct {
+    const char *needle;
+    void (*handle)(conn_t *, const char *, size_t, unsigned int);
+} canned[] = {
+    {"select 1 from ",                           h_probe},
+    {"show global status",                       h_show_vars},
+    {"show global variables",                    h_show_vars},
+    {"select 'alter' name",                      h_ddl},
+    {"show engine innodb status",                h_innodb_status},
+    {"information_schema.innodb_trx",            h_innodb_trx},
+    {"information_schema.processlist",           h_processlist},
+    {"mysql.slow_log",                           h_slow_log},
+    {"interval 30 minute",                       h_now},
+    {"trx_rseg_history_len",                     h_history_len},
+    {"information_schema.innodb_metrics",        h_metrics},
+    {"information_schema.engines",               h_engines},
+    {"setup_consumers",                          h_consumers},
+    {"table_io_waits_summary_by_index_usage",    h_table_io},
+    {"file_summary_by_instance",                 h_file_io},
+    {"show replica status",                      h_replica},
+    {"show slave status",                        h_replica},
+    {"replication_applier_status_by_worker",     h_workers},
+    {"performance_schema.data_lock_waits",       h_lock_waits},
+    {"information_schema.innodb_lock_waits",     h_lock_waits},
+    {"performance_schema.metadata_locks",        h_metadata_locks},
+    {"performance_schema.threads where",         h_thread_detail},
+    {"performance_schema.threads t",             h_ash},
+    {"information_schema.schemata",              h_schemata},
+    {"events_statements_histogram_global",       h_statement_histogram},
+    {"performance_schema.accounts",              h_accounts},
+    {"information_schema.tables",                h_tables},
+};
+
+/*
+ * One statement, 'more' when others follow it
+ */
+static void statement(conn_t *c, const char *q, size_t len, int more) {
+    unsigned int status = SERVER_STATUS_AUTOCOMMIT | (more ? SERVER_MORE_RESULTS : 0);
+    __sync_fetch_and_add(&standin.queries, 1);
+    if(standin.latency)
+        usleep(standin.latency*1000);
+    if(standin.verbose)
+        fprintf(stderr, "[%u] %.*s\n", c->id, (int)len, q);
+
+    while(len && (*q == ' ' || *q == '\n'))
+        q++, len--;
+    if(len >= 4 && !strncasecmp(q, "set ", 4)) {
+        ok(c, status);
+        return;
+    }
+
+    char buf[8192];
+    size_t n = len < sizeof(buf)-1 ? len : sizeof(buf)-1;
+    for(size_t i=0; i<n; i++)
+        buf[i] = q[i] >= 'A' && q[i] <= 'Z' ? q[i]-'A'+'a' : q[i];
+    buf[n] = '\0';
+
+    for(int i=0; i<(int)(sizeof(canned)/sizeof(canned[0])); i++) {
+        if(strstr(buf, canned[i].needle)) {
+            canned[i].handle(c, q, len, status);
+            return;
+        }
+    }
+    err(c, 1146, "42S02", "No canned result for this statement");
+}
+
+/*
+ * Splits on ';' outside of quotes
+ */
+static void query(conn_t *c, const char *q, size_t len) {
+    const char *stmt[STANDIN_STATEMENTS];
+    size_t size[STANDIN_STATEMENTS];
+    int n = 0;
+
+    const char *s = q, *e = q+len;
+    char quote = 0;
+    for(const char *p=q; p<=e && n<STANDIN_STATEMENTS; p++) {
+        if(p < e && quote) {
+            if(*p == quote) quote = 0;
+        } else if(p < e && (*p == '\'' || *p == '"' || *p == '`')) {
+            quote = *p;
+        } else if(p == e || *p == ';') {
+            if(strspn(s, " \t\r\n") < (size_t)(p-s)) {
+                stmt[n] = s;
+                size[n++] = p-s;
+            }
+            s = p+1;
+        }
+    }
+
+    if(n == 0)
+        err(c, 1065, "42000", "Query was empty");
+    for(int i=0; i<n; i++)
+        statement(c, stmt[i], size[i], i<n-1);
+}
+
+static void *session(void *arg) {
+    conn_t c = {.fd = (int)(long)arg, .id = __sync_add_and_fetch(&standin.connections, 1)};
+
+    // Handshake v10, auth data is not checked
+    begin(&c);
+    put_u8(&c, 10);
+    put(&c, STANDIN_VERSION, sizeof(STANDIN_VERSION));
+    put_u32(&c, c.id);
+    put(&c, "abcdefgh", 8);
+    put_u8(&c, 0);
+    unsigned int caps = CLIENT_LONG_PASSWORD | CLIENT_FOUND_ROWS | CLIENT_LONG_FLAG | CLIENT_CONNECT_WITH_DB | CLIENT_PROTOCOL_41
+        | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION | CLIENT_MULTI_STATEMENTS | CLIENT_MULTI_RESULTS | CLIENT_PLUGIN_AUTH;
+    put_u16(&c, caps);
+    put_u8(&c, 33);
+    put_u16(&c, SERVER_STATUS_AUTOCOMMIT);
+    put_u16(&c, caps>>16);
+    put_u8(&c, 21);
+    put(&c, "\0\0\0\0\0\0\0\0\0\0", 10);
+    put(&c, "ijklmnopqrst", 13);
+    put(&c, "mysql_native_password", 22);
+    end(&c);
+
+    size_t len;
+    unsigned char *pkt;
+    if(flush(&c) < 0 || !(pkt = receive(&c, &len)))
+        goto out;
+    free(pkt);
+    ok(&c, SERVER_STATUS_AUTOCOMMIT);
+    if(flush(&c) < 0)
+        goto out;
+
+    while((pkt = receive(&c, &len))) {
+        if(len == 0 || pkt[0] == COM_QUIT) {
+            free(pkt);
+            break;
+        }
+        switch(pkt[0]) {
+            case COM_QUERY:
+            query(&c, (char *)pkt+1, len-1);
+            break;
+
+            case COM_PING:
+            case COM_INIT_DB:
+            ok(&c, SERVER_STATUS_AUTOCOMMIT);
+            break;
+
+            default:
+            err(&c, 1047, "08S01", "Unknown command");
+            break;
+        }
+        free(pkt);
+        if(flush(&c) < 0)
+            break;
+    }
+
+out:
+    close(c.fd);
+    free(c.out);
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-p port] [-r rows] [-l latency_ms] [-i innodb_status.txt] [-v]\n", name);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int port = STANDIN_PORT;
+    const char *status = STANDIN_STATUS;
+    standin.rows = STANDIN_ROWS;
+
+    int opt;
+    while((opt = getopt(argc, argv, "p:r:l:i:v")) != -1) {
+        switch(opt) {
+            case 'p': port = atoi(optarg); break;
+            case 'r': standin.rows = atoi(optarg); break;
+            case 'l': standin.latency = atoi(optarg); break;
+            case 'i': status = optarg; break;
+            case 'v': standin.verbose = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+
+    FILE *fp = fopen(status, "rb");
+    if(fp) {
+        fseek(fp, 0, SEEK_END);
+        standin.status_len = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if((standin.status = malloc(standin.status_len+1))
+                && fread(standin.status, 1, standin.status_len, fp) != standin.status_len)
+            standin.status_len = 0;
+        fclose(fp);
+    } else {
+        fprintf(stderr, "%s: %s not found, InnoDB status will be empty\n", argv[0], status);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("bind");
+        return 1;
+    }
+    fprintf(stderr, "%s: listening on 127.0.0.1:%d, %d rows, %dms latency\n", argv[0], port, standin.rows, standin.latency);
+
+    for(;;) {
+        int client = accept(fd, NULL, NULL);
+        if(client < 0) continue;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+        pthread_t t;
+        if(pthread_create(&t, NULL, session, (void *)(long)client) == 0)
+            pthread_detach(t);
+        else
+            close(client);
+    }
+
+    return 0;
+}
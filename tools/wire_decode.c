@@ -0,0 +1,479 @@
+/**
+ * @file wire_decode.c
+ * @author Snyo
+ * @brief Print a binary packet as the JSON it was encoded from
+ *
+ * Reads a packet in the format of inc/wire.h and writes it back as JSON,
+ * to check an encoder or look at what an agent sent. Integers and strings
+ * come back as they were; decimals of a column or a series share the
+ * largest scale.
+ *
+ * usage: wire_decode [packet.bin] [-s]
+ *        -s prints the size of each kind of value to stderr
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define WIRE_MAGIC   "MGB"
+#define WIRE_VERSION 1
+
+enum wire_tag {
+    WIRE_NULL, WIRE_FALSE, WIRE_TRUE, WIRE_INT, WIRE_FIXED, WIRE_STR, WIRE_STRREF,
+    WIRE_NUMBER, WIRE_ARRAY, WIRE_INTS, WIRE_FIXEDS, WIRE_SCHEMA, WIRE_OBJECT,
+    WIRE_SERIES, WIRE_VALUES, WIRE_DELTA, WIRE_XOR, WIRE_FIELDS, WIRE_ELEMENTS, WIRE_TAGS
+};
+
+static const char *tag_names[WIRE_TAGS] = {
+    "null", "false", "true", "int", "fixed", "string", "strref",
+    "number", "array", "ints", "fixeds", "schema", "object",
+    "series", "values", "delta", "xor", "fields", "elements"
+};
+
+typedef struct span_t {
+    const unsigned char *s;
+    unsigned long long len;
+} span_t;
+
+/*
+ * Values are decoded into a tree first, columns of a series fill the
+ * objects of all its rows
+ */
+typedef struct node_t {
+    int type;       // WIRE_NULL to WIRE_NUMBER, WIRE_ARRAY or WIRE_OBJECT
+    int scale;
+    int schema;     // Of an object
+    long long v;
+    span_t s;
+    unsigned long long count;
+    struct node_t *child;
+} node_t;
+
+typedef struct schema_t {
+    unsigned int id;
+    int n;
+    span_t *keys;
+} schema_t;
+
+static const unsigned char *begin, *in, *end;
+static span_t *strings;
+static int nstrings, scap;
+static schema_t *schemas;
+static int nschemas, ncap;
+static unsigned long long bytes[WIRE_TAGS], counts[WIRE_TAGS];
+
+static void fail(const char *what) {
+    fprintf(stderr, "Malformed packet at byte %ld: %s\n", (long)(in-begin), what);
+    exit(1);
+}
+
+static unsigned long long varint() {
+    unsigned long long v = 0;
+    for(int shift=0; shift<64; shift+=7) {
+        if(in >= end) fail("truncated varint");
+        unsigned char b = *in++;
+        v |= (unsigned long long)(b & 0x7f) << shift;
+        if(!(b & 0x80)) return v;
+    }
+    fail("varint too long");
+    return 0;
+}
+
+static long long zigzag() {
+    unsigned long long v = varint();
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+static span_t span() {
+    span_t sp;
+    sp.len = varint();
+    if(sp.len > (unsigned long long)(end - in)) fail("truncated bytes");
+    sp.s = in;
+    in += sp.len;
+    return sp;
+}
+
+static void print_string(const unsigned char *s, unsigned long long len) {
+    putchar('"');
+    for(unsigned long long i=0; i<len; i++) {
+        unsigned char c = s[i];
+        switch(c) {
+            case '"':  fputs("\\\"", stdout); break;
+            case '\\': fputs("\\\\", stdout); break;
+            case '\n': fputs("\\n", stdout); break;
+            case '\r': fputs("\\r", stdout); break;
+            case '\t': fputs("\\t", stdout); break;
+            case '\b': fputs("\\b", stdout); break;
+            case '\f': fputs("\\f", stdout); break;
+            default:
+            if(c < 0x20) printf("\\u%04x", c);
+            else putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_fixed(long long m, int scale) {
+    unsigned long long u = m < 0 ? -(unsigned long long)m : (unsigned long long)m;
+    unsigned long long p = 1;
+    for(int i=0; i<scale; i++) p *= 10;
+    if(scale) printf("%s%llu.%0*llu", m < 0 ? "-" : "", u/p, scale, u%p);
+    else printf("%lld", m);
+}
+
+static node_t *children(unsigned long long n) {
+    node_t *c = calloc(n ? n : 1, sizeof(node_t));
+    if(!c) fail("out of memory");
+    return c;
+}
+
+/*
+ * Bits from the most significant
+ */
+static unsigned long long acc;
+static int nbits;
+
+static unsigned long long bits(int n) {
+    unsigned long long v = 0;
+    while(n > 0) {
+        if(!nbits) {
+            if(in >= end) fail("truncated bits");
+            acc = *in++;
+            nbits = 8;
+        }
+        int take = n < nbits ? n : nbits;
+        v = (v << take) | ((acc >> (nbits - take)) & ((1ULL << take) - 1));
+        nbits -= take;
+        n -= take;
+    }
+    return v;
+}
+
+static unsigned long long bits64(int n) {
+    unsigned long long high = n > 32 ? bits(n-32) : 0;
+    return high << 32 | bits(n > 32 ? 32 : n);
+}
+
+static long long unzigzag(unsigned long long v) {
+    return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+static int header(int define) {
+    unsigned int id = varint();
+    if(define) {
+        if(nschemas == ncap) {
+            ncap = ncap ? ncap*2 : 64;
+            schemas = realloc(schemas, ncap*sizeof(schema_t));
+        }
+        int sc = nschemas++;
+        schemas[sc].id = id;
+        schemas[sc].n = varint();
+        schemas[sc].keys = malloc((schemas[sc].n ? schemas[sc].n : 1)*sizeof(span_t));
+        for(int k=0; k<schemas[sc].n; k++)
+            schemas[sc].keys[k] = span();
+        return sc;
+    }
+    // The latest definition of an id wins
+    for(int i=nschemas-1; i>=0; i--)
+        if(schemas[i].id == id) return i;
+    fail("unknown schema");
+    return -1;
+}
+
+static int object_header() {
+    if(in >= end || (*in != WIRE_SCHEMA && *in != WIRE_OBJECT)) fail("expected a schema");
+    return header(*in++ == WIRE_SCHEMA);
+}
+
+static void value(node_t *v);
+
+static void column(node_t **rows, unsigned long long n) {
+    if(in >= end) fail("truncated column");
+    const unsigned char *at = in;
+    int tag = *in++;
+
+    switch(tag) {
+        case WIRE_VALUES:
+        for(unsigned long long j=0; j<n; j++)
+            value(rows[j]);
+        return;
+
+        case WIRE_DELTA:
+        case WIRE_XOR: {
+            if(in >= end) fail("truncated scale");
+            int scale = *in++;
+            if(tag == WIRE_DELTA) {
+                long long v = zigzag();
+                unsigned long long delta = 0;
+                for(unsigned long long j=0; j<n; j++) {
+                    if(j) {
+                        int width = 0;
+                        if(bits(1)) width = !bits(1) ? 7 : !bits(1) ? 9 : !bits(1) ? 12 : !bits(1) ? 32 : 64;
+                        unsigned long long z = bits64(width);
+                        delta += (unsigned long long)unzigzag(z);
+                        v = (long long)((unsigned long long)v + delta);
+                    }
+                    rows[j]->v = v;
+                }
+            } else {
+                union { double d; unsigned long long u; } x;
+                int lead = 0, len = 0;
+                x.u = bits64(64);
+                for(unsigned long long j=0; j<n; j++) {
+                    if(j && bits(1)) {
+                        if(bits(1)) {
+                            lead = bits(5);
+                            len = bits(6);
+                            if(!len) len = 64;
+                            if(lead+len > 64) fail("bad xor window");
+                        } else if(!len) {
+                            fail("xor window before any");
+                        }
+                        unsigned long long m = bits64(len);
+                        x.u ^= m << (64 - lead - len);
+                    }
+                    rows[j]->v = (long long)x.d;
+                }
+            }
+            nbits = 0;
+            for(unsigned long long j=0; j<n; j++) {
+                rows[j]->type = scale ? WIRE_FIXED : WIRE_INT;
+                rows[j]->scale = scale;
+            }
+            counts[tag] += n;
+            bytes[tag] += in - at;
+            return;
+        }
+
+        case WIRE_FIELDS:
+        case WIRE_ELEMENTS: {
+            int sc = -1;
+            unsigned long long count;
+            if(tag == WIRE_FIELDS) {
+                sc = object_header();
+                count = schemas[sc].n;
+            } else {
+                count = varint();
+            }
+            for(unsigned long long j=0; j<n; j++) {
+                rows[j]->type = tag == WIRE_FIELDS ? WIRE_OBJECT : WIRE_ARRAY;
+                rows[j]->schema = sc;
+                rows[j]->count = count;
+                rows[j]->child = children(count);
+            }
+            node_t **cells = malloc((n ? n : 1)*sizeof(node_t *));
+            for(unsigned long long k=0; k<count; k++) {
+                for(unsigned long long j=0; j<n; j++)
+                    cells[j] = &rows[j]->child[k];
+                column(cells, n);
+            }
+            free(cells);
+            return;
+        }
+    }
+    fail("unknown column");
+}
+
+static void value(node_t *v) {
+    if(in >= end) fail("truncated value");
+    const unsigned char *at = in;
+    int tag = *in++;
+    if(tag >= WIRE_TAGS) fail("unknown tag");
+    counts[tag]++;
+    v->type = tag;
+
+    switch(tag) {
+        case WIRE_NULL:
+        case WIRE_FALSE:
+        case WIRE_TRUE:
+        break;
+
+        case WIRE_INT:
+        v->v = zigzag();
+        break;
+
+        case WIRE_FIXED:
+        if(in >= end) fail("truncated scale");
+        v->scale = *in++;
+        v->v = zigzag();
+        break;
+
+        case WIRE_STR:
+        v->s = span();
+        if(nstrings == scap) {
+            scap = scap ? scap*2 : 1024;
+            strings = realloc(strings, scap*sizeof(span_t));
+        }
+        strings[nstrings++] = v->s;
+        break;
+
+        case WIRE_STRREF: {
+            unsigned long long i = varint();
+            if(i >= (unsigned long long)nstrings) fail("unknown string");
+            v->type = WIRE_STR;
+            v->s = strings[i];
+            break;
+        }
+
+        case WIRE_NUMBER:
+        v->s = span();
+        break;
+
+        case WIRE_ARRAY:
+        v->count = varint();
+        v->child = children(v->count);
+        for(unsigned long long i=0; i<v->count; i++)
+            value(&v->child[i]);
+        break;
+
+        case WIRE_INTS:
+        case WIRE_FIXEDS: {
+            int scale = 0;
+            if(tag == WIRE_FIXEDS) {
+                if(in >= end) fail("truncated scale");
+                scale = *in++;
+            }
+            v->type = WIRE_ARRAY;
+            v->count = varint();
+            v->child = children(v->count);
+            unsigned long long prev = 0;
+            for(unsigned long long i=0; i<v->count; i++) {
+                prev += (unsigned long long)zigzag();
+                v->child[i].type = scale ? WIRE_FIXED : WIRE_INT;
+                v->child[i].scale = scale;
+                v->child[i].v = (long long)prev;
+            }
+            break;
+        }
+
+        case WIRE_SCHEMA:
+        case WIRE_OBJECT:
+        v->type = WIRE_OBJECT;
+        v->schema = header(tag == WIRE_SCHEMA);
+        v->count = schemas[v->schema].n;
+        v->child = children(v->count);
+        for(unsigned long long k=0; k<v->count; k++)
+            value(&v->child[k]);
+        break;
+
+        case WIRE_SERIES: {
+            int sc = object_header();
+            unsigned long long n = varint();
+            v->type = WIRE_ARRAY;
+            v->count = n;
+            v->child = children(n);
+            for(unsigned long long j=0; j<n; j++) {
+                v->child[j].type = WIRE_OBJECT;
+                v->child[j].schema = sc;
+                v->child[j].count = schemas[sc].n;
+                v->child[j].child = children(schemas[sc].n);
+            }
+            node_t **cells = malloc((n ? n : 1)*sizeof(node_t *));
+            for(int k=0; k<schemas[sc].n; k++) {
+                for(unsigned long long j=0; j<n; j++)
+                    cells[j] = &v->child[j].child[k];
+                column(cells, n);
+            }
+            free(cells);
+            break;
+        }
+
+        default:
+        fail("column outside a series");
+    }
+
+    // Containers count only their own header
+    if(tag != WIRE_ARRAY && tag != WIRE_SCHEMA && tag != WIRE_OBJECT && tag != WIRE_SERIES)
+        bytes[tag] += in - at;
+}
+
+static void print(const node_t *v) {
+    switch(v->type) {
+        case WIRE_NULL:   fputs("null", stdout); break;
+        case WIRE_FALSE:  fputs("false", stdout); break;
+        case WIRE_TRUE:   fputs("true", stdout); break;
+        case WIRE_INT:
+        case WIRE_FIXED:  print_fixed(v->v, v->scale); break;
+        case WIRE_STR:    print_string(v->s.s, v->s.len); break;
+        case WIRE_NUMBER: printf("%.*s", (int)v->s.len, v->s.s); break;
+
+        case WIRE_ARRAY:
+        putchar('[');
+        for(unsigned long long i=0; i<v->count; i++) {
+            if(i) putchar(',');
+            print(&v->child[i]);
+        }
+        putchar(']');
+        break;
+
+        case WIRE_OBJECT: {
+            span_t *keys = schemas[v->schema].keys;
+            putchar('{');
+            for(unsigned long long k=0; k<v->count; k++) {
+                printf("%s\"%.*s\":", k?",":"", (int)keys[k].len, keys[k].s);
+                print(&v->child[k]);
+            }
+            putchar('}');
+            break;
+        }
+    }
+}
+
+static void release(node_t *v) {
+    if(!v->child) return;
+    for(unsigned long long i=0; i<v->count; i++)
+        release(&v->child[i]);
+    free(v->child);
+}
+
+int main(int argc, char **argv) {
+    const char *path = NULL;
+    int stats = 0;
+    for(int i=1; i<argc; i++) {
+        if(!strcmp(argv[i], "-s")) stats = 1;
+        else path = argv[i];
+    }
+
+    FILE *fp = path ? fopen(path, "rb") : stdin;
+    if(!fp) {
+        perror(path);
+        return 1;
+    }
+    size_t size = 0, cap = 65536;
+    unsigned char *buf = malloc(cap);
+    size_t n;
+    while((n = fread(buf+size, 1, cap-size, fp)) > 0) {
+        size += n;
+        if(size == cap) buf = realloc(buf, cap *= 2);
+    }
+    if(path) fclose(fp);
+
+    if(size < 4 || memcmp(buf, WIRE_MAGIC, 3) || buf[3] != WIRE_VERSION) {
+        fprintf(stderr, "Not a version %d packet\n", WIRE_VERSION);
+        return 1;
+    }
+    begin = buf;
+    in = buf+4;
+    end = buf+size;
+    node_t root = {0};
+    value(&root);
+    print(&root);
+    putchar('\n');
+    if(in != end)
+        fprintf(stderr, "%ld bytes after the packet\n", (long)(end-in));
+
+    if(stats) {
+        fprintf(stderr, "%zu bytes, %d strings, %d schemas\n", size, nstrings, nschemas);
+        for(int t=0; t<WIRE_TAGS; t++)
+            if(counts[t])
+                fprintf(stderr, "%8s %10llu values %10llu bytes\n", tag_names[t], counts[t], bytes[t]);
+    }
+
+    release(&root);
+    for(int i=0; i<nschemas; i++)
+        free(schemas[i].keys);
+    free(schemas);
+    free(strings);
+    free(buf);
+    return 0;
+}